@@ -18,6 +18,10 @@
 /// @file apiutil.h Defines macros and functions for implementation simplicity.
 
 #include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "socket.h"
 
 namespace RemoteCL
 {
@@ -35,6 +39,38 @@ void Store(T data, void* ptr, std::size_t availableSize, std::size_t* sizeRet)
 		*sizeRet = sizeof(T);
 	}
 }
+
+/// Reads an integer out of an info value, as sent by the server or kept by an object.
+/// @throws Socket::Error if the value is too short.
+template<typename T>
+T ReadValue(const std::vector<uint8_t>& value, std::size_t index = 0)
+{
+	T t;
+	if ((index + 1) * sizeof(T) > value.size()) throw Socket::Error();
+	std::memcpy(&t, value.data() + index * sizeof(T), sizeof(T));
+	return t;
+}
+
+/// Encodes this value in the form of a query reply, to be kept by an object.
+template<typename T>
+std::vector<uint8_t> EncodeValue(const T& value)
+{
+	const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+	return std::vector<uint8_t>(bytes, bytes + sizeof(T));
+}
+
+/// Used for API query functions returning data of variable size.
+/// Copies it out if sufficient space exists.
+inline void StoreData(const std::vector<uint8_t>& data, void* ptr, std::size_t availableSize,
+                      std::size_t* sizeRet)
+{
+	if (ptr != nullptr && availableSize >= data.size()) {
+		std::memcpy(ptr, data.data(), data.size());
+	}
+	if (sizeRet != nullptr) {
+		*sizeRet = data.size();
+	}
+}
 } // namespace Client
 } // namespace RemoteCL
 
@@ -18,11 +18,18 @@
 #include "socketstream.h"
 #include "objects.h"
 #include "packets/callbacks.h"
+#include "packets/channel.h"
+#include "packets/inventory.h"
+#include "packets/refcount.h"
+#include "packets/sharedmemory.h"
 #include "packets/version.h"
 #include "packets/terminate.h"
 
+#include <algorithm>
+#include <cassert>
 #include <cstdlib> // getenv
 #include <cstring>
+#include <system_error>
 #include <thread>
 
 using namespace RemoteCL;
@@ -32,6 +39,10 @@ Connection RemoteCL::Client::gConnection;
 
 namespace
 {
+/// How long to wait on the connection of a channel, in milliseconds. Queues use the main
+/// channel if it does not come through in time, as when a firewall drops it.
+constexpr int ChannelConnectTimeout = 1000;
+
 std::string ParseServerName(const char* name)
 {
 	const char* end = name;
@@ -51,50 +62,28 @@ std::string ParseServerName(const char* name)
 	return std::string(name, end-name);
 }
 
-/// The connection callback handler.
-bool HandleCallbacks(PacketStream& eventStream, std::vector<std::unique_ptr<Callback>>& callbacks,
-                     std::mutex& mutex)
-{
-	switch (eventStream.nextPacketTy()) {
-		case PacketType::Terminate:
-			return false;
-
-		case PacketType::CallbackTrigger: {
-			uint32_t index = eventStream.read<CallbackTriggerPacket>();
-			std::unique_lock<std::mutex> lock(mutex);
-			if (index >= callbacks.size() || callbacks[index] == nullptr) {
-				std::cerr << "Invalid server-side event trigger - ignored." << std::endl;
-				return true;
-			}
-			callbacks[index]->trigger(eventStream);
-			// Should we reset callbacks[index] ? callbacks shouldn't be run twice, right?
-		}
-		break;
-
-		default:
-			// We don't handle any other types of packets through this stream.
-			std::cerr << "Unexpected packet in event stream" << std::endl;
-			return false;
-	}
-	return true;
-}
-
-void CallbackThreadMain(std::unique_ptr<PacketStream>& eventStream, std::vector<std::unique_ptr<Callback>>& callbacks,
-                        std::mutex& mutex) noexcept
+/// Moves the large payloads of this stream through shared memory with rings of this size.
+/// @returns false if they keep going through the socket.
+bool AttachSharedMemory(PacketStream& stream, uint64_t ringSize)
 {
 	try {
-		while (HandleCallbacks(*eventStream, callbacks, mutex)) {
-
-		}
-	} catch (...) {
-		// If an exception triggers, we don't really care, the callback handler
-		// will terminate. Ensure that the stream itself is reset, so that the
-		// host application has the appropriate errors returned.
-		std::cerr << "Event Stream terminated." << std::endl;
-		// This is very much thread-unsafe, but it is an unlikely case.
-		// It'd be overkill to mutex-lock this.
-		eventStream.reset();
+		std::unique_ptr<SharedMemory> sharedMemory(new SharedMemory(ringSize));
+		OpenSharedMemory packet;
+		packet.mName = sharedMemory->name();
+		packet.mRingSize = ringSize;
+		stream.write(packet).flush();
+		stream.read<SuccessPacket>();
+		// Both ends have it mapped; the name is no longer needed.
+		sharedMemory->unlink();
+		stream.attach(std::move(sharedMemory));
+		return true;
+	} catch (const ErrorPacket&) {
+		std::clog << "RemoteCL Server could not map shared memory; using the socket only." << std::endl;
+	} catch (const std::system_error& e) {
+		std::clog << "RemoteCL Client could not create shared memory (" << e.what()
+		          << "); using the socket only." << std::endl;
 	}
+	return false;
 }
 } // anon namespace
 
@@ -109,7 +98,17 @@ Connection::Connection() noexcept
 {
 	try {
 		uint16_t port = Socket::DefaultPort;
-		std::string serverName = DEFAULT_REMOTE_HOST;
+		std::string& serverName = mServerName;
+		serverName = DEFAULT_REMOTE_HOST;
+		// Unix domain socket of a server on this machine, which takes precedence over the host.
+		std::string localPath;
+		// Size of each shared memory ring in MiB, used with a server on this machine.
+		unsigned long sharedRingMiB = 64;
+		std::size_t& bufferSize = mBufferSize;
+#if defined(REMOTECL_ENABLE_ASYNC)
+		// Open a channel for each queue, if the server can.
+		bool channels = true;
+#endif
 
 #if defined(_MSC_VER)
 		WSADATA wsaData;
@@ -132,44 +131,119 @@ Connection::Connection() noexcept
 				hostStr += 5;
 				serverName = ParseServerName(hostStr);
 			}
+			if (const char* pathStr = std::strstr(envVar, "path=")) {
+				pathStr += 5;
+				localPath = ParseServerName(pathStr);
+			}
+			if (const char* bufferStr = std::strstr(envVar, "buffer=")) {
+				bufferStr += 7;
+				char* end;
+				unsigned long kib = std::strtoul(bufferStr, &end, 10);
+				if (end != bufferStr) {
+					bufferSize = kib << 10;
+				}
+			}
+			if (const char* shmStr = std::strstr(envVar, "shm=")) {
+				shmStr += 4;
+				char* end;
+				unsigned long newSize = std::strtoul(shmStr, &end, 10);
+				if (end != shmStr) {
+					sharedRingMiB = newSize;
+				}
+			}
+			if (const char* batchStr = std::strstr(envVar, "batch=")) {
+				batchStr += 6;
+				char* end;
+				std::size_t newBatch = std::strtoul(batchStr, &end, 10);
+				if (end != batchStr) {
+					mBatchBytes = newBatch;
+				}
+			}
+			if (const char* delayStr = std::strstr(envVar, "batchus=")) {
+				delayStr += 8;
+				char* end;
+				unsigned long newDelay = std::strtoul(delayStr, &end, 10);
+				if (end != delayStr) {
+					mBatchDelay = std::chrono::microseconds(newDelay);
+				}
+			}
+			mPrintStats = std::strstr(envVar, "stats") != nullptr;
+			mFoldKernelArgs = std::strstr(envVar, "eagerargs") == nullptr;
+#if defined(REMOTECL_ENABLE_ASYNC)
+			channels = std::strstr(envVar, "nochannels") == nullptr;
+#endif
 		}
 
-		mStream.reset(new PacketStream(Socket(serverName.c_str(), port)));
+		mMain.mStream.reset(new PacketStream(localPath.empty() ? Socket(serverName.c_str(), port)
+		                                                       : Socket::connectLocal(localPath.c_str()),
+		                                     bufferSize));
+		// Lets the server tell when a batch has arrived whole.
+		mMain.mStream->frameWrites();
 
-		VersionPacket serverVersion = mStream->read<VersionPacket>();
+		VersionPacket serverVersion = mMain.mStream->read<VersionPacket>();
 		VersionPacket currentVersion;
 		if (!currentVersion.isCompatibleWith(serverVersion)) {
 			// The versions are not compatible
 			std::cerr << "The RemoteCL server version is not compatible with this client. Disconnecting.\n";
-			mStream.reset();
+			if (serverVersion.idSize() != currentVersion.idSize()) {
+				std::cerr << "The server uses " << serverVersion.idSize() * 8 << "-bit object IDs, this client "
+				          << currentVersion.idSize() * 8 << "-bit ones (see REMOTECL_WIDE_IDS).\n";
+			}
+			mMain.mStream.reset();
 			return;
 		}
 
+		// The server lists its platforms and devices straight away.
+		InventoryPacket inventory = mMain.mStream->read<InventoryPacket>();
+		{
+			LockedConnection conn(*this, mMain);
+			for (InventoryPacket::Platform& entry : inventory.mPlatforms) {
+				PlatformID& platform = conn.getOrInsertObject<PlatformID>(entry.mID);
+				for (InventoryPacket::Info& info : entry.mInfo) {
+					platform.mInfo[info.mParam] = std::move(info.mValue);
+				}
+				for (InventoryPacket::Object& deviceEntry : entry.mDevices) {
+					DeviceID& device = conn.getOrInsertObject<DeviceID>(deviceEntry.mID);
+					for (InventoryPacket::Info& info : deviceEntry.mInfo) {
+						device.mInfo[info.mParam] = std::move(info.mValue);
+					}
+					platform.mDevices.push_back(device.ID);
+				}
+				platform.mDevicesListed = entry.mDevicesListed;
+				mPlatforms.push_back(platform.ID);
+			}
+		}
+
 #if defined(REMOTECL_ENABLE_ASYNC)
 		if (serverVersion.eventEnabled()) {
-			// Attempt to negotiate a server-side stream.
-			mStream->write<OpenEventStream>({}).flush();
-			// The server replies with an opened port number, or 0 if an event stream
-			// cannot be estabilished.
-			const uint16_t eventPort =
-				mStream->read<SimplePacket<PacketType::Payload, uint16_t>>();
-
-			if (eventPort != 0) {
-				// The server allowed an event port to be opened.
-				try {
-					mEventStream.reset(new PacketStream(Socket(serverName.c_str(), eventPort)));
-					std::thread(CallbackThreadMain,
-					            std::ref(mEventStream), std::ref(mCallbacks), std::ref(mCallbackMutex)).detach();
-				} catch (...) {
-					// Failed to negotiate an event stream.
-					std::cerr << "RemoteCL Client event stream could not be opened" << std::endl;
-				}
+			// Callback triggers come in between the replies, without any negotiation,
+			// as does the data of the non-blocking reads.
+			watch(mMain);
+			mCallbacksEnabled = true;
+			// The receiver thread watches the other channels as well.
+			mChannelsEnabled = channels && serverVersion.channelsEnabled();
+			try {
+				mReceiver = std::thread(&Connection::receiverMain, this);
+				mDispatcher = std::thread(&Connection::dispatcherMain, this);
+			} catch (const std::system_error&) {
+				std::cerr << "RemoteCL Client could not start the callback threads" << std::endl;
+				mCallbacksEnabled = false;
+				mChannelsEnabled = false;
 			}
 		} else {
-			std::clog << "RemoteCL Server does not support event stream." << std::endl;
+			std::clog << "RemoteCL Server does not support callbacks." << std::endl;
 		}
 #endif
 
+		if (!localPath.empty() && sharedRingMiB != 0 &&
+		    currentVersion.sharedMemoryEnabled() && serverVersion.sharedMemoryEnabled()) {
+			// The server runs on this machine, so large payloads can skip the socket.
+			if (AttachSharedMemory(*mMain.mStream, uint64_t(sharedRingMiB) << 20)) {
+				mSharedRingSize = uint64_t(sharedRingMiB) << 20;
+			}
+		}
+		mMain.mWritten = mMain.mStream->bytesWritten();
+
 		// Preallocate slots for CL objects. This is an estimate of how
 		// many objects will be used throughout the lifetime of the connection.
 		mObjects.reserve(64);
@@ -182,11 +256,48 @@ Connection::Connection() noexcept
 
 Connection::~Connection()
 {
+	{
+		std::unique_lock<std::mutex> lock(mCallbackMutex);
+		mStopping = true;
+	}
+	mCallbackCondition.notify_all();
+	if (mReceiver.joinable()) mReceiver.join();
+	if (mDispatcher.joinable()) mDispatcher.join();
+	{
+		std::unique_lock<std::mutex> lock(mFlushMutex);
+		mFlusherStopping = true;
+	}
+	mFlushCondition.notify_all();
+	if (mFlusher.joinable()) mFlusher.join();
+
 	mObjects.clear();
-	if (mStream) {
+	mClientObjects.clear();
+	PacketStream::BatchStats stats = mMain.mStream ? mMain.mStream->stats() : PacketStream::BatchStats();
+	for (std::unique_ptr<Channel>& channel : mChannels) {
+		const PacketStream::BatchStats& channelStats = channel->mStream->stats();
+		stats.batches += channelStats.batches;
+		stats.packets += channelStats.packets;
+		stats.bytes += channelStats.bytes;
+		stats.largest = std::max(stats.largest, channelStats.largest);
+		try {
+			channel->mStream->write<TerminatePacket>({}).flush();
+		} catch (...) {
+			// Ignore - the process is terminating.
+		}
+	}
+	if (mMain.mStream) {
+		if (mPrintStats) {
+			std::clog << "RemoteCL: sent " << stats.packets << " packets (" << stats.bytes
+			          << " bytes) in " << stats.batches << " batches, " << (stats.batches ?
+			             static_cast<double>(stats.packets) / stats.batches : 0.0)
+			          << " packets per batch on average, " << stats.largest << " at most, through "
+			          << mChannels.size() + 1 << " channels.\n";
+			std::clog << "RemoteCL: answered " << mInfoHits << " of " << (mInfoHits + mInfoMisses)
+			          << " info queries without the server.\n";
+		}
 		try {
 			// Not strictly required because the socket will close anyway.
-			mStream->write<TerminatePacket>({}).flush();
+			mMain.mStream->write<TerminatePacket>({}).flush();
 		} catch (...) {
 			// Ignore - the process is terminating.
 		}
@@ -196,3 +307,410 @@ Connection::~Connection()
 	WSACleanup();
 #endif
 }
+
+void Connection::queueCallback(const CallbackTriggerPacket& trigger)
+{
+	std::unique_lock<std::mutex> lock(mCallbackMutex);
+	const uint32_t index = trigger.mCallbackID;
+	if (index >= mCallbacks.size() || mCallbacks[index] == nullptr) {
+		std::cerr << "Invalid server-side event trigger - ignored." << std::endl;
+		return;
+	}
+	// Callbacks only ever trigger once.
+	mTriggeredCallbacks.emplace_back(std::move(mCallbacks[index]), trigger.mStatus);
+	mPendingCallbacks--;
+	mCallbackCondition.notify_all();
+}
+
+void* Connection::claimRead(Channel& channel, const ReadDataPacket& packet)
+{
+	auto read = channel.mReads.find(packet.mReadID);
+	if (read == channel.mReads.end()) {
+		std::cerr << "Invalid server-side read data - ignored." << std::endl;
+		return nullptr;
+	}
+	// The data of a failed read is empty; the event carries its status.
+	void* ptr = read->second.mPtr;
+	channel.mReads.erase(read);
+	std::unique_lock<std::mutex> lock(mCallbackMutex);
+	channel.mPendingReads--;
+	mPendingReads--;
+	return ptr;
+}
+
+void Connection::watch(Channel& channel)
+{
+	Channel* watched = &channel;
+	channel.mStream->setCallbackHandler([this](const CallbackTriggerPacket& trigger){ queueCallback(trigger); });
+	channel.mStream->setReadDataHandler([this, watched](const ReadDataPacket& packet) {
+		return claimRead(*watched, packet);
+	});
+}
+
+void Connection::receiverMain() noexcept
+{
+	// API calls read the triggers and read data which arrive while they wait on a reply. This
+	// thread picks up the others, so only watches the channels while some are expected.
+	std::vector<Channel*> watched;
+	std::vector<const Socket*> sockets;
+	while (true) {
+		watched.clear();
+		{
+			std::unique_lock<std::mutex> lock(mCallbackMutex);
+			mCallbackCondition.wait(lock, [this]{
+				return mStopping || mPendingCallbacks != 0 || mPendingReads != 0;
+			});
+			if (mStopping) return;
+			// Callbacks are registered, and so triggered, through the main channel.
+			if (mPendingCallbacks != 0 || mMain.mPendingReads != 0) watched.push_back(&mMain);
+			for (const std::unique_ptr<Channel>& channel : mChannels) {
+				if (channel->mPendingReads != 0) watched.push_back(channel.get());
+			}
+		}
+
+		try {
+			// Wait without holding the channels, and wake up now and then to check for mStopping.
+			sockets.clear();
+			for (Channel* channel : watched) {
+				sockets.push_back(&channel->mStream->socket());
+			}
+			if (!Socket::poll(sockets.data(), sockets.size(), 100)) continue;
+			for (Channel* channel : watched) {
+				PacketStream& stream = *channel->mStream;
+				if (!stream.poll(0)) continue;
+				std::unique_lock<std::mutex> lock(channel->mMutex);
+				// Outside of an API call, the server only sends triggers and read data.
+				while (stream.available() != 0 || stream.poll(0)) {
+					stream.readNotice();
+				}
+			}
+		} catch (...) {
+			// The connection is lost. API calls report it from now on.
+			std::cerr << "RemoteCL Client stopped receiving callbacks." << std::endl;
+			return;
+		}
+	}
+}
+
+void Connection::dispatcherMain() noexcept
+{
+	std::unique_lock<std::mutex> lock(mCallbackMutex);
+	while (true) {
+		mCallbackCondition.wait(lock, [this]{ return mStopping || !mTriggeredCallbacks.empty(); });
+		if (mStopping) return;
+		std::pair<std::unique_ptr<Callback>, int32_t> triggered = std::move(mTriggeredCallbacks.front());
+		mTriggeredCallbacks.pop_front();
+		// Run it without holding the lock, as it may call back into the API.
+		lock.unlock();
+		triggered.first->trigger(triggered.second);
+		lock.lock();
+	}
+}
+
+void Connection::scheduleFlush(Channel& channel)
+{
+	std::unique_lock<std::mutex> lock(mFlushMutex);
+	if (channel.mBatched) return;
+	try {
+		// Started with the first batch which is not sent straight away.
+		if (!mFlusher.joinable()) mFlusher = std::thread(&Connection::flusherMain, this);
+		mBatchedChannels.push_back(&channel);
+	} catch (...) {
+		// Without the flusher, the batch goes now.
+		lock.unlock();
+		channel.mStream->flush();
+		return;
+	}
+	channel.mBatched = true;
+	mFlushCondition.notify_one();
+}
+
+void Connection::flusherMain() noexcept
+{
+	using Clock = std::chrono::steady_clock;
+	std::vector<Channel*> batched;
+	std::vector<Channel*> later;
+	std::unique_lock<std::mutex> lock(mFlushMutex);
+	// Give each batch the time to fill up, and to be sent along with a later command.
+	Clock::duration wait = mBatchDelay;
+	while (true) {
+		mFlushCondition.wait(lock, [this]{ return mFlusherStopping || !mBatchedChannels.empty(); });
+		mFlushCondition.wait_for(lock, wait, [this]{ return mFlusherStopping; });
+		if (mFlusherStopping) return;
+		batched.swap(mBatchedChannels);
+		for (Channel* channel : batched) {
+			channel->mBatched = false;
+		}
+		lock.unlock();
+
+		wait = mBatchDelay;
+		for (Channel* channel : batched) {
+			std::unique_lock<std::mutex> channelLock(channel->mMutex, std::try_to_lock);
+			if (!channelLock.owns_lock()) {
+				// Not waited on: the API call holding the channel may block on the server.
+				later.push_back(channel);
+				continue;
+			}
+			PacketStream& stream = *channel->mStream;
+			if (stream.pendingPackets() == 0) continue;
+			const Clock::duration waited = Clock::now() - stream.batchStart();
+			if (waited < mBatchDelay) {
+				// A later batch, which the previous one was sent with.
+				later.push_back(channel);
+				wait = std::min<Clock::duration>(wait, mBatchDelay - waited);
+				continue;
+			}
+			try {
+				stream.flush();
+			} catch (...) {
+				// The connection is lost. API calls report it from now on.
+			}
+		}
+		batched.clear();
+
+		lock.lock();
+		for (Channel* channel : later) {
+			if (channel->mBatched) continue;
+			channel->mBatched = true;
+			mBatchedChannels.push_back(channel);
+		}
+		later.clear();
+	}
+}
+
+LockedConnection Connection::get(cl_uint numEvents, const cl_event* events)
+{
+	return get(mMain, numEvents, events);
+}
+
+LockedConnection Connection::get(cl_command_queue queue, cl_uint numEvents, const cl_event* events)
+{
+	Channel* channel = Unwrappers::Unwrap(queue).mChannel;
+	return get(channel ? *channel : mMain, numEvents, events);
+}
+
+LockedConnection Connection::get(cl_event event)
+{
+	Channel* channel = Unwrappers::Unwrap(event).mChannel;
+	return LockedConnection(*this, channel ? *channel : mMain);
+}
+
+LockedConnection Connection::get(Channel& channel, cl_uint numEvents, const cl_event* events)
+{
+	// The objects used by the command may have been created through the main channel, and the
+	// events it waits on through any of them. Those are sent ahead, for the server to wait on,
+	// before taking the channel, as only the main one may be held while taking another.
+	const bool other = &channel != &mMain;
+	const uint64_t created = other ? mMain.mWritten.load() : 0;
+	if (other) flushUpTo(mMain, created);
+	for (cl_uint i = 0; i < numEvents; ++i) {
+		if (!events[i]) continue;
+		const Event& event = Unwrappers::Unwrap(events[i]);
+		if (event.mChannel && event.mChannel != &channel) flushUpTo(*event.mChannel, event.mCreatedAt);
+	}
+
+	LockedConnection conn(*this, channel);
+	if (other) conn.syncWith(mMain, created);
+	for (cl_uint i = 0; i < numEvents; ++i) {
+		if (!events[i]) continue;
+		const Event& event = Unwrappers::Unwrap(events[i]);
+		if (event.mChannel) conn.syncWith(*event.mChannel, event.mCreatedAt);
+	}
+	return conn;
+}
+
+void Connection::flushUpTo(Channel& channel, uint64_t bytes)
+{
+	if (channel.mStream->bytesFlushed() >= bytes) return;
+	std::unique_lock<std::mutex> lock(channel.mMutex);
+	channel.mStream->flush();
+}
+
+void LockedConnection::syncWith(Channel& channel, uint64_t bytes)
+{
+	if (&channel == &mChannel) return;
+	std::vector<uint64_t>& synced = mChannel.mSynced;
+	if (synced.size() <= channel.mIndex) synced.resize(channel.mIndex + 1);
+	if (synced[channel.mIndex] >= bytes) return;
+	mChannel.mStream->write<ChannelSync>({channel.mIndex, bytes});
+	synced[channel.mIndex] = bytes;
+}
+
+void LockedConnection::sendRefCounts()
+{
+	// The commands sent through the other channels may still use the released objects.
+	// The main channel is held, so the list of channels cannot change.
+	for (std::unique_ptr<Channel>& channel : mParent.mChannels) {
+		const uint64_t written = channel->mWritten.load();
+		mParent.flushUpTo(*channel, written);
+		syncWith(*channel, written);
+	}
+
+	RefCountBatch& batch = mParent.mRefCounts;
+	mChannel.mStream->write(batch);
+	batch.mChanges.clear();
+
+	// The dropped IDs may be bound again once the server has handled the batch.
+	std::unique_lock<std::mutex> lock(mParent.mObjectsMutex);
+	const uint64_t sent = mChannel.mStream->bytesWritten();
+	for (IDType id : mParent.mDroppedIDs) {
+		mParent.mFreeClientIDs.emplace_back(id, sent);
+	}
+	mParent.mDroppedIDs.clear();
+}
+
+cl_event LockedConnection::registerEvent(IDType id)
+{
+	Event& event = registerID<Event>(id);
+	event.mChannel = &mChannel;
+	event.mCreatedAt = mChannel.mStream->bytesWritten();
+	return event;
+}
+
+Channel* LockedConnection::openChannel()
+{
+	assert(isMain() && "Channels are opened through the main channel");
+	if (!mParent.mChannelsEnabled) return nullptr;
+	std::vector<Channel*>& idle = mParent.mIdleChannels;
+	if (!idle.empty()) {
+		Channel* channel = idle.back();
+		idle.pop_back();
+		return channel;
+	}
+
+	try {
+		(*this)->write<OpenChannel>({}).flush();
+		const ChannelAddressPacket address = (*this)->read<ChannelAddressPacket>();
+		std::unique_ptr<Channel> channel(new Channel());
+		channel->mIndex = address.mChannel;
+		// The other API calls go on while the channel connects. The server waits on the
+		// connection, and drops it if it does not come soon.
+		mChannel.mWritten.store(mChannel.mStream->bytesWritten());
+		mLock.unlock();
+		try {
+			channel->mStream.reset(new PacketStream(address.mPath.empty() ?
+			                                        Socket(mParent.mServerName.c_str(), address.mPort,
+			                                               ChannelConnectTimeout) :
+			                                        Socket::connectLocal(address.mPath.c_str()),
+			                                        mParent.mBufferSize));
+			channel->mStream->frameWrites();
+			ChannelHello hello;
+			hello.mToken = address.mToken;
+			hello.mChannel = address.mChannel;
+			channel->mStream->write(hello).flush();
+			mParent.watch(*channel);
+			if (mParent.mSharedRingSize != 0) AttachSharedMemory(*channel->mStream, mParent.mSharedRingSize);
+			channel->mWritten = channel->mStream->bytesWritten();
+		} catch (...) {
+			mLock.lock();
+			throw;
+		}
+		mLock.lock();
+
+		Channel* opened = channel.get();
+		std::unique_lock<std::mutex> lock(mParent.mCallbackMutex);
+		mParent.mChannels.push_back(std::move(channel));
+		return opened;
+	} catch (const ErrorPacket&) {
+		std::clog << "RemoteCL Server could not open a channel; using the main one only." << std::endl;
+	} catch (const Socket::Error&) {
+		std::clog << "RemoteCL Client could not connect a channel; using the main one only." << std::endl;
+	}
+	mParent.mChannelsEnabled = false;
+	return nullptr;
+}
+
+uint32_t LockedConnection::expectRead(void* ptr, IDType queueID, IDType eventID)
+{
+	const uint32_t id = mChannel.mNextReadID++;
+	if (mChannel.mNextReadID == 0) mChannel.mNextReadID = 1;
+	mChannel.mReads[id] = {ptr, queueID, eventID};
+	{
+		std::unique_lock<std::mutex> lock(mParent.mCallbackMutex);
+		mChannel.mPendingReads++;
+		mParent.mPendingReads++;
+	}
+	mParent.mCallbackCondition.notify_all();
+	return id;
+}
+
+void LockedConnection::awaitReads(IDType queueID)
+{
+	const auto& reads = mChannel.mReads;
+	auto onQueue = [queueID](const std::pair<const uint32_t, Channel::PendingRead>& read) {
+		return read.second.mQueueID == queueID;
+	};
+	// The server sends the data of each read once it completes, without being asked.
+	while (std::any_of(reads.begin(), reads.end(), onQueue)) {
+		mChannel.mStream->readNotice();
+	}
+}
+
+void LockedConnection::awaitEvent(cl_event event)
+{
+	const Event& object = Unwrappers::Unwrap(event);
+	Channel& channel = object.mChannel ? *object.mChannel : mParent.mMain;
+	const IDType eventID = object.ID;
+	auto ofEvent = [eventID](const std::pair<const uint32_t, Channel::PendingRead>& read) {
+		return read.second.mEventID == eventID;
+	};
+	// The read went through the channel of its queue, which the main channel may take.
+	assert((isMain() || &channel == &mChannel) && "Channels are only taken from the main one");
+	std::unique_lock<std::mutex> lock;
+	if (&channel != &mChannel) lock = std::unique_lock<std::mutex>(channel.mMutex);
+	while (std::any_of(channel.mReads.begin(), channel.mReads.end(), ofEvent)) {
+		channel.mStream->readNotice();
+	}
+}
+
+void LockedConnection::queueRefCount(char objTy, IDType id, int32_t delta, bool drop)
+{
+	std::vector<RefCountChange>& changes = mParent.mRefCounts.mChanges;
+	auto change = std::find_if(changes.begin(), changes.end(),
+	                           [id](const RefCountChange& c) { return c.mID == id; });
+	if (change == changes.end()) {
+		changes.emplace_back();
+		change = changes.end() - 1;
+		change->mID = id;
+		change->mObjTy = objTy;
+	}
+	change->mDelta += delta;
+	change->mDrop = change->mDrop || drop;
+
+	if (changes.size() >= MaxRefCountChanges) {
+		sendRefCounts();
+		submit();
+	}
+}
+
+void LockedConnection::retain(char objTy, IDType id)
+{
+	queueRefCount(objTy, id, 1, false);
+	std::unique_lock<std::mutex> lock(mParent.mObjectsMutex);
+	if (CLObject* obj = slot(id).get()) obj->RefCount++;
+}
+
+void LockedConnection::release(char objTy, IDType id)
+{
+	std::unique_lock<std::mutex> lock(mParent.mObjectsMutex);
+	CLObject* obj = slot(id).get();
+	// Devices keep their IDs, as they stay listed in the inventory.
+	const bool last = obj && obj->RefCount == 1 && objTy != 'D';
+	if (obj && obj->RefCount != 0) obj->RefCount--;
+	if (last) {
+		// The next queue takes over the channel of this one.
+		if (objTy == 'Q') {
+			if (Channel* channel = static_cast<Queue*>(obj)->mChannel) mParent.mIdleChannels.push_back(channel);
+		}
+		drop(id);
+	}
+	lock.unlock();
+	queueRefCount(objTy, id, -1, last);
+}
+
+void LockedConnection::drop(IDType id)
+{
+	slot(id).reset();
+	// Only recycled once the drop has been sent.
+	if ((id & ClientIDFlag) != 0) mParent.mDroppedIDs.push_back(id);
+}
@@ -16,16 +16,27 @@
 #if !defined(REMOTECL_CLIENT_CONNECTION_H)
 #define REMOTECL_CLIENT_CONNECTION_H
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <iostream>
 #include <list>
 #include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 #include <type_traits>
 #include <mutex>
 #include <memory>
 
+#include "CL/cl.h"
+
 #include "idtype.h"
 #include "packetstream.h"
+#include "packets/refcount.h"
 
 namespace RemoteCL
 {
@@ -38,11 +49,45 @@ class Callback
 {
 public:
 	/// Trigger this callback, whatever it may do.
-	/// The stream provided is the event stream, not the API stream.
-	virtual void trigger(PacketStream&) noexcept = 0;
+	/// @param status The execution status sent along by the server, for event callbacks.
+	virtual void trigger(int32_t status) noexcept = 0;
 	virtual ~Callback() = default;
 };
 
+/// A socket to the server, served by a thread of its own on the other end.
+/// Each queue sends its commands through a channel of its own where possible, so that threads
+/// using different queues do not wait on each other. Everything else goes through the main one.
+struct Channel
+{
+	/// A non-blocking read, waiting on its data.
+	struct PendingRead
+	{
+		/// Where the data goes.
+		void* mPtr;
+		IDType mQueueID;
+		/// ID of the event returned to the host application, or 0.
+		IDType mEventID;
+	};
+
+	std::unique_ptr<PacketStream> mStream;
+	/// Index of the channel within the connection. The main channel is 0.
+	uint32_t mIndex = 0;
+	/// Serialises the API calls using the channel.
+	std::mutex mMutex;
+	/// Number of bytes written into the stream by the API calls which have ended.
+	std::atomic<uint64_t> mWritten{0};
+	/// How far into each other channel, by index, the server waits before going on with this one.
+	std::vector<uint64_t> mSynced;
+	/// Non-blocking reads waiting on their data, by their ID.
+	std::unordered_map<uint32_t, PendingRead> mReads;
+	uint32_t mNextReadID = 1;
+	/// Number of entries in mReads, guarded by the callback mutex of the connection.
+	std::size_t mPendingReads = 0;
+	/// A batch of commands is waiting on the flusher thread, guarded by the flush mutex of the
+	/// connection.
+	bool mBatched = false;
+};
+
 /// Describes a client connection.
 /// This isn't meant to be used directly. Use get() to acquire a locked
 /// access handle.
@@ -51,31 +96,128 @@ class Connection final
 public:
 	Connection() noexcept;
 
-	/// Acquire a locked handle to use the connection.
+	/// Acquire a locked handle to use the main channel of the connection.
 	LockedConnection get();
+	/// Acquire a locked handle to use the main channel, for a command about these events.
+	/// The server handles it once it has the commands behind them, from any channel.
+	LockedConnection get(cl_uint numEvents, const cl_event* events);
+	/// Acquire a locked handle to use the channel of this queue, for a command waiting on
+	/// these events. The server handles it once it has the objects created by the API calls
+	/// which have returned, and the commands behind the events.
+	LockedConnection get(cl_command_queue queue, cl_uint numEvents = 0, const cl_event* events = nullptr);
+	/// Acquire a locked handle to use the channel this event was created through, to wait on
+	/// it (or on others created through the same channel) without holding up the other ones.
+	LockedConnection get(cl_event event);
+
+	/// Checks if the server sends callback triggers, for callback registration.
+	bool callbacksEnabled() const noexcept
+	{
+		return mCallbacksEnabled;
+	}
+
+	/// Checks if non-blocking reads run in the background, with their data sent back by the
+	/// server once they complete, rather than in a reply.
+	bool backgroundReads() const noexcept
+	{
+		return mCallbacksEnabled;
+	}
 
-	/// Checks if the callback stream is available for callback registration.
-	bool hasEventStream() const noexcept
+	/// Checks if kernel arguments are recorded locally and sent along with launches,
+	/// rather than each being sent by clSetKernelArg.
+	bool foldKernelArgs() const noexcept
 	{
-		return mEventStream != nullptr;
+		return mFoldKernelArgs;
 	}
 
 	~Connection();
 
 private:
 	friend class LockedConnection;
-	/// Data stream for regular CL API communication.
-	std::unique_ptr<PacketStream> mStream;
-	/// Data stream for server-side requests and notifications.
-	std::unique_ptr<PacketStream> mEventStream;
+	LockedConnection get(Channel& channel, cl_uint numEvents, const cl_event* events);
+	/// Makes sure the server is sent this channel up to this many bytes.
+	/// Must not be called while holding another channel than the main one.
+	void flushUpTo(Channel& channel, uint64_t bytes);
+	/// Hands the callback triggers and read data of this channel to the connection.
+	void watch(Channel& channel);
+	/// Queues the callback for this trigger, to run on the dispatcher thread.
+	void queueCallback(const CallbackTriggerPacket& trigger);
+	/// Claims the non-blocking read for this data, and gives where the data goes.
+	void* claimRead(Channel& channel, const ReadDataPacket& packet);
+	/// Reads the callback triggers and read data received while no API call waits on a reply.
+	void receiverMain() noexcept;
+	/// Runs the triggered callbacks, outside of the connection lock.
+	void dispatcherMain() noexcept;
+	/// Has the flusher thread send the batch of this channel once it has waited long enough,
+	/// unless a later command does so first. The caller holds the channel.
+	void scheduleFlush(Channel& channel);
+	/// Sends the batches which have waited for mBatchDelay, while the host issues no command.
+	void flusherMain() noexcept;
+
+	/// Channel for regular CL API communication. The server sends its callback triggers
+	/// through it as well.
+	Channel mMain;
+	/// The other channels, in the order they were opened. Changed under both the main channel
+	/// and the callback mutex, so that either is enough to go through it.
+	std::vector<std::unique_ptr<Channel>> mChannels;
+	/// Channels of the queues released so far, ready for the next queues.
+	std::vector<Channel*> mIdleChannels;
+	bool mChannelsEnabled = false;
+	bool mCallbacksEnabled = false;
 	/// List of registered callbacks on the connection.
 	std::vector<std::unique_ptr<Callback>> mCallbacks;
-	/// Serialises accesses to mCallbacks.
+	/// Number of registered callbacks which have not triggered yet.
+	std::size_t mPendingCallbacks = 0;
+	/// Triggered callbacks waiting on the dispatcher, with their status.
+	std::deque<std::pair<std::unique_ptr<Callback>, int32_t>> mTriggeredCallbacks;
+	/// Number of non-blocking reads whose data has yet to arrive, over all of the channels.
+	std::size_t mPendingReads = 0;
+	bool mStopping = false;
+	/// Serialises accesses to the callback state above.
 	std::mutex mCallbackMutex;
+	std::condition_variable mCallbackCondition;
+	std::thread mReceiver;
+	std::thread mDispatcher;
 	/// All of the objects that have been queried by the client.
 	/// Each will have a unique ID which is effectively an index into this vector.
 	std::vector<std::unique_ptr<CLObject>> mObjects;
-	std::mutex mMutex;
+	/// Platforms listed in the server's inventory, in order.
+	std::vector<IDType> mPlatforms;
+	/// Objects created under a client-allocated ID, indexed without the ClientIDFlag.
+	std::vector<std::unique_ptr<CLObject>> mClientObjects;
+	/// Client-allocated IDs of dropped objects, with how far into the main channel their drop
+	/// was sent. Another channel only reuses one once the server has handled the drop.
+	std::vector<std::pair<IDType, uint64_t>> mFreeClientIDs;
+	/// Client-allocated IDs dropped by the reference count changes not sent yet.
+	std::vector<IDType> mDroppedIDs;
+	/// Serialises accesses to the object tables above, from API calls on any of the channels.
+	std::mutex mObjectsMutex;
+	/// Reference count changes not sent yet, one per object.
+	RefCountBatch mRefCounts;
+
+	/// Where the channels connect to, as for the main one.
+	std::string mServerName;
+	std::size_t mBufferSize = SocketStream::DefaultBufferSize;
+	/// Size of the shared memory rings of each channel, or 0 if payloads go through the sockets.
+	uint64_t mSharedRingSize = 0;
+
+	/// Commands without a reply are batched until this many bytes are pending...
+	std::size_t mBatchBytes = SocketStream::DefaultBufferSize;
+	/// ... or the oldest pending command has waited this long.
+	std::chrono::microseconds mBatchDelay{1000};
+	/// Channels with a batch waiting on the flusher, in the order they were scheduled.
+	std::vector<Channel*> mBatchedChannels;
+	bool mFlusherStopping = false;
+	/// Serialises accesses to the flusher state above.
+	std::mutex mFlushMutex;
+	std::condition_variable mFlushCondition;
+	std::thread mFlusher;
+	/// Print the batching statistics on disconnection.
+	bool mPrintStats = false;
+	/// Info queries answered from the objects' info, and those sent to the server.
+	std::size_t mInfoHits = 0;
+	std::size_t mInfoMisses = 0;
+	/// Send kernel arguments with the next launch of the kernel.
+	bool mFoldKernelArgs = true;
 };
 
 /// Allows access to the connection internals through an auto-locked handle.
@@ -84,46 +226,158 @@ class LockedConnection final
 private:
 	LockedConnection(const LockedConnection&) = delete;
 	LockedConnection& operator=(const LockedConnection&) = delete;
-	explicit LockedConnection(Connection& parent) :
-		mLock(parent.mMutex), mParent(parent)
+	LockedConnection(Connection& parent, Channel& channel) :
+		mLock(channel.mMutex), mParent(parent), mChannel(channel)
 	{
-		if (!parent.mStream) throw Socket::Error();
+		if (!channel.mStream) throw Socket::Error();
 	}
 
 	std::unique_lock<std::mutex> mLock;
 	Connection& mParent;
+	Channel& mChannel;
+
+	/// Reference count changes are sent once this many objects have pending changes,
+	/// if no other command was sent before.
+	static constexpr std::size_t MaxRefCountChanges = 64;
+
+	bool isMain() const noexcept
+	{
+		return &mChannel == &mParent.mMain;
+	}
+
+	/// Records a change to the reference count of this object, to be sent with the next command.
+	void queueRefCount(char objTy, IDType id, int32_t delta, bool drop);
+
+	/// Writes the pending reference count changes, once the server has the commands sent
+	/// through the other channels, which may still use the objects.
+	void sendRefCounts();
+
+	/// Holds the commands that follow until the server has handled this channel up to here.
+	void syncWith(Channel& channel, uint64_t bytes);
+
+	/// Retrieves the object table entry for this ID, growing the table if required.
+	/// The caller holds the object mutex.
+	std::unique_ptr<CLObject>& slot(IDType id)
+	{
+		auto& objects = (id & ClientIDFlag) != 0 ? mParent.mClientObjects : mParent.mObjects;
+		const std::size_t index = id & ~ClientIDFlag;
+		if (objects.size() <= index)
+			objects.resize(index+1);
+		return objects[index];
+	}
+
+	/// Destroys the object for this ID, and recycles the ID if allocated by the client.
+	/// The caller holds the object mutex.
+	void drop(IDType id);
 
 public:
 	LockedConnection(LockedConnection&&) = default;
 	LockedConnection& operator=(LockedConnection&&) = default;
+	/// Records how far the API calls which have ended went into the channel.
+	~LockedConnection()
+	{
+		if (mLock.owns_lock()) mChannel.mWritten.store(mChannel.mStream->bytesWritten());
+	}
 
 	template<typename ObjTy>
 	ObjTy* getObject(IDType id)
 	{
 		static_assert(std::is_base_of<CLObject, ObjTy>::value, "Invalid object queried");
+		std::unique_lock<std::mutex> lock(mParent.mObjectsMutex);
 		// std::vector default-initialises to nullptr, which is what we want.
-		return static_cast<ObjTy*>(mParent.mObjects[id].get());
+		return static_cast<ObjTy*>(slot(id).get());
 	}
 
+	/// Registers an object created by the host application, which holds its first reference.
 	template<typename ObjTy>
 	ObjTy& registerID(IDType id)
 	{
 		static_assert(std::is_base_of<CLObject, ObjTy>::value, "Invalid object queried");
 		std::unique_ptr<ObjTy> obj(new ObjTy(id));
 		ObjTy* ptr = obj.get();
-		if (mParent.mObjects.size() <= id)
-			mParent.mObjects.resize(id+1);
-		mParent.mObjects[id] = std::move(obj);
+		ptr->RefCount = 1;
+		std::unique_lock<std::mutex> lock(mParent.mObjectsMutex);
+		slot(id) = std::move(obj);
 		return *ptr;
 	}
 
+	/// Registers an event created by the command just written, and records where it was sent.
+	cl_event registerEvent(IDType id);
+
 	template<typename ObjTy>
 	ObjTy& getOrInsertObject(IDType id)
 	{
 		static_assert(std::is_base_of<CLObject, ObjTy>::value, "Invalid object queried");
-		if (id < mParent.mObjects.size())
-			return *static_cast<ObjTy*>(mParent.mObjects[id].get());
-		return registerID<ObjTy>(id);
+		std::unique_lock<std::mutex> lock(mParent.mObjectsMutex);
+		std::unique_ptr<CLObject>& entry = slot(id);
+		if (!entry) entry.reset(new ObjTy(id));
+		return *static_cast<ObjTy*>(entry.get());
+	}
+
+	/// The platforms listed in the server's inventory, or none if it could not list them.
+	const std::vector<IDType>& platforms() const noexcept
+	{
+		return mParent.mPlatforms;
+	}
+
+	/// Counts an info query, answered locally if hit is set, for the statistics.
+	void countInfoQuery(bool hit) noexcept
+	{
+		++(hit ? mParent.mInfoHits : mParent.mInfoMisses);
+	}
+
+	/// Records the host application's reference, and retains the object on the server
+	/// once the next command is sent.
+	void retain(char objTy, IDType id);
+
+	/// Drops the host application's reference, and releases the object on the server once
+	/// the next command is sent. Once the host application has released all of its
+	/// references, the object and its ID are dropped on both ends.
+	void release(char objTy, IDType id);
+
+	/// Opens a channel for a new queue, or hands over that of a released one. Lets go of the
+	/// main channel while the new one connects.
+	/// @returns nullptr if the queue has to use the main channel.
+	Channel* openChannel();
+
+	/// Records a non-blocking read into this pointer, whose data the server sends back once
+	/// the read completes. The receiver thread watches the connection until then.
+	/// @returns the ID the server tags the data with.
+	uint32_t expectRead(void* ptr, IDType queueID, IDType eventID);
+	/// Waits on the data of the non-blocking reads enqueued on this queue.
+	void awaitReads(IDType queueID);
+	/// Waits on the data of the non-blocking read behind this event, if any.
+	void awaitEvent(cl_event event);
+
+	/// Reserves an ID for an object about to be created by the client.
+	/// The server binds the new object to this ID, so the creation needs no reply.
+	IDType allocateID()
+	{
+		std::unique_lock<std::mutex> lock(mParent.mObjectsMutex);
+		auto& freeIDs = mParent.mFreeClientIDs;
+		if (!freeIDs.empty() && (isMain() || (!mChannel.mSynced.empty() &&
+		                                      mChannel.mSynced[0] >= freeIDs.back().second))) {
+			const IDType id = freeIDs.back().first;
+			freeIDs.pop_back();
+			return id;
+		}
+		auto& objects = mParent.mClientObjects;
+		if (objects.size() >= ClientIDFlag) throw std::bad_alloc();
+		objects.emplace_back();
+		return static_cast<IDType>(ClientIDFlag | (objects.size()-1));
+	}
+
+	/// Ends a command which expects no reply. These are batched, and sent once the
+	/// batch reaches one of its thresholds, or when a later command waits on a reply.
+	void submit()
+	{
+		PacketStream& stream = *mChannel.mStream;
+		if (stream.pendingBytes() >= mParent.mBatchBytes ||
+		    std::chrono::steady_clock::now() - stream.batchStart() >= mParent.mBatchDelay) {
+			stream.flush();
+		} else {
+			mParent.scheduleFlush(mChannel);
+		}
 	}
 
 	uint32_t registerCallback(std::unique_ptr<Callback> callback)
@@ -132,13 +386,29 @@ public:
 		// but for API simplicity, leave it so.
 		std::unique_lock<std::mutex> lock(mParent.mCallbackMutex);
 		mParent.mCallbacks.emplace_back(std::move(callback));
+		// Wake the receiver up, which watches the connection while callbacks are pending.
+		mParent.mPendingCallbacks++;
+		mParent.mCallbackCondition.notify_all();
 		return (mParent.mCallbacks.size()-1);
 	}
+	/// Drops a callback the server did not take, so that it is no longer waited on.
+	void unregisterCallback(uint32_t callbackID) noexcept
+	{
+		std::unique_lock<std::mutex> lock(mParent.mCallbackMutex);
+		std::unique_ptr<Callback>& callback = mParent.mCallbacks[callbackID];
+		// Already gone if it has triggered.
+		if (callback == nullptr) return;
+		callback.reset();
+		mParent.mPendingCallbacks--;
+	}
 
 	/// Send and receive packets through this connection.
-	PacketStream* operator->() noexcept
+	/// Pending reference count changes are sent ahead of any other packet on the main channel,
+	/// so that the server has dropped the IDs which may be reused by what follows.
+	PacketStream* operator->()
 	{
-		return mParent.mStream.get();
+		if (isMain() && !mParent.mRefCounts.mChanges.empty()) sendRefCounts();
+		return mChannel.mStream.get();
 	}
 
 	friend class Connection;
@@ -146,7 +416,7 @@ public:
 
 inline LockedConnection Connection::get()
 {
-	return LockedConnection(*this);
+	return LockedConnection(*this, mMain);
 }
 
 /// Each client only has one connection to one server, created at process start time.
@@ -15,6 +15,7 @@
 
 #include <cstdint>
 #include <cstring>
+#include <utility>
 
 #include "CL/cl_platform.h"
 #include "hints.h"
@@ -30,6 +31,34 @@ using namespace RemoteCL;
 using namespace RemoteCL::Client;
 
 
+namespace
+{
+/// The property list of a new context as returned by CL_CONTEXT_PROPERTIES, terminator included.
+std::vector<uint8_t> EncodeProperties(const cl_context_properties* properties)
+{
+	if (properties == nullptr) return {};
+	std::size_t count = 1;
+	while (properties[count - 1] != 0) count += 2;
+	const uint8_t* bytes = reinterpret_cast<const uint8_t*>(properties);
+	return std::vector<uint8_t>(bytes, bytes + count * sizeof(cl_context_properties));
+}
+}
+
+bool Context::isCacheable(uint32_t param) noexcept
+{
+	switch (param) {
+		case CL_CONTEXT_DEVICES:
+		case CL_CONTEXT_PROPERTIES:
+#if defined(CL_VERSION_1_1)
+		case CL_CONTEXT_NUM_DEVICES:
+#endif
+			return true;
+		default:
+			// The reference count changes, and extension queries may as well.
+			return false;
+	}
+}
+
 SO_EXPORT CL_API_ENTRY cl_context CL_API_CALL
 clCreateContext(const cl_context_properties* properties,
                 cl_uint num_devices, const cl_device_id* devices,
@@ -48,6 +77,7 @@ clCreateContext(const cl_context_properties* properties,
 
 	try {
 		CreateContext packet;
+		const std::vector<uint8_t> propertyList = EncodeProperties(properties);
 		// Properties come in pairs.
 		if (properties != nullptr) {
 			while (properties[0] != 0) {
@@ -78,6 +108,12 @@ clCreateContext(const cl_context_properties* properties,
 		// We expect a single ID.
 		IDPacket ID = conn->read<IDPacket>();
 		Context& C = conn.registerID<Context>(ID);
+		C.mInfo[CL_CONTEXT_PROPERTIES] = propertyList;
+		C.mInfo[CL_CONTEXT_DEVICES].assign(reinterpret_cast<const uint8_t*>(packet.mDevices.data()),
+		                                   reinterpret_cast<const uint8_t*>(packet.mDevices.data() + num_devices));
+#if defined(CL_VERSION_1_1)
+		C.mInfo[CL_CONTEXT_NUM_DEVICES] = EncodeValue<cl_uint>(num_devices);
+#endif
 		if (errcode_ret) *errcode_ret = CL_SUCCESS;
 		return C;
 	} catch (...) {
@@ -102,6 +138,7 @@ clCreateContextFromType(const cl_context_properties* properties, cl_device_type
 	try {
 		CreateContextFromType packet;
 		packet.mDeviceType = device_type;
+		const std::vector<uint8_t> propertyList = EncodeProperties(properties);
 		// Properties come in pairs.
 		if (properties != nullptr) {
 			while (properties[0] != 0) {
@@ -123,7 +160,9 @@ clCreateContextFromType(const cl_context_properties* properties, cl_device_type
 		conn->flush();
 		// We expect a single ID.
 		IDPacket ID = conn->read<IDPacket>();
+		// The server picks the devices, which are asked for when first queried.
 		Context& C = conn.registerID<Context>(ID);
+		C.mInfo[CL_CONTEXT_PROPERTIES] = propertyList;
 		if (errcode_ret) *errcode_ret = CL_SUCCESS;
 		return C;
 	} catch (...) {
@@ -139,29 +178,37 @@ clGetContextInfo(cl_context context, cl_context_info param_name,
 {
 	if (context == nullptr) return CL_INVALID_CONTEXT;
 
-	IDType id = GetID(context);
-
 	try {
+		Context& object = Unwrappers::Unwrap(context);
 		auto conn = gConnection.get();
-		conn->write<GetContextInfo>({id, param_name});
-		conn->flush();
-		Payload<uint8_t> payload = conn->read<Payload<uint8_t>>();
+		auto cached = object.mInfo.find(param_name);
+		conn.countInfoQuery(cached != object.mInfo.end());
+		std::vector<uint8_t> reply;
+		if (cached == object.mInfo.end()) {
+			conn->write<GetContextInfo>({object.ID, param_name});
+			conn->flush();
+			reply = std::move(conn->read<Payload<uint8_t>>().mData);
+			if (Context::isCacheable(param_name)) {
+				cached = object.mInfo.emplace(param_name, std::move(reply)).first;
+			}
+		}
+		const std::vector<uint8_t>& value = cached != object.mInfo.end() ? cached->second : reply;
 		if (param_value_size_ret) {
 			if (param_name == CL_CONTEXT_DEVICES) {
-				assert((payload.mData.size() % sizeof(IDType)) == 0);
-				*param_value_size_ret = (payload.mData.size() / sizeof(IDType)) * sizeof(cl_device_id);
+				assert((value.size() % sizeof(IDType)) == 0);
+				*param_value_size_ret = (value.size() / sizeof(IDType)) * sizeof(cl_device_id);
 			} else {
-				*param_value_size_ret = payload.mData.size();
+				*param_value_size_ret = value.size();
 			}
 		}
 
 		if (param_value) {
 			if (param_name == CL_CONTEXT_DEVICES) {
 				// TODO: This might be problematic when the std::vector data isn't IDType aligned.
-				const IDType* ids = reinterpret_cast<IDType*>(payload.mData.data());
-				assert((payload.mData.size() % sizeof(IDType)) == 0);
+				const IDType* ids = reinterpret_cast<const IDType*>(value.data());
+				assert((value.size() % sizeof(IDType)) == 0);
 				/// Number of IDs returned by the server.
-				const auto idCount = payload.mData.size() / sizeof(IDType);
+				const auto idCount = value.size() / sizeof(IDType);
 				/// The return data, which will contain device IDs.
 				cl_device_id* ret = static_cast<cl_device_id*>(param_value);
 				/// The number of IDs that can be returned through param_value.
@@ -173,7 +220,7 @@ clGetContextInfo(cl_context context, cl_context_info param_name,
 					--available;
 				}
 			} else {
-				std::memcpy(param_value, payload.mData.data(), std::min(param_value_size, payload.mData.size()));
+				std::memcpy(param_value, value.data(), std::min(param_value_size, value.size()));
 			}
 		}
 		return CL_SUCCESS;
@@ -192,9 +239,7 @@ clRetainContext(cl_context context) CL_API_SUFFIX__VERSION_1_0
 	try {
 		auto conn = gConnection.get();
 		IDType id = GetID(context);
-		conn->write<Retain>({'C', id});
-		conn->flush();
-		conn->read<SuccessPacket>();
+		conn.retain('C', id);
 	} catch (const ErrorPacket& e) {
 		return e.mData;
 	} catch (...) {
@@ -212,9 +257,7 @@ clReleaseContext(cl_context context) CL_API_SUFFIX__VERSION_1_0
 	try {
 		auto conn = gConnection.get();
 		IDType id = GetID(context);
-		conn->write<Release>({'C', id});
-		conn->flush();
-		conn->read<SuccessPacket>();
+		conn.release('C', id);
 	} catch (const ErrorPacket& e) {
 		return e.mData;
 	} catch (...) {
@@ -232,22 +275,31 @@ clGetSupportedImageFormats(cl_context context, cl_mem_flags flags,
 	if (context == nullptr) return CL_INVALID_CONTEXT;
 
 	try {
+		Context& object = Unwrappers::Unwrap(context);
 		auto conn = gConnection.get();
 
-		GetImageFormats query;
-		query.mContextID = GetID(context);
-		query.mFlags = flags;
-		query.mImageType = image_type;
-		conn->write(query);
-		conn->flush();
-		// The server will reply with a payload
-		Payload<uint16_t> payload = conn->read<Payload<uint16_t>>();
+		// The formats supported by a context do not change, so each combination is asked once.
+		const auto key = std::make_pair(uint64_t(flags), uint32_t(image_type));
+		auto cached = object.mImageFormats.find(key);
+		conn.countInfoQuery(cached != object.mImageFormats.end());
+		if (cached == object.mImageFormats.end()) {
+			GetImageFormats query;
+			query.mContextID = object.ID;
+			query.mFlags = flags;
+			query.mImageType = image_type;
+			conn->write(query);
+			conn->flush();
+			// The server will reply with a payload
+			Payload<uint16_t> payload = conn->read<Payload<uint16_t>>();
+			cached = object.mImageFormats.emplace(key, std::move(payload.mData)).first;
+		}
+		const std::vector<uint8_t>& formats = cached->second;
 		if (num_image_formats) {
-			*num_image_formats = payload.mData.size() / sizeof(cl_image_format);
+			*num_image_formats = formats.size() / sizeof(cl_image_format);
 		}
 		if (image_formats) {
-			std::memcpy(image_formats, payload.mData.data(),
-			            std::min(num_entries*sizeof(cl_image_format), payload.mData.size()));
+			std::memcpy(image_formats, formats.data(),
+			            std::min(num_entries*sizeof(cl_image_format), formats.size()));
 		}
 		return CL_SUCCESS;
 	} catch (const ErrorPacket& e) {
@@ -13,8 +13,10 @@
 // You should have received a copy of the GNU Lesser General Public License
 // along with RemoteCL.  If not, see <https://www.gnu.org/licenses/>.
 
+#include <algorithm>
 #include <cstdint>
 #include <iostream>
+#include <iterator>
 
 #include "CL/cl_platform.h"
 #include <cstring>
@@ -26,20 +28,112 @@
 #include "packets/IDs.h"
 #include "packets/refcount.h"
 #include "packets/device.h"
+#include "packets/inventory.h"
 #include "packets/payload.h"
 
 using namespace RemoteCL;
 using namespace RemoteCL::Client;
 
+namespace
+{
+/// Lists the devices of this type from the inventory.
+/// @returns false if the server must be asked instead.
+bool ListInventoryDevices(LockedConnection& conn, cl_platform_id platform, cl_device_type type,
+                          std::vector<IDType>& ids)
+{
+	// The default device, invalid types, and the choice of platform are left to the server.
+	cl_device_type listable = CL_DEVICE_TYPE_CPU | CL_DEVICE_TYPE_GPU | CL_DEVICE_TYPE_ACCELERATOR;
+#if defined(CL_VERSION_1_2)
+	listable |= CL_DEVICE_TYPE_CUSTOM;
+#endif
+	if (platform == nullptr || (type != CL_DEVICE_TYPE_ALL && (type == 0 || (type & ~listable) != 0))) {
+		return false;
+	}
+	const PlatformID& object = Unwrappers::Unwrap(platform);
+	if (!object.mDevicesListed) return false;
+
+	for (IDType id : object.mDevices) {
+		const DeviceID* device = conn.getObject<DeviceID>(id);
+		auto deviceType = device->mInfo.find(CL_DEVICE_TYPE);
+		if (deviceType == device->mInfo.end()) return false;
+		if (type == CL_DEVICE_TYPE_ALL || (ReadValue<cl_device_type>(deviceType->second) & type) != 0) {
+			ids.push_back(id);
+		}
+	}
+	return true;
+}
+
+/// Translates a device info value sent by the server, and stores it for the host application.
+void StoreDeviceInfo(LockedConnection& conn, cl_device_info param_name, const std::vector<uint8_t>& value,
+                     size_t param_value_size, void* param_value, size_t* param_value_size_ret)
+{
+	switch (param_name) {
+		// These queries must be ID-translated.
+		case CL_DEVICE_PLATFORM: {
+			PlatformID& id = conn.getOrInsertObject<PlatformID>(ReadValue<IDType>(value));
+			Store<cl_platform_id>(id, param_value, param_value_size, param_value_size_ret);
+			break;
+		}
+		case CL_DEVICE_PARENT_DEVICE: {
+			DeviceID& id = conn.getOrInsertObject<DeviceID>(ReadValue<IDType>(value));
+			Store<cl_device_id>(id, param_value, param_value_size, param_value_size_ret);
+			break;
+		}
+
+		// These queries must be std::size_t translated.
+		case CL_DEVICE_PRINTF_BUFFER_SIZE:
+		case CL_DEVICE_IMAGE2D_MAX_WIDTH:
+		case CL_DEVICE_IMAGE3D_MAX_WIDTH:
+		case CL_DEVICE_IMAGE_MAX_BUFFER_SIZE:
+		case CL_DEVICE_IMAGE2D_MAX_HEIGHT:
+		case CL_DEVICE_IMAGE3D_MAX_HEIGHT:
+		case CL_DEVICE_IMAGE_MAX_ARRAY_SIZE:
+		case CL_DEVICE_IMAGE3D_MAX_DEPTH:
+		case CL_DEVICE_IMAGE_PITCH_ALIGNMENT:
+		case CL_DEVICE_IMAGE_BASE_ADDRESS_ALIGNMENT:
+		case CL_DEVICE_PROFILING_TIMER_RESOLUTION:
+		case CL_DEVICE_MAX_GLOBAL_VARIABLE_SIZE:
+		case CL_DEVICE_GLOBAL_VARIABLE_PREFERRED_TOTAL_SIZE:
+		case CL_DEVICE_MAX_PARAMETER_SIZE:
+		case CL_DEVICE_MAX_WORK_GROUP_SIZE: {
+			const std::size_t size = ReadValue<uint64_t>(value);
+			Store<std::size_t>(size, param_value, param_value_size, param_value_size_ret);
+			break;
+		}
+		case CL_DEVICE_MAX_WORK_ITEM_SIZES: {
+			const std::size_t dimensions = value.size() / sizeof(uint64_t);
+			std::size_t* retVal = reinterpret_cast<std::size_t*>(param_value);
+			if (param_value_size_ret) *param_value_size_ret = dimensions * sizeof(std::size_t);
+			if (retVal && param_value_size >= dimensions * sizeof(std::size_t)) {
+				for (std::size_t i = 0; i < dimensions; ++i) {
+					retVal[i] = ReadValue<uint64_t>(value, i);
+				}
+			}
+			break;
+		}
+
+		// All others, just copy whatever the server returned.
+		default:
+			StoreData(value, param_value, param_value_size, param_value_size_ret);
+			break;
+	}
+}
+}
+
+bool DeviceID::isCacheable(uint32_t param) noexcept
+{
+	// Whatever the server sends in the inventory does not change.
+	return std::find(std::begin(InventoryDeviceInfo), std::end(InventoryDeviceInfo), param) !=
+	       std::end(InventoryDeviceInfo);
+}
+
 
 SO_EXPORT CL_API_ENTRY cl_int CL_API_CALL
 clRetainDevice(cl_device_id device) CL_API_SUFFIX__VERSION_1_0
 {
 	try {
 		auto conn = gConnection.get();
-		conn->write<Retain>({'D', GetID(device)});
-		conn->flush();
-		conn->read<SuccessPacket>();
+		conn.retain('D', GetID(device));
 	} catch (const ErrorPacket& e) {
 		return e.mData;
 	} catch (...) {
@@ -54,9 +148,7 @@ clReleaseDevice(cl_device_id device) CL_API_SUFFIX__VERSION_1_0
 {
 	try {
 		auto conn = gConnection.get();
-		conn->write( Release('D', GetID(device)));
-		conn->flush();
-		conn->read<SuccessPacket>();
+		conn.release('D', GetID(device));
 	} catch (const ErrorPacket& e) {
 		return e.mData;
 	} catch (...) {
@@ -81,16 +173,22 @@ clGetDeviceIDs(cl_platform_id platform, cl_device_type device_type,
 		IDType platID = 0;
 		if (platform) platID = GetID(platform);
 
-		// Request the device list...
-		conn->write(GetDeviceIDs(platID, device_type));
-		conn->flush();
-		// ... and wait for it to arrive.
-		IDListPacket list = conn->read<IDListPacket>();
+		std::vector<IDType> ids;
+		if (!ListInventoryDevices(conn, platform, device_type, ids)) {
+			// Request the device list...
+			conn->write(GetDeviceIDs(platID, device_type));
+			conn->flush();
+			// ... and wait for it to arrive.
+			IDListPacket list = conn->read<IDListPacket>();
+			ids.assign(list.mIDs.begin(), list.mIDs.end());
+		} else if (ids.empty()) {
+			return CL_DEVICE_NOT_FOUND;
+		}
 
 		// Create a device for each ID queried.
-		if (num_devices) *num_devices = list.mIDs.size();
+		if (num_devices) *num_devices = ids.size();
 		uint32_t entry = 0;
-		for (auto& p : list.mIDs) {
+		for (auto& p : ids) {
 			DeviceID& device = conn.getOrInsertObject<DeviceID>(p);
 			if (entry < num_entries) {
 				devices[entry] = device;
@@ -116,67 +214,21 @@ clGetDeviceInfo(cl_device_id device, cl_device_info param_name,
 	if (device == nullptr) return CL_INVALID_DEVICE;
 
 	try {
+		DeviceID& object = Unwrappers::Unwrap(device);
 		auto conn = gConnection.get();
+		auto cached = object.mInfo.find(param_name);
+		conn.countInfoQuery(cached != object.mInfo.end());
+		if (cached != object.mInfo.end()) {
+			StoreDeviceInfo(conn, param_name, cached->second,
+			                param_value_size, param_value, param_value_size_ret);
+			return CL_SUCCESS;
+		}
 
-		conn->write<GetDeviceInfo>({GetID(device), param_name});
+		conn->write<GetDeviceInfo>({object.ID, param_name});
 		conn->flush();
-
-		switch (param_name) {
-			// These queries must be ID-translated.
-			case CL_DEVICE_PLATFORM: {
-				PlatformID& id = conn.getOrInsertObject<PlatformID>(conn->read<IDPacket>());
-				Store<cl_platform_id>(id, param_value, param_value_size, param_value_size_ret);
-				break;
-			}
-			case CL_DEVICE_PARENT_DEVICE: {
-				DeviceID& id = conn.getOrInsertObject<DeviceID>(conn->read<IDPacket>());
-				Store<cl_device_id>(id, param_value, param_value_size, param_value_size_ret);
-				break;
-			}
-
-			// These queries must be std::size_t translated.
-			case CL_DEVICE_PRINTF_BUFFER_SIZE:
-			case CL_DEVICE_IMAGE2D_MAX_WIDTH:
-			case CL_DEVICE_IMAGE3D_MAX_WIDTH:
-			case CL_DEVICE_IMAGE_MAX_BUFFER_SIZE:
-			case CL_DEVICE_IMAGE2D_MAX_HEIGHT:
-			case CL_DEVICE_IMAGE3D_MAX_HEIGHT:
-			case CL_DEVICE_IMAGE_MAX_ARRAY_SIZE:
-			case CL_DEVICE_IMAGE3D_MAX_DEPTH:
-			case CL_DEVICE_IMAGE_PITCH_ALIGNMENT:
-			case CL_DEVICE_IMAGE_BASE_ADDRESS_ALIGNMENT:
-			case CL_DEVICE_PROFILING_TIMER_RESOLUTION:
-			case CL_DEVICE_MAX_GLOBAL_VARIABLE_SIZE:
-			case CL_DEVICE_GLOBAL_VARIABLE_PREFERRED_TOTAL_SIZE:
-			case CL_DEVICE_MAX_PARAMETER_SIZE:
-			case CL_DEVICE_MAX_WORK_GROUP_SIZE: {
-				uint64_t value = conn->read<SimplePacket<PacketType::Payload, uint64_t>>();
-				Store<uint64_t>(value, param_value, param_value_size, param_value_size_ret);
-				break;
-			}
-			case CL_DEVICE_MAX_WORK_ITEM_SIZES: {
-				uint64_t sizes[3];
-				conn->read(PayloadInto<uint8_t>(sizes));
-				std::size_t* retVal = reinterpret_cast<std::size_t*>(param_value);
-				if (param_value_size_ret) *param_value_size_ret = 3 * sizeof(std::size_t);
-				if (retVal && param_value_size >= 3 * sizeof(std::size_t)) {
-					retVal[0] = sizes[0];
-					retVal[1] = sizes[1];
-					retVal[2] = sizes[2];
-				}
-				break;
-			}
-
-			// All others, just memcpy whatever the server returned.
-			default: {
-				Payload<> payload = conn->read<Payload<>>();
-				if (param_value_size_ret) *param_value_size_ret = payload.mData.size();
-				if (param_value && param_value_size >= payload.mData.size()) {
-					std::memcpy(param_value, payload.mData.data(), payload.mData.size());
-				}
-				break;
-			}
-		}
+		Payload<> payload = conn->read<Payload<>>();
+		StoreDeviceInfo(conn, param_name, payload.mData, param_value_size, param_value, param_value_size_ret);
+		if (DeviceID::isCacheable(param_name)) object.mInfo.emplace(param_name, std::move(payload.mData));
 		return CL_SUCCESS;
 	} catch (const ErrorPacket& e) {
 		return e.mData;
@@ -25,7 +25,9 @@
 #include "packets/event.h"
 #include "packets/simple.h"
 
+#include <algorithm>
 #include <cstring>
+#include <vector>
 
 using namespace RemoteCL;
 using namespace RemoteCL::Client;
@@ -41,10 +43,19 @@ public:
 		mEvent(event), mCallback(fn), mUserData(userData)
 	{}
 
-	void trigger(PacketStream& stream) noexcept override
+	void trigger(int32_t status) noexcept override
 	{
-		cl_int code = stream.read<TriggerEventCallback>();
-		mCallback(mEvent, code, mUserData);
+		if (status == CL_COMPLETE) {
+			try {
+				// The data of a non-blocking read must be in place before the host application hears of it.
+				gConnection.get().awaitEvent(mEvent);
+			} catch (...) {
+				// The connection is lost; the host application finds out on its next call.
+			}
+		}
+		mCallback(mEvent, status, mUserData);
+		// Drop the reference taken on registration.
+		clReleaseEvent(mEvent);
 	}
 
 private:
@@ -62,20 +73,29 @@ clSetEventCallback(cl_event event, cl_int command_exec_callback_type,
 	if (event == nullptr) return CL_INVALID_EVENT;
 	if (pfn_notify == nullptr) return CL_INVALID_VALUE;
 
-	if (!gConnection.hasEventStream()) {
+	if (!gConnection.callbacksEnabled()) {
 		return CL_INVALID_OPERATION;
 	}
 
 	try {
-		auto conn = gConnection.get();
+		auto conn = gConnection.get(1, &event);
 		std::unique_ptr<EventCallback> callBack(new EventCallback(event, pfn_notify, user_data));
 		uint32_t callbackID = conn.registerCallback(std::move(callBack));
-		RegisterEventCallback P;
-		P.mCallbackID = callbackID;
-		P.mEventID = GetID(event);
-		P.mCBType = command_exec_callback_type;
-		conn->write(P).flush();
-		conn->read<SuccessPacket>();
+		try {
+			RegisterEventCallback P;
+			P.mCallbackID = callbackID;
+			P.mEventID = GetID(event);
+			P.mCBType = command_exec_callback_type;
+			conn->write(P).flush();
+			conn->read<SuccessPacket>();
+		} catch (...) {
+			// The server did not register it, so it never triggers.
+			conn.unregisterCallback(callbackID);
+			throw;
+		}
+		// The server retains the event until the callback triggers, so that the host
+		// application may release it in the meantime. Keep the handle alive as well.
+		Unwrappers::Unwrap(event).RefCount++;
 		return CL_SUCCESS;
 	} catch (const std::bad_alloc&) {
 		return(CL_OUT_OF_HOST_MEMORY);
@@ -135,16 +155,25 @@ clEnqueueNDRangeKernel(cl_command_queue command_queue, cl_kernel kernel,
 			}
 		}
 
-		auto conn = gConnection.get();
+		auto conn = gConnection.get(command_queue, num_events_in_wait_list, event_wait_list);
+
+		// Ship the arguments changed since the last launch along with this one.
+		Kernel& kern = Unwrappers::Unwrap(kernel);
+		for (std::size_t i = 0; i < kern.mArgChanged.size(); ++i) {
+			if (!kern.mArgChanged[i]) continue;
+			E.mArgs.push_back(kern.mArgs[i]);
+			kern.mArgChanged[i] = false;
+		}
 
+		if (event) E.mEventID = conn.allocateID();
 		conn->write(E);
 		if (num_events_in_wait_list) {
 			conn->write(eventList);
 		}
-		conn->flush();
+		conn.submit();
 
-		if (event) *event = conn.registerID<Event>(conn->read<IDPacket>());
-		conn->read<SuccessPacket>();
+		// The server does not reply; errors are reported on the next synchronising call.
+		if (event) *event = conn.registerEvent(E.mEventID);
 	} catch (const ErrorPacket& e) {
 		return e.mData;
 	} catch (...) {
@@ -159,8 +188,12 @@ clCreateUserEvent(cl_context context, cl_int* errcode_ret) CL_API_SUFFIX__VERSIO
 
 	try {
 		auto conn = gConnection.get();
-		conn->write<CreateUserEvent>({GetID(context)}).flush();
-		cl_event ret = conn.registerID<Event>(conn->read<IDPacket>());
+		// The server binds the event to this ID; any creation error is reported
+		// on the next synchronising call.
+		IDType eventID = conn.allocateID();
+		conn->write<CreateUserEvent>({GetID(context), eventID});
+		conn.submit();
+		cl_event ret = conn.registerEvent(eventID);
 		if (errcode_ret) *errcode_ret = CL_SUCCESS;
 		return ret;
 	} catch (const std::bad_alloc&) {
@@ -203,7 +236,7 @@ clGetEventInfo(cl_event event, cl_event_info param_name,
 
 	try {
 		IDType id = GetID(event);
-		auto conn = gConnection.get();
+		auto conn = gConnection.get(1, &event);
 		conn->write<GetEventInfo>({id, param_name});
 		conn->flush();
 
@@ -212,8 +245,7 @@ clGetEventInfo(cl_event event, cl_event_info param_name,
 			auto ID = conn->read<IDPacket>();
 			if (param_value_size_ret) *param_value_size_ret = sizeof(cl_command_queue);
 			if (param_value && param_value_size >= sizeof(cl_command_queue)) {
-				Queue* queue = conn.getObject<Queue>(ID.mData);
-				cl_command_queue cmdQueue = *queue;
+				cl_command_queue cmdQueue = conn.getOrInsertObject<Queue>(ID.mData);
 				std::memcpy(param_value, &cmdQueue, sizeof(cl_command_type));
 			}
 			break;
@@ -222,8 +254,7 @@ clGetEventInfo(cl_event event, cl_event_info param_name,
 			auto ID = conn->read<IDPacket>();
 			if (param_value_size_ret) *param_value_size_ret = sizeof(cl_context);
 			if (param_value && param_value_size >= sizeof(cl_context)) {
-				Context* C = conn.getObject<Context>(ID.mData);
-				cl_context context = *C;
+				cl_context context = conn.getOrInsertObject<Context>(ID.mData);
 				std::memcpy(param_value, &context, sizeof(cl_context));
 			}
 			break;
@@ -238,7 +269,16 @@ clGetEventInfo(cl_event event, cl_event_info param_name,
 			}
 			break;
 		}
-		case CL_EVENT_COMMAND_EXECUTION_STATUS:
+		case CL_EVENT_COMMAND_EXECUTION_STATUS: {
+			auto payload = conn->read<SimplePacket<PacketType::Payload, uint32_t>>();
+			// A non-blocking read only completes for the host application once its data is in place.
+			if (static_cast<cl_int>(payload.mData) == CL_COMPLETE) conn.awaitEvent(event);
+			if (param_value_size_ret) *param_value_size_ret = sizeof(cl_int);
+			if (param_value && param_value_size >= sizeof(cl_int)) {
+				std::memcpy(param_value, &payload.mData, sizeof(cl_int));
+			}
+			break;
+		}
 		case CL_EVENT_REFERENCE_COUNT:
 		default:
 			// The "default" should not trigger as the server would issue an error.
@@ -268,7 +308,7 @@ clGetEventProfilingInfo(cl_event event, cl_profiling_info param_name,
 
 	try {
 		IDType id = GetID(event);
-		auto conn = gConnection.get();
+		auto conn = gConnection.get(1, &event);
 		conn->write<GetEventProfilingInfo>({id, param_name});
 		conn->flush();
 
@@ -293,20 +333,37 @@ clWaitForEvents(cl_uint num_events, const cl_event* event_list) CL_API_SUFFIX__V
 	if (num_events == 0) return CL_INVALID_VALUE;
 	if (event_list == nullptr) return CL_INVALID_VALUE;
 
-	try {
-		IDListPacket eventList;
-		eventList.mIDs.reserve(num_events);
-		for (unsigned i = 0; i < num_events; ++i) {
-			if (!event_list[i]) return CL_INVALID_EVENT;
-			eventList.mIDs.push_back(GetID(event_list[i]));
-		}
+	for (cl_uint i = 0; i < num_events; ++i) {
+		if (!event_list[i]) return CL_INVALID_EVENT;
+	}
 
-		auto conn = gConnection.get();
+	try {
+		// The events are waited on through the channels they were created through, a channel
+		// at a time. This holds up neither the main channel nor the queues of other events.
+		std::vector<cl_event> events(event_list, event_list + num_events);
+		for (auto first = events.begin(); first != events.end();) {
+			const Channel* channel = Unwrappers::Unwrap(*first).mChannel;
+			const auto last = std::stable_partition(first, events.end(), [channel](cl_event event) {
+				return Unwrappers::Unwrap(event).mChannel == channel;
+			});
+
+			IDListPacket eventList;
+			eventList.mIDs.reserve(last - first);
+			for (auto it = first; it != last; ++it) {
+				eventList.mIDs.push_back(GetID(*it));
+			}
 
-		conn->write<WaitForEvents>({});
-		conn->write(eventList);
-		conn->flush();
-		conn->read<SuccessPacket>();
+			auto conn = gConnection.get(*first);
+			conn->write<WaitForEvents>({});
+			conn->write(eventList);
+			conn->flush();
+			conn->read<SuccessPacket>();
+			// The data of completed non-blocking reads may still be on the way.
+			for (auto it = first; it != last; ++it) {
+				conn.awaitEvent(*it);
+			}
+			first = last;
+		}
 		return CL_SUCCESS;
 	} catch (const std::bad_alloc&) {
 		return CL_OUT_OF_HOST_MEMORY;
@@ -324,9 +381,7 @@ clRetainEvent(cl_event event) CL_API_SUFFIX__VERSION_1_0
 
 	try {
 		auto conn = gConnection.get();
-		conn->write<Retain>({'E', GetID(event)});
-		conn->flush();
-		conn->read<SuccessPacket>();
+		conn.retain('E', GetID(event));
 	} catch (const ErrorPacket& e) {
 		return e.mData;
 	} catch (...) {
@@ -341,9 +396,7 @@ clReleaseEvent(cl_event event) CL_API_SUFFIX__VERSION_1_0
 
 	try {
 	auto conn = gConnection.get();
-		conn->write<Release>({'E', GetID(event)});
-		conn->flush();
-		conn->read<SuccessPacket>();
+		conn.release('E', GetID(event));
 	} catch (const ErrorPacket& e){
 		return e.mData;
 	} catch (...) {
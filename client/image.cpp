@@ -69,16 +69,19 @@ clEnqueueReadImage(cl_command_queue command_queue, cl_mem image, cl_bool blockin
 		E.mImageID = GetID(image);
 		E.mQueueID = GetID(command_queue);
 
-		auto conn = gConnection.get();
+		auto conn = gConnection.get(command_queue, num_events_in_wait_list, event_wait_list);
 
+		if (event) E.mEventID = conn.allocateID();
 		conn->write(E);
 		if (num_events_in_wait_list) {
 			conn->write(eventList);
 		}
 		conn->flush();
 
-		if (event) *event = conn.registerID<Event>(conn->read<IDPacket>());
 		conn->read<PayloadInto<>>({ptr});
+		// Earlier non-blocking reads on the queue have completed as well.
+		if (Unwrappers::Unwrap(command_queue).inOrder()) conn.awaitReads(E.mQueueID);
+		if (event) *event = conn.registerEvent(E.mEventID);
 		return CL_SUCCESS;
 	} catch (const std::bad_alloc&) {
 		return CL_OUT_OF_HOST_MEMORY;
@@ -129,8 +132,9 @@ clEnqueueWriteImage(cl_command_queue command_queue, cl_mem image, cl_bool blocki
 		E.mImageID = GetID(image);
 		E.mQueueID = GetID(command_queue);
 
-		auto conn = gConnection.get();
+		auto conn = gConnection.get(command_queue, num_events_in_wait_list, event_wait_list);
 
+		if (event) E.mEventID = conn.allocateID();
 		conn->write(E);
 		if (num_events_in_wait_list) {
 			conn->write(eventList);
@@ -141,11 +145,19 @@ clEnqueueWriteImage(cl_command_queue command_queue, cl_mem image, cl_bool blocki
 		// which will be known by the server, so wait for the server to tell us
 		// how much data will be required.
 		auto dataSize = conn->read<SimplePacket<PacketType::Payload, uint32_t>>();
-		// Push out the image data.
-		conn->write<PayloadPtr<>>({ptr, dataSize}).flush();
+		// Push out the image data, in chunks of whole rows if it is large, for the server to write
+		// each while the next arrives.
+		const std::size_t rowSize = dataSize.mData != 0 ? dataSize.mData / (region[1] * region[2]) : 0;
+		const uint8_t* data = static_cast<const uint8_t*>(ptr);
+		for (const ImageChunk& chunk : SplitImageWrite(E.mRegion, rowSize)) {
+			const std::size_t size = chunk.mSlices * chunk.mRows * rowSize;
+			conn->write<PayloadPtr<>>({data, size});
+			data += size;
+		}
+		conn->flush();
 
-		if (event) *event = conn.registerID<Event>(conn->read<IDPacket>());
-		else conn->read<SuccessPacket>();
+		conn->read<SuccessPacket>();
+		if (event) *event = conn.registerEvent(E.mEventID);
 		return CL_SUCCESS;
 	} catch (const std::bad_alloc&) {
 		return CL_OUT_OF_HOST_MEMORY;
@@ -198,7 +210,10 @@ clCreateImage(cl_context context, cl_mem_flags flags,
 
 		if (errcode_ret) *errcode_ret = CL_SUCCESS;
 		IDType imageID = conn->read<IDPacket>();
-		cl_mem image = conn.getOrInsertObject<MemObject>(imageID);
+		// The size depends on the server's layout of the image, so it is asked for.
+		MemObject& image = conn.registerID<MemObject>(imageID);
+		image.mInfo[CL_MEM_TYPE] = EncodeValue<cl_mem_object_type>(image_desc->image_type);
+		image.mInfo[CL_MEM_FLAGS] = EncodeValue<cl_mem_flags>(flags);
 		return image;
 	} catch (const ErrorPacket& e) {
 		ReturnError(e.mData);
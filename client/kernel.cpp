@@ -16,6 +16,7 @@
 #include "objects.h"
 
 #include <cstring>
+#include <utility>
 #include "hints.h"
 #include "connection.h"
 #include "apiutil.h"
@@ -26,6 +27,43 @@
 using namespace RemoteCL;
 using namespace RemoteCL::Client;
 
+namespace
+{
+/// Records the description sent by the server for a new kernel of this program.
+/// The context and program are not kept: the server forgets their IDs once the application
+/// releases them, while the kernel still holds on to them.
+void Describe(Kernel& kernel, KernelDescription& description)
+{
+	kernel.mSignature = std::move(description.mSignature);
+	kernel.mInfo[CL_KERNEL_NUM_ARGS] = EncodeValue<cl_uint>(kernel.mSignature.size());
+	if (!description.mName.empty()) {
+		kernel.mInfo[CL_KERNEL_FUNCTION_NAME].assign(description.mName.begin(), description.mName.end());
+	}
+#if defined(CL_VERSION_1_2)
+	if (!description.mAttributes.empty()) {
+		kernel.mInfo[CL_KERNEL_ATTRIBUTES].assign(description.mAttributes.begin(), description.mAttributes.end());
+	}
+#endif
+}
+
+/// Checks if replies to work-group queries for this parameter can be kept by the kernel.
+/// The local memory size is left out, as it grows with the local arguments set.
+bool IsWorkGroupInfoCacheable(cl_kernel_work_group_info param) noexcept
+{
+	switch (param) {
+		case CL_KERNEL_WORK_GROUP_SIZE:
+		case CL_KERNEL_COMPILE_WORK_GROUP_SIZE:
+#if defined(CL_VERSION_1_1)
+		case CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE:
+		case CL_KERNEL_PRIVATE_MEM_SIZE:
+#endif
+			return true;
+		default:
+			return false;
+	}
+}
+}
+
 SO_EXPORT CL_API_ENTRY cl_kernel CL_API_CALL
 clCreateKernel(cl_program program, const char* kernel_name, cl_int* errcode_ret) CL_API_SUFFIX__VERSION_1_0
 {
@@ -35,13 +73,16 @@ clCreateKernel(cl_program program, const char* kernel_name, cl_int* errcode_ret)
 	try {
 		auto conn = gConnection.get();
 		KernelName createKernel;
-		createKernel.mID = GetID(program);
-		createKernel.mString = kernel_name;
+		createKernel.mProgramID = GetID(program);
+		createKernel.mKernelID = conn.allocateID();
+		createKernel.mName = kernel_name;
+		// The server binds the kernel to this ID and replies with its description.
 		conn->write(createKernel);
-		conn->flush();
-		IDType kernelID = conn->read<IDPacket>();
+		KernelDescription description = conn->read<KernelDescription>();
+		Kernel& ret = conn.registerID<Kernel>(createKernel.mKernelID);
+		Describe(ret, description);
 		if (errcode_ret) *errcode_ret = CL_SUCCESS;
-		return conn.registerID<Kernel>(kernelID);
+		return ret;
 	} catch (const ErrorPacket& e) {
 		ReturnError(e.mData);
 	} catch (std::bad_alloc&) {
@@ -82,7 +123,10 @@ clCreateKernelsInProgram(cl_program program,
 		IDListPacket list = conn->read<IDListPacket>();
 		assert(list.mIDs.size() <= num_kernels && "Remote API should have validated this.");
 		for (IDType id : list.mIDs) {
-			*kernels = conn.registerID<Kernel>(id);
+			Kernel& kernel = conn.registerID<Kernel>(id);
+			KernelDescription description = conn->read<KernelDescription>();
+			Describe(kernel, description);
+			*kernels = kernel;
 			kernels++;
 			if (num_kernels_ret) *num_kernels_ret += 1;
 		}
@@ -103,39 +147,71 @@ clSetKernelArg(cl_kernel kernel, cl_uint arg_index,
 	if (kernel == nullptr) return CL_INVALID_KERNEL;
 
 	try {
+		Kernel& kern = Unwrappers::Unwrap(kernel);
+		if (arg_index >= kern.mSignature.size()) return CL_INVALID_ARG_INDEX;
+		const KernelArgKind kind = static_cast<KernelArgKind>(kern.mSignature[arg_index]);
+
+		// The signature tells us whether arg_value needs translating into an ID
+		// the server understands, so the argument is sent without asking first.
+		IDType memID = NullID;
+		if (kind == KernelArgKind::MemObject) {
+			if (arg_size != sizeof(cl_mem)) return CL_INVALID_ARG_SIZE;
+			// Fetch the ID of the memory object. Either NULL stands for a NULL buffer.
+			cl_mem obj = nullptr;
+			if (arg_value != nullptr) std::memcpy(&obj, arg_value, sizeof(cl_mem));
+			if (obj != nullptr) memID = GetID(obj);
+		} else if (kind == KernelArgKind::Value) {
+			// Should the size be invalid, the server reports it on the next synchronising call.
+			if (arg_value == nullptr) return CL_INVALID_ARG_VALUE;
+		}
+
+		if (gConnection.foldKernelArgs()) {
+			// Only record the argument. It is sent with the next launch, unless unchanged.
+			KernelArgValue value;
+			value.mIndex = arg_index;
+			value.mKind = kind;
+			if (kind == KernelArgKind::MemObject) {
+				value.mData.resize(sizeof(memID));
+				std::memcpy(value.mData.data(), &memID, sizeof(memID));
+			} else if (kind == KernelArgKind::LocalSize) {
+				const uint32_t size = static_cast<uint32_t>(arg_size);
+				value.mData.resize(sizeof(size));
+				std::memcpy(value.mData.data(), &size, sizeof(size));
+			} else {
+				const uint8_t* bytes = reinterpret_cast<const uint8_t*>(arg_value);
+				value.mData.assign(bytes, bytes + arg_size);
+			}
+
+			if (kern.mArgs.size() != kern.mSignature.size()) {
+				kern.mArgs.resize(kern.mSignature.size());
+				kern.mArgChanged.resize(kern.mSignature.size(), false);
+			}
+			// Memory object IDs are recycled once released, so an unchanged ID may
+			// now name a different object: always send those.
+			if (kind == KernelArgKind::MemObject || !(kern.mArgs[arg_index] == value)) {
+				kern.mArgs[arg_index] = std::move(value);
+				kern.mArgChanged[arg_index] = true;
+			}
+			return CL_SUCCESS;
+		}
+
 		KernelArg arg;
-		arg.mKernelID = GetID(kernel);
+		arg.mKernelID = kern.ID;
 		arg.mArgIndex = arg_index;
+		arg.mKind = kind;
 
 		auto conn = gConnection.get();
-
 		conn->write(arg);
-		conn->flush();
-		// Because we don't know if we need to translate the arg_value into an ID
-		// that the server can understand, we need to wait for the server to tell us
-		// what to do.
-		SimplePacket<PacketType::Payload, char> what = conn->read<SimplePacket<PacketType::Payload, char>>();
-		if (what.mData == 'I' && arg_size == sizeof(cl_mem)) {
-			// Fetch the ID of the memory object.
-			cl_mem obj = nullptr;
-			// The following 2 lines will probably catastrophically fail if the host app did something stupid.
-			std::memcpy(&obj, arg_value, sizeof(cl_mem));
-			IDType id = GetID(obj);
-			conn->write<IDPacket>(id);
-		} else if (what.mData == 'S') {
+		if (kind == KernelArgKind::MemObject) {
+			conn->write<IDPacket>(memID);
+		} else if (kind == KernelArgKind::LocalSize) {
 			// This is a local-memory size packet.
 			conn->write<SimplePacket<PacketType::Payload, uint32_t>>({static_cast<uint32_t>(arg_size)});
 		} else {
 			// Send the data verbatim.
-			// This branch will also be taken if the sizeof() checks above are invalid,
-			// in which case the server will send back some error.
-			Payload<> payload;
-			payload.mData.resize(arg_size);
-			std::memcpy(payload.mData.data(), arg_value, arg_size);
-			conn->write(payload);
+			conn->write<PayloadPtr<>>({arg_value, arg_size});
 		}
-		conn->flush();
-		conn->read<SuccessPacket>();
+		conn.submit();
 	} catch (const std::bad_alloc&) {
 		return CL_OUT_OF_HOST_MEMORY;
 	} catch (const ErrorPacket& e) {
@@ -156,25 +232,30 @@ clGetKernelWorkGroupInfo(cl_kernel kernel, cl_device_id device,
 	if (device == nullptr) return CL_INVALID_DEVICE;
 
 	try {
+		Kernel& object = Unwrappers::Unwrap(kernel);
+		const auto key = std::make_pair(GetID(device), uint32_t(param_name));
+		auto conn = gConnection.get();
+		auto cached = object.mWorkGroupInfo.find(key);
+		conn.countInfoQuery(cached != object.mWorkGroupInfo.end());
+		if (cached != object.mWorkGroupInfo.end()) {
+			StoreData(cached->second, param_value, param_value_size, param_value_size_ret);
+			return CL_SUCCESS;
+		}
+
 		KernelWGInfo info;
-		info.mKernelID = GetID(kernel);
-		info.mDeviceID = GetID(device);
+		info.mKernelID = object.ID;
+		info.mDeviceID = key.first;
 		info.mParam = param_name;
-
-		auto conn = gConnection.get();
 		conn->write(info).flush();
 
+		// The reply is translated into the value returned to the host application.
+		std::vector<uint8_t> value;
 		switch (param_name) {
 			case CL_KERNEL_COMPILE_WORK_GROUP_SIZE: {
 				uint64_t sizes[3];
 				conn->read(PayloadInto<uint8_t>(sizes));
-				std::size_t* retVal = reinterpret_cast<std::size_t*>(param_value);
-				if (param_value_size_ret) *param_value_size_ret = 3 * sizeof(std::size_t);
-				if (retVal && param_value_size >= 3 * sizeof(std::size_t)) {
-					retVal[0] = sizes[0];
-					retVal[1] = sizes[1];
-					retVal[2] = sizes[2];
-				}
+				const std::size_t retVal[3] = {std::size_t(sizes[0]), std::size_t(sizes[1]), std::size_t(sizes[2])};
+				value = EncodeValue(retVal);
 				break;
 			}
 
@@ -182,19 +263,16 @@ clGetKernelWorkGroupInfo(cl_kernel kernel, cl_device_id device,
 			case CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE:
 			case CL_KERNEL_WORK_GROUP_SIZE: {
 				std::size_t val = conn->read<SimplePacket<PacketType::Payload, uint64_t>>().mData;
-				Store<std::size_t>(val, param_value, param_value_size, param_value_size_ret);
+				value = EncodeValue(val);
 				break;
 			}
 
-			default: {
-				Payload<> payload = conn->read<Payload<>>();
-				if (param_value_size_ret) *param_value_size_ret = payload.mData.size();
-				if (param_value && param_value_size >= payload.mData.size()) {
-					std::memcpy(param_value, payload.mData.data(), payload.mData.size());
-				}
+			default:
+				value = std::move(conn->read<Payload<>>().mData);
 				break;
-			}
 		}
+		StoreData(value, param_value, param_value_size, param_value_size_ret);
+		if (IsWorkGroupInfoCacheable(param_name)) object.mWorkGroupInfo.emplace(key, std::move(value));
 		return CL_SUCCESS;
 	} catch (const std::bad_alloc&) {
 		return CL_OUT_OF_HOST_MEMORY;
@@ -212,11 +290,18 @@ clGetKernelInfo(cl_kernel kernel, cl_kernel_info param_name, size_t param_value_
 	if (kernel == nullptr) return CL_INVALID_KERNEL;
 
 	try {
+		const Kernel& object = Unwrappers::Unwrap(kernel);
+		auto conn = gConnection.get();
+		auto known = object.mInfo.find(param_name);
+		conn.countInfoQuery(known != object.mInfo.end());
+		if (known != object.mInfo.end()) {
+			StoreData(known->second, param_value, param_value_size, param_value_size_ret);
+			return CL_SUCCESS;
+		}
+
 		KernelInfo info;
-		info.mID = GetID(kernel);
+		info.mID = object.ID;
 		info.mData = param_name;
-
-		auto conn = gConnection.get();
 		conn->write(info).flush();
 
 		switch (param_name) {
@@ -324,8 +409,17 @@ clCloneKernel(cl_kernel source_kernel, cl_int* errcode_ret) CL_API_SUFFIX__VERSI
 		auto conn = gConnection.get();
 		conn->write<SimplePacket<PacketType::CloneKernel, IDType>>({GetID(source_kernel)}).flush();
 		IDType kernelID = conn->read<IDPacket>();
+		// A clone shares the signature and info of its source. The server-side clone only has
+		// the arguments sent so far, so it inherits which ones are still pending too.
+		Kernel& ret = conn.registerID<Kernel>(kernelID);
+		const Kernel& source = Unwrappers::Unwrap(source_kernel);
+		ret.mSignature = source.mSignature;
+		ret.mInfo = source.mInfo;
+		ret.mWorkGroupInfo = source.mWorkGroupInfo;
+		ret.mArgs = source.mArgs;
+		ret.mArgChanged = source.mArgChanged;
 		if (errcode_ret) *errcode_ret = CL_SUCCESS;
-		return conn.registerID<Kernel>(kernelID);
+		return ret;
 	} catch (const std::bad_alloc&) {
 		ReturnError(CL_OUT_OF_HOST_MEMORY);
 	} catch (const ErrorPacket& e) {
@@ -342,9 +436,7 @@ clRetainKernel(cl_kernel kernel) CL_API_SUFFIX__VERSION_1_0
 
 	try {
 		auto conn = gConnection.get();
-		conn->write<Retain>({'K', GetID(kernel)});
-		conn->flush();
-		conn->read<SuccessPacket>();
+		conn.retain('K', GetID(kernel));
 	} catch (const ErrorPacket& e) {
 		return e.mData;
 	} catch (...) {
@@ -361,9 +453,7 @@ clReleaseKernel(cl_kernel kernel) CL_API_SUFFIX__VERSION_1_0
 
 	try {
 		auto conn = gConnection.get();
-		conn->write<Release>({'K', GetID(kernel)});
-		conn->flush();
-		conn->read<SuccessPacket>();
+		conn.release('K', GetID(kernel));
 	} catch (const ErrorPacket& e) {
 		return e.mData;
 	} catch (...) {
@@ -15,6 +15,7 @@
 
 #include "objects.h"
 
+#include <algorithm>
 #include <cstring>
 
 #include "hints.h"
@@ -64,16 +65,17 @@ clEnqueueFillBuffer(cl_command_queue command_queue, cl_mem buffer,
 		}
 		std::memcpy(E.mPattern.data(), pattern, pattern_size);
 
-		auto conn = gConnection.get();
+		auto conn = gConnection.get(command_queue, num_events_in_wait_list, event_wait_list);
 
+		if (event) E.mEventID = conn.allocateID();
 		conn->write(E);
 		if (num_events_in_wait_list) {
 			conn->write(eventList);
 		}
-		conn->flush();
+		conn.submit();
 
-		if (event) *event = conn.registerID<Event>(conn->read<IDPacket>());
-		conn->read<SuccessPacket>();
+		// Fills are not acknowledged; errors are reported on the next synchronising call.
+		if (event) *event = conn.registerEvent(E.mEventID);
 		return CL_SUCCESS;
 	} catch (const std::bad_alloc&) {
 		return CL_OUT_OF_HOST_MEMORY;
@@ -92,12 +94,26 @@ clEnqueueMapBuffer(cl_command_queue command_queue, cl_mem buffer, cl_bool blocki
 {
 	if (buffer == nullptr) ReturnError(CL_INVALID_MEM_OBJECT)
 	if ((map_flags & ~(CL_MAP_READ | CL_MAP_WRITE)) != 0) ReturnError(CL_INVALID_VALUE);
-	// We don't know the buffer's size and offset and as such cannot validate
-	// those arguments. As a possible fix, we could save those parameters when
-	// constructing the memory object.
 
 	try {
 		MemObject& obj = Unwrappers::Unwrap(buffer);
+		// Validate the region against the size and flags recorded on creation, if known.
+		auto bufferSize = obj.mInfo.find(CL_MEM_SIZE);
+		if (bufferSize != obj.mInfo.end()) {
+			const std::size_t available = ReadValue<std::size_t>(bufferSize->second);
+			if (size == 0 || offset > available || size > available - offset) ReturnError(CL_INVALID_VALUE);
+		}
+#if defined(CL_VERSION_1_2)
+		auto bufferFlags = obj.mInfo.find(CL_MEM_FLAGS);
+		if (bufferFlags != obj.mInfo.end()) {
+			const cl_mem_flags flags = ReadValue<cl_mem_flags>(bufferFlags->second);
+			if ((flags & CL_MEM_HOST_NO_ACCESS) != 0 ||
+			    ((flags & CL_MEM_HOST_WRITE_ONLY) != 0 && (map_flags & CL_MAP_READ) != 0) ||
+			    ((flags & CL_MEM_HOST_READ_ONLY) != 0 && (map_flags & CL_MAP_WRITE) != 0)) {
+				ReturnError(CL_INVALID_OPERATION);
+			}
+		}
+#endif
 		auto& mapping = obj.getMapping(size, offset, map_flags);
 		void* ptr = mapping;
 
@@ -110,6 +126,11 @@ clEnqueueMapBuffer(cl_command_queue command_queue, cl_mem buffer, cl_bool blocki
 				// A readbuffer will likely fail due to bad size/offset pairs.
 				ReturnError(CL_INVALID_VALUE);
 			}
+			if (!blocking_map) {
+				// The data may arrive in the background; the unmap must not outrun it.
+				mapping.queue = command_queue;
+				clRetainCommandQueue(command_queue);
+			}
 		} else if (blocking_map && event_wait_list && num_events_in_wait_list != 0) {
 			// The host application expects these events to be completed
 			// on a blocking map.
@@ -166,16 +187,31 @@ clEnqueueReadBuffer(cl_command_queue command_queue, cl_mem buffer, cl_bool block
 		E.mOffset = offset;
 		E.mQueueID = GetID(command_queue);
 
-		auto conn = gConnection.get();
+		auto conn = gConnection.get(command_queue, num_events_in_wait_list, event_wait_list);
 
+		if (event) E.mEventID = conn.allocateID();
+		// The data of a non-blocking read arrives once it completes, so that the host
+		// application can carry on in the meantime.
+		const bool background = !blocking_read && gConnection.backgroundReads();
+		if (background) E.mReadID = conn.expectRead(ptr, E.mQueueID, E.mEventID);
 		conn->write(E);
 		if (num_events_in_wait_list) {
 			conn->write(eventList);
 		}
 		conn->flush();
 
-		if (event) *event = conn.registerID<Event>(conn->read<IDPacket>());
-		conn->read<PayloadInto<>>({ptr});
+		if (!background) {
+			// Large reads arrive in chunks, each sent as soon as the server has it.
+			std::size_t received = 0;
+			do {
+				PayloadInto<> chunk(static_cast<uint8_t*>(ptr) + received, size - received);
+				conn->read(chunk);
+				received += chunk.mSize;
+			} while (received < size);
+			// Earlier non-blocking reads on the queue have completed as well.
+			if (Unwrappers::Unwrap(command_queue).inOrder()) conn.awaitReads(E.mQueueID);
+		}
+		if (event) *event = conn.registerEvent(E.mEventID);
 		return CL_SUCCESS;
 	} catch (const std::bad_alloc&) {
 		return CL_OUT_OF_HOST_MEMORY;
@@ -230,16 +266,19 @@ clEnqueueReadBufferRect(cl_command_queue command_queue, cl_mem buffer, cl_bool b
 		E.mHostSlicePitch = host_slice_pitch;
 		E.mQueueID = GetID(command_queue);
 
-		auto conn = gConnection.get();
+		auto conn = gConnection.get(command_queue, num_events_in_wait_list, event_wait_list);
 
+		if (event) E.mEventID = conn.allocateID();
 		conn->write(E);
 		if (num_events_in_wait_list) {
 			conn->write(eventList);
 		}
 		conn->flush();
 
-		if (event) *event = conn.registerID<Event>(conn->read<IDPacket>());
 		conn->read<PayloadInto<>>({ptr});
+		// Earlier non-blocking reads on the queue have completed as well.
+		if (Unwrappers::Unwrap(command_queue).inOrder()) conn.awaitReads(E.mQueueID);
+		if (event) *event = conn.registerEvent(E.mEventID);
 		return CL_SUCCESS;
 	} catch (const std::bad_alloc&) {
 		return CL_OUT_OF_HOST_MEMORY;
@@ -260,6 +299,12 @@ clEnqueueUnmapMemObject(cl_command_queue command_queue, cl_mem memobj, void* map
 	try {
 		MemObject& obj = Unwrappers::Unwrap(memobj);
 		auto& mapping = obj.getMapping(mapped_ptr);
+		if (mapping.queue != nullptr) {
+			// Neither free nor write back the mapping before the data of the map has landed.
+			gConnection.get(mapping.queue).awaitReads(GetID(mapping.queue));
+			clReleaseCommandQueue(mapping.queue);
+			mapping.queue = nullptr;
+		}
 
 		if ((mapping.flags & CL_MAP_WRITE) != 0) {
 			// Flush out any pending writes.
@@ -319,21 +364,32 @@ clEnqueueWriteBuffer(cl_command_queue command_queue, cl_mem buffer, cl_bool bloc
 		}
 
 		E.mBufferID = GetID(buffer);
-		E.mSize = size; // This is redundant because the payload will have this anyway.
+		E.mSize = size; // Tells the server if the data comes in chunks.
 		E.mOffset = offset;
 		E.mQueueID = GetID(command_queue);
 
-		auto conn = gConnection.get();
+		auto conn = gConnection.get(command_queue, num_events_in_wait_list, event_wait_list);
 
+		if (event) E.mEventID = conn.allocateID();
 		conn->write(E);
 		if (num_events_in_wait_list) {
 			conn->write(eventList);
 		}
-		conn->write<PayloadPtr<>>({ptr, size});
-		conn->flush();
+		if (size > WriteChunkThreshold) {
+			// Each chunk goes out straight away, for the server to write while the next arrives.
+			for (std::size_t sent = 0; sent < size; sent += WriteChunkSize) {
+				conn->write<PayloadPtr<>>({static_cast<const uint8_t*>(ptr) + sent,
+				                           std::min(WriteChunkSize, size - sent)});
+			}
+		} else {
+			conn->write<PayloadPtr<>>({ptr, size});
+		}
 
-		if (event) *event = conn.registerID<Event>(conn->read<IDPacket>());
-		conn->read<SuccessPacket>();
+		// Non-blocking writes are not acknowledged; errors are reported on the
+		// next synchronising call.
+		if (blocking_write) conn->read<SuccessPacket>();
+		else conn.submit();
+		if (event) *event = conn.registerEvent(E.mEventID);
 		return CL_SUCCESS;
 	} catch (const std::bad_alloc&) {
 		return CL_OUT_OF_HOST_MEMORY;
@@ -361,13 +417,33 @@ clCreateBuffer(cl_context context, cl_mem_flags flags, size_t size,
 
 		auto conn = gConnection.get();
 
+		// The server binds the buffer to this ID; any creation error is reported
+		// on the next synchronising call.
+		packet.mID = conn.allocateID();
 		conn->write(packet);
-		if (host_ptr) conn->write<PayloadPtr<>>({host_ptr, size});
-		conn->flush();
+		if (host_ptr && size > WriteChunkThreshold) {
+			// Each chunk goes out straight away, for the server to write while the next arrives.
+			for (std::size_t sent = 0; sent < size; sent += WriteChunkSize) {
+				conn->write<PayloadPtr<>>({static_cast<const uint8_t*>(host_ptr) + sent,
+				                           std::min(WriteChunkSize, size - sent)});
+			}
+		} else if (host_ptr) {
+			conn->write<PayloadPtr<>>({host_ptr, size});
+		}
+		conn.submit();
+		MemObject& object = conn.registerID<MemObject>(packet.mID);
+		object.mInfo[CL_MEM_TYPE] = EncodeValue<cl_mem_object_type>(CL_MEM_OBJECT_BUFFER);
+		object.mInfo[CL_MEM_FLAGS] = EncodeValue<cl_mem_flags>(flags);
+		object.mInfo[CL_MEM_SIZE] = EncodeValue<std::size_t>(size);
+#if defined(CL_VERSION_1_1)
+		object.mInfo[CL_MEM_OFFSET] = EncodeValue<std::size_t>(0);
+#endif
 		if (errcode_ret) *errcode_ret = CL_SUCCESS;
-		return conn.getOrInsertObject<MemObject>(conn->read<IDPacket>());
+		return object;
 	} catch (const ErrorPacket& e) {
 		ReturnError(e.mData);
+	} catch (const std::bad_alloc&) {
+		ReturnError(CL_OUT_OF_HOST_MEMORY);
 	} catch (...) {
 		ReturnError(CL_DEVICE_NOT_AVAILABLE);
 	}
@@ -391,11 +467,20 @@ clCreateSubBuffer(cl_mem buffer, cl_mem_flags flags, cl_buffer_create_type buffe
 
 		auto conn = gConnection.get();
 
-		conn->write(packet).flush();
+		packet.mID = conn.allocateID();
+		conn->write(packet);
+		conn.submit();
+		// The flags may be inherited from the parent, so the server is asked for them.
+		MemObject& object = conn.registerID<MemObject>(packet.mID);
+		object.mInfo[CL_MEM_TYPE] = EncodeValue<cl_mem_object_type>(CL_MEM_OBJECT_BUFFER);
+		object.mInfo[CL_MEM_SIZE] = EncodeValue<std::size_t>(region.size);
+		object.mInfo[CL_MEM_OFFSET] = EncodeValue<std::size_t>(region.origin);
 		if (errcode_ret) *errcode_ret = CL_SUCCESS;
-		return conn.getOrInsertObject<MemObject>(conn->read<IDPacket>());
+		return object;
 	} catch (const ErrorPacket& e) {
 		ReturnError(e.mData);
+	} catch (const std::bad_alloc&) {
+		ReturnError(CL_OUT_OF_HOST_MEMORY);
 	} catch (...) {
 		ReturnError(CL_DEVICE_NOT_AVAILABLE);
 	}
@@ -408,12 +493,18 @@ clGetMemObjectInfo(cl_mem memobj, cl_mem_info param_name, size_t param_value_siz
 	if (memobj == nullptr) return CL_INVALID_MEM_OBJECT;
 
 	try {
-		IDParamPair<PacketType::GetMemObjInfo> query;
-		query.mID = GetID(memobj);
-		query.mData = param_name;
-
+		const MemObject& object = Unwrappers::Unwrap(memobj);
 		auto conn = gConnection.get();
+		auto known = object.mInfo.find(param_name);
+		conn.countInfoQuery(known != object.mInfo.end());
+		if (known != object.mInfo.end()) {
+			StoreData(known->second, param_value, param_value_size, param_value_size_ret);
+			return CL_SUCCESS;
+		}
 
+		IDParamPair<PacketType::GetMemObjInfo> query;
+		query.mID = object.ID;
+		query.mData = param_name;
 		conn->write(query).flush();
 
 		switch (param_name) {
@@ -458,9 +549,7 @@ clRetainMemObject(cl_mem memobj) CL_API_SUFFIX__VERSION_1_0
 
 	try {
 		auto conn = gConnection.get();
-		conn->write<Retain>({'M', GetID(memobj)});
-		conn->flush();
-		conn->read<SuccessPacket>();
+		conn.retain('M', GetID(memobj));
 	} catch (const ErrorPacket& e) {
 		return e.mData;
 	} catch (...) {
@@ -476,9 +565,7 @@ clReleaseMemObject(cl_mem memobj) CL_API_SUFFIX__VERSION_1_0
 
 	try {
 		auto conn = gConnection.get();
-		conn->write<Release>({'M', GetID(memobj)});
-		conn->flush();
-		conn->read<SuccessPacket>();
+		conn.release('M', GetID(memobj));
 	} catch (const ErrorPacket& e){
 		return e.mData;
 	} catch (...) {
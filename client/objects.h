@@ -20,21 +20,31 @@
 #include "CL/cl_icd.h"
 
 #include "idtype.h"
+#include "packets/program.h"
 
 #include <list>
+#include <map>
 #include <memory>
 #include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace RemoteCL
 {
 namespace Client
 {
+struct Channel;
+
 struct CLObject
 {
 	explicit CLObject(IDType id) noexcept : ID(id) {}
 	virtual ~CLObject() {}
 
 	const IDType ID;
+	/// References held by the host application. Objects only reported by queries hold none.
+	uint32_t RefCount = 0;
 };
 
 extern cl_icd_dispatch OCLDispatchTable;
@@ -77,24 +87,60 @@ public:
 	operator Parent&() noexcept { return *mDispatchObject.ptr; }
 };
 
+/// Info values of an object by parameter, in the form of query replies.
+/// These come from the server's inventory, and from the replies to queries for
+/// parameters which cannot change during the lifetime of the object.
+using InfoValues = std::unordered_map<uint32_t, std::vector<uint8_t>>;
+
 struct PlatformID final : public ICDDispatchable<PlatformID, cl_platform_id>
 {
 	using ICDDispatchable::ICDDispatchable;
+
+	/// Checks if replies to queries for this parameter can be kept in mInfo.
+	static bool isCacheable(uint32_t param) noexcept;
+
+	/// Info answered without asking the server.
+	InfoValues mInfo;
+	/// The devices of the platform from the inventory, if the server could list them.
+	std::vector<IDType> mDevices;
+	bool mDevicesListed = false;
 };
 
 struct DeviceID final : public ICDDispatchable<DeviceID, cl_device_id>
 {
 	using ICDDispatchable::ICDDispatchable;
+
+	/// Checks if replies to queries for this parameter can be kept in mInfo.
+	static bool isCacheable(uint32_t param) noexcept;
+
+	/// Info answered without asking the server.
+	InfoValues mInfo;
 };
 
 struct Context final : public ICDDispatchable<Context, cl_context>
 {
 	using ICDDispatchable::ICDDispatchable;
+
+	/// Checks if replies to queries for this parameter can be kept in mInfo.
+	static bool isCacheable(uint32_t param) noexcept;
+
+	/// Info answered without asking the server.
+	InfoValues mInfo;
+	/// Supported image formats by memory flags and image type, as sent by the server.
+	std::map<std::pair<uint64_t, uint32_t>, std::vector<uint8_t>> mImageFormats;
 };
 
 struct Queue final : public ICDDispatchable<Queue, cl_command_queue>
 {
 	using ICDDispatchable::ICDDispatchable;
+
+	/// Info recorded on creation, answered without asking the server.
+	InfoValues mInfo;
+	/// The channel the commands of the queue go through, or nullptr for the main one.
+	Channel* mChannel = nullptr;
+
+	/// Checks if the commands of this queue complete in order, as far as the client knows.
+	bool inOrder() const;
 };
 
 struct Program final : public ICDDispatchable<Program, cl_program>
@@ -105,6 +151,17 @@ struct Program final : public ICDDispatchable<Program, cl_program>
 struct Kernel final : public ICDDispatchable<Kernel, cl_kernel>
 {
 	using ICDDispatchable::ICDDispatchable;
+
+	/// How each argument is passed (see KernelArgKind), as sent by the server on creation.
+	std::string mSignature;
+	/// The last value set for each argument, if arguments are folded into launches.
+	std::vector<KernelArgValue> mArgs;
+	/// Which of mArgs the server has not seen yet.
+	std::vector<bool> mArgChanged;
+	/// Info sent by the server on creation, answered without asking it.
+	InfoValues mInfo;
+	/// Work-group info by device ID and parameter, for parameters which cannot change.
+	std::map<std::pair<IDType, uint32_t>, std::vector<uint8_t>> mWorkGroupInfo;
 };
 
 class MemObject final : public ICDDispatchable<MemObject, cl_mem>
@@ -112,6 +169,10 @@ class MemObject final : public ICDDispatchable<MemObject, cl_mem>
 public:
 	using ICDDispatchable::ICDDispatchable;
 
+	/// Info recorded on creation, answered without asking the server.
+	/// It does not change afterwards, so it can be read without holding the connection.
+	InfoValues mInfo;
+
 	/// Represents a mapping of this object.
 	class Mapping
 	{
@@ -136,6 +197,9 @@ public:
 		const size_t size;
 		const size_t offset;
 		const cl_map_flags flags;
+		/// The queue reading the data of a non-blocking map, retained until the unmap has
+		/// waited on the data.
+		cl_command_queue queue = nullptr;
 	};
 
 	/// Retrieves a memory buffer which can be used to map this Memory Object.
@@ -183,6 +247,11 @@ private:
 struct Event final : public ICDDispatchable<Event, cl_event>
 {
 	using ICDDispatchable::ICDDispatchable;
+
+	/// The channel the command behind the event went through, and how far into it.
+	/// The server knows of the event once it has handled that channel up to there.
+	Channel* mChannel = nullptr;
+	uint64_t mCreatedAt = 0;
 };
 
 /// Extracts the internal object from the OpenCL dispatchable type.
@@ -13,20 +13,32 @@
 // You should have received a copy of the GNU Lesser General Public License
 // along with RemoteCL.  If not, see <https://www.gnu.org/licenses/>.
 
+#include <algorithm>
 #include <cstdint>
 #include <cstring>
+#include <iterator>
 
 #include "CL/cl_platform.h"
 #include "hints.h"
+#include "apiutil.h"
 #include "connection.h"
 #include "objects.h"
 #include "packets/platform.h"
 #include "packets/IDs.h"
+#include "packets/inventory.h"
 #include "packets/payload.h"
 
 using namespace RemoteCL;
 using namespace RemoteCL::Client;
 
+bool PlatformID::isCacheable(uint32_t param) noexcept
+{
+	// Whatever the server sends in the inventory does not change. Extension queries may,
+	// so they are always sent to the server.
+	return std::find(std::begin(InventoryPlatformInfo), std::end(InventoryPlatformInfo), param) !=
+	       std::end(InventoryPlatformInfo);
+}
+
 SO_EXPORT CL_API_ENTRY cl_int CL_API_CALL
 clGetPlatformIDs(cl_uint num_entries, cl_platform_id* platforms, cl_uint* num_platforms) CL_API_SUFFIX__VERSION_1_0
 {
@@ -37,16 +49,20 @@ clGetPlatformIDs(cl_uint num_entries, cl_platform_id* platforms, cl_uint* num_pl
 
 	try {
 		auto conn = gConnection.get();
-		// Request the platform list...
-		conn->write<GetPlatformIDs>({});
-		conn->flush();
-		// ... and wait for it to arrive.
-		IDListPacket list = conn->read<IDListPacket>();
+		std::vector<IDType> ids = conn.platforms();
+		if (ids.empty()) {
+			// The inventory has none, so request the platform list...
+			conn->write<GetPlatformIDs>({});
+			conn->flush();
+			// ... and wait for it to arrive.
+			IDListPacket list = conn->read<IDListPacket>();
+			ids.assign(list.mIDs.begin(), list.mIDs.end());
+		}
 
 		// Create a platform for each ID queried.
-		if (num_platforms) *num_platforms = list.mIDs.size();
+		if (num_platforms) *num_platforms = ids.size();
 		uint32_t entry = 0;
-		for (auto& p : list.mIDs) {
+		for (auto& p : ids) {
 			PlatformID& platform = conn.getOrInsertObject<PlatformID>(p);
 			if (entry < num_entries) {
 				platforms[entry] = platform;
@@ -72,18 +88,21 @@ clGetPlatformInfo(cl_platform_id platform, cl_platform_info param_name,
 	if (platform == nullptr) return CL_INVALID_PLATFORM;
 
 	try {
-		IDType id = GetID(platform);
+		PlatformID& object = Unwrappers::Unwrap(platform);
 		auto conn = gConnection.get();
-		conn->write<GetPlatformInfo>({id, param_name});
-		conn->flush();
-
 		// All platform queries can be passed down straight to client.
-		Payload<uint8_t> payload = conn->read<Payload<uint8_t>>();
-		if (param_value_size_ret) *param_value_size_ret = payload.mData.size();
-		if (param_value && param_value_size >= payload.mData.size()) {
-			std::memcpy(param_value, payload.mData.data(), payload.mData.size());
+		auto cached = object.mInfo.find(param_name);
+		conn.countInfoQuery(cached != object.mInfo.end());
+		if (cached != object.mInfo.end()) {
+			StoreData(cached->second, param_value, param_value_size, param_value_size_ret);
+			return CL_SUCCESS;
 		}
 
+		conn->write<GetPlatformInfo>({object.ID, param_name});
+		conn->flush();
+		Payload<> payload = conn->read<Payload<>>();
+		StoreData(payload.mData, param_value, param_value_size, param_value_size_ret);
+		if (PlatformID::isCacheable(param_name)) object.mInfo.emplace(param_name, std::move(payload.mData));
 		return CL_SUCCESS;
 	} catch (const ErrorPacket& e) {
 		return e.mData;
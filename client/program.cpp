@@ -132,7 +132,7 @@ public:
 		mProgram(program), mCallback(fn), mUserData(userData)
 	{}
 
-	void trigger(PacketStream&) noexcept override
+	void trigger(int32_t) noexcept override
 	{
 		mCallback(mProgram, mUserData);
 	}
@@ -187,14 +187,20 @@ clCompileProgram(cl_program program, cl_uint num_devices, const cl_device_id* de
 		}
 
 		auto conn = gConnection.get();
-		if (pfn_notify && gConnection.hasEventStream()) {
+		if (pfn_notify && gConnection.callbacksEnabled()) {
 			packet.mHasCallback = true;
 			std::unique_ptr<ProgramCallback> callback(new ProgramCallback(program, pfn_notify, user_data));
 			packet.mCallbackID = conn.registerCallback(std::move(callback));
 		}
 
-		conn->write(packet).flush();
-		conn->read<SuccessPacket>();
+		try {
+			conn->write(packet).flush();
+			conn->read<SuccessPacket>();
+		} catch (...) {
+			// The server did not start the compile, so the callback never triggers.
+			if (packet.mHasCallback) conn.unregisterCallback(packet.mCallbackID);
+			throw;
+		}
 
 		// If the callback was not sent to the server, trigger it now.
 		if (pfn_notify && !packet.mHasCallback) {
@@ -349,12 +355,12 @@ clGetProgramInfo(cl_program program, cl_program_info param_name,
 
 		if (param_name == CL_PROGRAM_CONTEXT) {
 			IDPacket id = conn->read<IDPacket>();
-			// We know the context exists.
-			Context* context = conn.getObject<Context>(id);
-			assert(context != nullptr);
+			// The context may have been released by the host application already,
+			// and so come back under a new ID.
+			Context& context = conn.getOrInsertObject<Context>(id);
 			if (param_value_size_ret) *param_value_size_ret = sizeof(cl_context);
 			if (param_value && param_value_size >= sizeof(cl_context)) {
-				*reinterpret_cast<cl_context*>(param_value) = *context;
+				*reinterpret_cast<cl_context*>(param_value) = context;
 			}
 		} else if (param_name == CL_PROGRAM_DEVICES) {
 			IDListPacket list = conn->read<IDListPacket>();
@@ -362,7 +368,7 @@ clGetProgramInfo(cl_program program, cl_program_info param_name,
 			if (param_value && param_value_size >= list.mIDs.size() * sizeof(cl_device_id)) {
 				cl_device_id* ids = reinterpret_cast<cl_device_id*>(param_value);
 				for (IDType id : list.mIDs) {
-					*ids = *conn.getObject<DeviceID>(id);
+					*ids = conn.getOrInsertObject<DeviceID>(id);
 					++ids;
 				}
 			}
@@ -418,9 +424,7 @@ clRetainProgram(cl_program program) CL_API_SUFFIX__VERSION_1_0
 	auto conn = gConnection.get();
 
 	try {
-		conn->write<Retain>({'P', GetID(program)});
-		conn->flush();
-		conn->read<SuccessPacket>();
+		conn.retain('P', GetID(program));
 	} catch (const ErrorPacket& e) {
 		return e.mData;
 	} catch (...) {
@@ -437,9 +441,7 @@ clReleaseProgram(cl_program program) CL_API_SUFFIX__VERSION_1_0
 	auto conn = gConnection.get();
 
 	try {
-		conn->write<Release>({'P', GetID(program)});
-		conn->flush();
-		conn->read<SuccessPacket>();
+		conn.release('P', GetID(program));
 	} catch (const ErrorPacket& e) {
 		return e.mData;
 	} catch (...) {
@@ -30,6 +30,24 @@
 using namespace RemoteCL;
 using namespace RemoteCL::Client;
 
+namespace
+{
+/// Records the info of a new queue, which cannot change. The context and device are not kept:
+/// the server forgets their IDs once the application releases them, while the queue still
+/// holds on to them.
+void Describe(Queue& queue, cl_command_queue_properties properties)
+{
+	queue.mInfo[CL_QUEUE_PROPERTIES] = EncodeValue<cl_command_queue_properties>(properties);
+}
+}
+
+bool Queue::inOrder() const
+{
+	auto properties = mInfo.find(CL_QUEUE_PROPERTIES);
+	if (properties == mInfo.end()) return true;
+	return (ReadValue<cl_command_queue_properties>(properties->second) &
+	        CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE) == 0;
+}
 
 SO_EXPORT CL_API_ENTRY cl_command_queue CL_API_CALL
 clCreateCommandQueue(cl_context context, cl_device_id device,
@@ -51,6 +69,8 @@ clCreateCommandQueue(cl_context context, cl_device_id device,
 		// We expect a single ID.
 		IDPacket ID = conn->read<IDPacket>();
 		Queue& Q = conn.registerID<Queue>(ID);
+		Describe(Q, properties);
+		Q.mChannel = conn.openChannel();
 		if (errcode_ret) *errcode_ret = CL_SUCCESS;
 		return Q;
 	} catch (const std::bad_alloc&) {
@@ -73,8 +93,10 @@ clCreateCommandQueueWithProperties(cl_context context, cl_device_id device, cons
 		CreateQueueWithProp packet;
 		packet.mContext = GetID(context);
 		packet.mDevice = GetID(device);
+		cl_command_queue_properties queueProperties = 0;
 		if (properties) {
 			while (*properties != 0) {
+				if (properties[0] == CL_QUEUE_PROPERTIES) queueProperties = properties[1];
 				// Copy the property ID and payload.
 				packet.mProperties.push_back(*properties);
 				++properties;
@@ -88,6 +110,8 @@ clCreateCommandQueueWithProperties(cl_context context, cl_device_id device, cons
 		// We expect a single ID.
 		IDPacket ID = conn->read<IDPacket>();
 		Queue& Q = conn.registerID<Queue>(ID);
+		Describe(Q, queueProperties);
+		Q.mChannel = conn.openChannel();
 		if (errcode_ret) *errcode_ret = CL_SUCCESS;
 		return Q;
 	} catch (const std::bad_alloc&) {
@@ -107,13 +131,18 @@ clGetCommandQueueInfo(cl_command_queue command_queue, cl_command_queue_info para
 	if (command_queue == nullptr) return CL_INVALID_COMMAND_QUEUE;
 
 	try {
-		auto queue = GetID(command_queue);
-		IDParamPair<PacketType::GetQueueInfo> query;
-		query.mID = queue;
-		query.mData = param_name;
-
+		const Queue& object = Unwrappers::Unwrap(command_queue);
 		auto conn = gConnection.get();
+		auto known = object.mInfo.find(param_name);
+		conn.countInfoQuery(known != object.mInfo.end());
+		if (known != object.mInfo.end()) {
+			StoreData(known->second, param_value, param_value_size, param_value_size_ret);
+			return CL_SUCCESS;
+		}
 
+		IDParamPair<PacketType::GetQueueInfo> query;
+		query.mID = object.ID;
+		query.mData = param_name;
 		conn->write(query).flush();
 
 		switch (param_name) {
@@ -157,7 +186,7 @@ clFlush(cl_command_queue command_queue) CL_API_SUFFIX__VERSION_1_0
 	if (command_queue == nullptr) return CL_INVALID_COMMAND_QUEUE;
 
 	try {
-		auto conn = gConnection.get();
+		auto conn = gConnection.get(command_queue);
 		conn->write<QFlushPacket>(GetID(command_queue));
 		conn->flush();
 		conn->read<SuccessPacket>();
@@ -176,10 +205,12 @@ clFinish(cl_command_queue command_queue) CL_API_SUFFIX__VERSION_1_0
 	if (command_queue == nullptr) return CL_INVALID_COMMAND_QUEUE;
 
 	try {
-		auto conn = gConnection.get();
+		auto conn = gConnection.get(command_queue);
 		conn->write<QFinishPacket>(GetID(command_queue));
 		conn->flush();
 		conn->read<SuccessPacket>();
+		// The reads have completed, but their data may still be on the way.
+		conn.awaitReads(GetID(command_queue));
 	} catch (const ErrorPacket& e) {
 		return e.mData;
 	} catch (...) {
@@ -196,9 +227,7 @@ clRetainCommandQueue(cl_command_queue command_queue) CL_API_SUFFIX__VERSION_1_0
 
 	try {
 		auto conn = gConnection.get();
-		conn->write<Retain>({'Q', GetID(command_queue)});
-		conn->flush();
-		conn->read<SuccessPacket>();
+		conn.retain('Q', GetID(command_queue));
 	} catch (const ErrorPacket& e) {
 		return e.mData;
 	} catch (...) {
@@ -215,9 +244,7 @@ clReleaseCommandQueue(cl_command_queue command_queue) CL_API_SUFFIX__VERSION_1_0
 
 	try {
 		auto conn = gConnection.get();
-		conn->write<Release>({'Q', GetID(command_queue)});
-		conn->flush();
-		conn->read<SuccessPacket>();
+		conn.release('Q', GetID(command_queue));
 	} catch (const ErrorPacket& e){
 		return e.mData;
 	} catch (...) {
@@ -24,8 +24,21 @@ namespace RemoteCL
 /// The underlying integer type used for OpenCL Object IDs, used to translate
 /// the object allocation from client to server.
 /// A small integer type is more efficient to transfer on slow connections, but
-/// obviously limits the number of objects that can be allocated.
+/// obviously limits the number of objects that can be alive at once. IDs are
+/// recycled when objects are released, so this is not a limit on the total.
+/// The width is advertised in the VersionPacket, and both ends must agree on it.
+#if defined(REMOTECL_WIDE_IDS)
+using IDType = uint32_t;
+#else
 using IDType = uint16_t;
+#endif
+
+/// IDs with this bit set are allocated by the client for the objects it creates, so
+/// that creation calls do not need to wait on the server. All other IDs are allocated
+/// by the server for the objects it reports (platforms, devices, query results...).
+constexpr IDType ClientIDFlag = static_cast<IDType>(1u << (sizeof(IDType) * 8 - 1));
+/// The ID of no object, which stands for a NULL argument. The server never assigns it.
+constexpr IDType NullID = 0;
 }
 
 #endif
@@ -20,15 +20,72 @@
 #include <cstdint>
 
 #include "idtype.h"
+#include "packets/payload.h"
 #include "packets/simple.h"
 #include "packets/IDs.h"
 
 namespace RemoteCL
 {
-using OpenEventStream = SignalPacket<PacketType::EventStreamOpen>;
-/// Triggers a predefined callback.
-using CallbackTriggerPacket = SimplePacket<PacketType::CallbackTrigger, uint32_t>;
-using TriggerEventCallback = SimplePacket<PacketType::EventCallbackTrigger, IDType>;
+/// Triggers a predefined callback. The server sends it on its own initiative, through the
+/// same stream as the replies.
+struct CallbackTriggerPacket : public Packet
+{
+	CallbackTriggerPacket() noexcept : Packet(PacketType::CallbackTrigger) {}
+	CallbackTriggerPacket(uint32_t callbackID, int32_t status) noexcept :
+		Packet(PacketType::CallbackTrigger), mCallbackID(callbackID), mStatus(status) {}
+
+	/// Client-side ID for the callback.
+	uint32_t mCallbackID = 0;
+	/// Execution status of the event, for event callbacks.
+	int32_t mStatus = 0;
+};
+
+inline SocketStream& operator <<(SocketStream& o, const CallbackTriggerPacket& P)
+{
+	o << P.mCallbackID;
+	o << P.mStatus;
+	return o;
+}
+
+inline SocketStream& operator >>(SocketStream& i, CallbackTriggerPacket& P)
+{
+	i >> P.mCallbackID;
+	i >> P.mStatus;
+	return i;
+}
+
+/// Carries the data of a non-blocking read back to the client, once the read has completed.
+/// The server sends it on its own initiative, through the same stream as the replies.
+struct ReadDataPacket : public Packet
+{
+	ReadDataPacket() noexcept : Packet(PacketType::ReadData) {}
+	ReadDataPacket(uint32_t readID, int32_t status, const void* data = nullptr, uint32_t size = 0) noexcept :
+		Packet(PacketType::ReadData), mReadID(readID), mStatus(status), mData(data), mSize(size) {}
+
+	/// Client-side ID for the read.
+	uint32_t mReadID = 0;
+	/// Execution status of the read: CL_COMPLETE, or the error it failed with.
+	int32_t mStatus = 0;
+	/// The data read, sent as a payload following the header.
+	const void* mData = nullptr;
+	uint32_t mSize = 0;
+};
+
+inline SocketStream& operator <<(SocketStream& o, const ReadDataPacket& P)
+{
+	o << P.mReadID;
+	o << P.mStatus;
+	o << PayloadPtr<>(P.mData, P.mSize);
+	return o;
+}
+
+/// Only reads the header: the receiver picks where the payload that follows goes.
+inline SocketStream& operator >>(SocketStream& i, ReadDataPacket& P)
+{
+	i >> P.mReadID;
+	i >> P.mStatus;
+	return i;
+}
 
 struct RegisterEventCallback : public Packet
 {
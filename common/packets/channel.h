@@ -0,0 +1,104 @@
+// This file is part of RemoteCL.
+
+// RemoteCL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// RemoteCL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public License
+// along with RemoteCL.  If not, see <https://www.gnu.org/licenses/>.
+
+#if !defined(REMOTECL_PACKET_CHANNEL_H)
+#define REMOTECL_PACKET_CHANNEL_H
+/// @file channel.h Defines the packets which set up and order the channels of a connection.
+
+#include <cstdint>
+#include <string>
+
+#include "packets/packet.h"
+#include "packets/simple.h"
+#include "streamserialise.h"
+
+namespace RemoteCL
+{
+/// Asks the server for another channel to the same session, served by its own thread.
+/// The server replies with a ChannelAddressPacket, or with an ErrorPacket if it cannot.
+using OpenChannel = SignalPacket<PacketType::ChannelOpen>;
+
+/// Where the client connects its new channel. The server waits on it for a few seconds.
+struct ChannelAddressPacket : public Packet
+{
+	ChannelAddressPacket() noexcept : Packet(PacketType::ChannelAddress) {}
+
+	/// Unix domain socket path to connect to, or empty to connect to mPort on the server host.
+	std::string mPath;
+	uint16_t mPort = 0;
+	/// Sent back through the channel, so that the server knows who connected.
+	uint64_t mToken = 0;
+	/// Index of the channel within the connection, whose main channel is 0.
+	uint32_t mChannel = 0;
+};
+
+inline SocketStream& operator <<(SocketStream& o, const ChannelAddressPacket& p)
+{
+	o << p.mPath << p.mPort << p.mToken << p.mChannel;
+	return o;
+}
+
+inline SocketStream& operator >>(SocketStream& i, ChannelAddressPacket& p)
+{
+	i >> p.mPath >> p.mPort >> p.mToken >> p.mChannel;
+	return i;
+}
+
+/// Sent by the client as the first packet of a new channel. The server does not reply.
+struct ChannelHello : public Packet
+{
+	ChannelHello() noexcept : Packet(PacketType::ChannelHello) {}
+
+	/// The token and channel index of the ChannelAddressPacket. Channels opened one after
+	/// the other may connect in any order.
+	uint64_t mToken = 0;
+	uint32_t mChannel = 0;
+};
+
+inline SocketStream& operator <<(SocketStream& o, const ChannelHello& p)
+{
+	return o << p.mToken << p.mChannel;
+}
+
+inline SocketStream& operator >>(SocketStream& i, ChannelHello& p)
+{
+	return i >> p.mToken >> p.mChannel;
+}
+
+/// The commands after this one depend on commands sent through another channel.
+/// The server handles them once it has read that channel up to this many bytes.
+/// It does not reply.
+struct ChannelSync : public Packet
+{
+	ChannelSync() noexcept : Packet(PacketType::ChannelSync) {}
+	ChannelSync(uint32_t channel, uint64_t bytes) noexcept :
+		Packet(PacketType::ChannelSync), mChannel(channel), mBytes(bytes) {}
+
+	uint32_t mChannel = 0;
+	uint64_t mBytes = 0;
+};
+
+inline SocketStream& operator <<(SocketStream& o, const ChannelSync& p)
+{
+	return o << p.mChannel << p.mBytes;
+}
+
+inline SocketStream& operator >>(SocketStream& i, ChannelSync& p)
+{
+	return i >> p.mChannel >> p.mBytes;
+}
+}
+
+#endif
@@ -17,10 +17,14 @@
 #define REMOTECL_PACKET_COMMANDS_H
 /// @file commands.h Defines packets for commands.
 
+#include <algorithm>
 #include <array>
+#include <cstddef>
+#include <vector>
 
 #include "idtype.h"
 #include "packets/packet.h"
+#include "packets/program.h"
 #include "socketstream.h"
 #include "streamserialise.h"
 
@@ -36,9 +40,13 @@ struct EnqueueKernel final : public Packet
 
 	IDType mKernelID;
 	IDType mQueueID;
+	/// Client-allocated ID for the returned event, if mWantEvent is set.
+	IDType mEventID = 0;
 	uint8_t mWorkDim;
 	bool mWantEvent = false;
 	bool mExpectEventList = false;
+	/// Kernel arguments changed since the last launch, set right before enqueuing.
+	Serialiseable<std::vector<KernelArgValue>, uint16_t> mArgs;
 };
 
 template<PacketType Type>
@@ -48,6 +56,8 @@ struct ImageRW final : public Packet
 
 	IDType mImageID;
 	IDType mQueueID;
+	/// Client-allocated ID for the returned event, if mWantEvent is set.
+	IDType mEventID = 0;
 	uint32_t mRowPitch, mSlicePitch;
 	std::array<uint32_t, 3> mOrigin;
 	std::array<uint32_t, 3> mRegion;
@@ -66,8 +76,13 @@ struct BufferRW final : public Packet
 
 	IDType mBufferID;
 	IDType mQueueID;
+	/// Client-allocated ID for the returned event, if mWantEvent is set.
+	IDType mEventID = 0;
 	uint32_t mSize;
 	uint32_t mOffset;
+	/// Client-side ID for a non-blocking read, whose data is sent back in a ReadDataPacket
+	/// once the read completes, rather than in a reply. 0 if the read replies with its data.
+	uint32_t mReadID = 0;
 	bool mWantEvent = false;
 	bool mExpectEventList = false;
 	bool mBlock;
@@ -80,6 +95,8 @@ struct BufferRectRW final : public Packet
 
 	IDType mBufferID;
 	IDType mQueueID;
+	/// Client-allocated ID for the returned event, if mWantEvent is set.
+	IDType mEventID = 0;
 	std::array<uint32_t, 3> mBufferOrigin;
 	std::array<uint32_t, 3> mHostOrigin;
 	std::array<uint32_t, 3> mRegion;
@@ -94,12 +111,53 @@ using ReadBuffer = BufferRW<PacketType::ReadBuffer>;
 using ReadBufferRect = BufferRectRW<PacketType::ReadBufferRect>;
 using WriteBuffer = BufferRW<PacketType::WriteBuffer>;
 
+/// The data of a WriteBuffer, or of a CreateBuffer, larger than this follows as payloads of
+/// WriteChunkSize (the last one smaller), which the server writes to the device as they arrive.
+/// The data of a WriteImage follows as the payloads of SplitImageWrite().
+constexpr std::size_t WriteChunkThreshold = 8 << 20;
+constexpr std::size_t WriteChunkSize = 4 << 20;
+
+/// The part of the region of an image write sent as one payload: mRows rows, from mRow on,
+/// of mSlices slices, from mSlice on.
+struct ImageChunk
+{
+	std::size_t mSlice, mSlices;
+	std::size_t mRow, mRows;
+};
+
+/// Splits the region of an image write, whose tightly packed rows are this many bytes, into
+/// chunks of about WriteChunkSize: whole slices if one fits, otherwise rows of a slice.
+/// Writes of WriteChunkThreshold bytes or less are a single chunk.
+inline std::vector<ImageChunk> SplitImageWrite(const std::array<uint32_t, 3>& region, std::size_t rowSize)
+{
+	std::vector<ImageChunk> chunks;
+	const std::size_t sliceSize = rowSize * region[1];
+	if (sliceSize * region[2] <= WriteChunkThreshold) {
+		chunks.push_back({0, region[2], 0, region[1]});
+	} else if (sliceSize <= WriteChunkSize) {
+		const std::size_t slices = WriteChunkSize / sliceSize;
+		for (std::size_t slice = 0; slice < region[2]; slice += slices) {
+			chunks.push_back({slice, std::min<std::size_t>(slices, region[2] - slice), 0, region[1]});
+		}
+	} else {
+		const std::size_t rows = std::max<std::size_t>(WriteChunkSize / rowSize, 1);
+		for (std::size_t slice = 0; slice < region[2]; ++slice) {
+			for (std::size_t row = 0; row < region[1]; row += rows) {
+				chunks.push_back({slice, 1, row, std::min<std::size_t>(rows, region[1] - row)});
+			}
+		}
+	}
+	return chunks;
+}
+
 struct FillBuffer final : public Packet
 {
 	FillBuffer() noexcept : Packet(PacketType::FillBuffer) {}
 
 	IDType mBufferID;
 	IDType mQueueID;
+	/// Client-allocated ID for the returned event, if mWantEvent is set.
+	IDType mEventID = 0;
 	uint32_t mOffset;
 	uint32_t mSize;
 	uint8_t mPatternSize;
@@ -121,7 +179,9 @@ inline SocketStream& operator <<(SocketStream& o, const EnqueueKernel& E)
 	o << E.mLocalSize;
 
 	o << E.mWantEvent;
+	o << E.mEventID;
 	o << E.mExpectEventList;
+	o << E.mArgs;
 
 	return o;
 }
@@ -137,7 +197,9 @@ inline SocketStream& operator >>(SocketStream& i, EnqueueKernel& E)
 	i >> E.mLocalSize;
 
 	i >> E.mWantEvent;
+	i >> E.mEventID;
 	i >> E.mExpectEventList;
+	i >> E.mArgs;
 
 	return i;
 }
@@ -155,6 +217,7 @@ SocketStream& operator <<(SocketStream& o, const ImageRW<Type>& E)
 	o << E.mSlicePitch;
 
 	o << E.mWantEvent;
+	o << E.mEventID;
 	o << E.mExpectEventList;
 	o << E.mBlock;
 
@@ -174,6 +237,7 @@ SocketStream& operator >>(SocketStream& i, ImageRW<Type>& E)
 	i >> E.mSlicePitch;
 
 	i >> E.mWantEvent;
+	i >> E.mEventID;
 	i >> E.mExpectEventList;
 	i >> E.mBlock;
 
@@ -187,7 +251,9 @@ SocketStream& operator <<(SocketStream& o, const BufferRW<Type>& E)
 	o << E.mQueueID;
 	o << E.mSize;
 	o << E.mOffset;
+	o << E.mReadID;
 	o << E.mWantEvent;
+	o << E.mEventID;
 	o << E.mExpectEventList;
 	o << E.mBlock;
 
@@ -201,7 +267,9 @@ SocketStream& operator >>(SocketStream& i, BufferRW<Type>& E)
 	i >> E.mQueueID;
 	i >> E.mSize;
 	i >> E.mOffset;
+	i >> E.mReadID;
 	i >> E.mWantEvent;
+	i >> E.mEventID;
 	i >> E.mExpectEventList;
 	i >> E.mBlock;
 
@@ -221,6 +289,7 @@ SocketStream& operator <<(SocketStream& o, const BufferRectRW<Type>& E)
 	o << E.mHostRowPitch;
 	o << E.mHostSlicePitch;
 	o << E.mWantEvent;
+	o << E.mEventID;
 	o << E.mExpectEventList;
 	o << E.mBlock;
 
@@ -240,6 +309,7 @@ SocketStream& operator >>(SocketStream& i, BufferRectRW<Type>& E)
 	i >> E.mHostRowPitch;
 	i >> E.mHostSlicePitch;
 	i >> E.mWantEvent;
+	i >> E.mEventID;
 	i >> E.mExpectEventList;
 	i >> E.mBlock;
 
@@ -254,6 +324,7 @@ inline SocketStream& operator <<(SocketStream& o, const FillBuffer& E)
 	o << E.mOffset;
 	o << E.mPatternSize;
 	o << E.mWantEvent;
+	o << E.mEventID;
 	o << E.mExpectEventList;
 	o << E.mPattern;
 
@@ -268,6 +339,7 @@ inline SocketStream& operator >>(SocketStream& i, FillBuffer& E)
 	i >> E.mOffset;
 	i >> E.mPatternSize;
 	i >> E.mWantEvent;
+	i >> E.mEventID;
 	i >> E.mExpectEventList;
 	i >> E.mPattern;
 
@@ -39,7 +39,7 @@ struct CreateContext : public Packet
 	CreateContext() noexcept : Packet(PacketType::CreateContext) {}
 
 	Serialiseable<std::vector<uint64_t>, uint8_t> mProperties;
-	Serialiseable<std::vector<uint16_t>> mDevices;
+	Serialiseable<std::vector<IDType>> mDevices;
 };
 
 struct GetImageFormats final : public Packet
@@ -25,7 +25,8 @@
 
 namespace RemoteCL
 {
-using CreateUserEvent = SimplePacket<PacketType::CreateUserEvent, IDType>;
+/// Pairs the context ID with the client-allocated ID for the new event.
+using CreateUserEvent = IDTypePair<PacketType::CreateUserEvent, IDType>;
 using SetUserEventStatus = IDTypePair<PacketType::SetUserEventStatus, uint32_t>;
 using GetEventInfo = IDParamPair<PacketType::GetEventInfo>;
 using GetEventProfilingInfo = IDParamPair<PacketType::GetEventProfilingInfo>;
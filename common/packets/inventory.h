@@ -0,0 +1,171 @@
+// This file is part of RemoteCL.
+
+// RemoteCL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// RemoteCL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public License
+// along with RemoteCL.  If not, see <https://www.gnu.org/licenses/>.
+
+#if !defined(REMOTECL_PACKET_INVENTORY_H)
+#define REMOTECL_PACKET_INVENTORY_H
+/// @file inventory.h Defines the packet listing the platforms and devices of the server.
+
+#include <cstdint>
+#include <vector>
+
+#include "CL/cl.h"
+
+#include "idtype.h"
+#include "packets/packet.h"
+
+namespace RemoteCL
+{
+/// Platform info sent in the inventory. None of it changes while the platform is loaded, so the
+/// client keeps it for the whole connection.
+const cl_platform_info InventoryPlatformInfo[] = {
+	CL_PLATFORM_PROFILE, CL_PLATFORM_VERSION, CL_PLATFORM_NAME, CL_PLATFORM_VENDOR,
+	CL_PLATFORM_EXTENSIONS,
+#if defined(CL_VERSION_2_1)
+	CL_PLATFORM_HOST_TIMER_RESOLUTION,
+#endif
+};
+
+/// Device info sent in the inventory: everything but the reference count and availability, which
+/// are the only device info that can change. The client keeps it for the whole connection.
+const cl_device_info InventoryDeviceInfo[] = {
+	CL_DEVICE_TYPE, CL_DEVICE_VENDOR_ID, CL_DEVICE_MAX_COMPUTE_UNITS,
+	CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS, CL_DEVICE_MAX_WORK_GROUP_SIZE, CL_DEVICE_MAX_WORK_ITEM_SIZES,
+	CL_DEVICE_PREFERRED_VECTOR_WIDTH_CHAR, CL_DEVICE_PREFERRED_VECTOR_WIDTH_SHORT,
+	CL_DEVICE_PREFERRED_VECTOR_WIDTH_INT, CL_DEVICE_PREFERRED_VECTOR_WIDTH_LONG,
+	CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT, CL_DEVICE_PREFERRED_VECTOR_WIDTH_DOUBLE,
+	CL_DEVICE_MAX_CLOCK_FREQUENCY, CL_DEVICE_ADDRESS_BITS, CL_DEVICE_MAX_READ_IMAGE_ARGS,
+	CL_DEVICE_MAX_WRITE_IMAGE_ARGS, CL_DEVICE_MAX_MEM_ALLOC_SIZE, CL_DEVICE_IMAGE2D_MAX_WIDTH,
+	CL_DEVICE_IMAGE2D_MAX_HEIGHT, CL_DEVICE_IMAGE3D_MAX_WIDTH, CL_DEVICE_IMAGE3D_MAX_HEIGHT,
+	CL_DEVICE_IMAGE3D_MAX_DEPTH, CL_DEVICE_IMAGE_SUPPORT, CL_DEVICE_MAX_PARAMETER_SIZE,
+	CL_DEVICE_MAX_SAMPLERS, CL_DEVICE_MEM_BASE_ADDR_ALIGN, CL_DEVICE_MIN_DATA_TYPE_ALIGN_SIZE,
+	CL_DEVICE_SINGLE_FP_CONFIG, CL_DEVICE_GLOBAL_MEM_CACHE_TYPE, CL_DEVICE_GLOBAL_MEM_CACHELINE_SIZE,
+	CL_DEVICE_GLOBAL_MEM_CACHE_SIZE, CL_DEVICE_GLOBAL_MEM_SIZE, CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE,
+	CL_DEVICE_MAX_CONSTANT_ARGS, CL_DEVICE_LOCAL_MEM_TYPE, CL_DEVICE_LOCAL_MEM_SIZE,
+	CL_DEVICE_ERROR_CORRECTION_SUPPORT, CL_DEVICE_PROFILING_TIMER_RESOLUTION, CL_DEVICE_ENDIAN_LITTLE,
+	CL_DEVICE_COMPILER_AVAILABLE, CL_DEVICE_EXECUTION_CAPABILITIES, CL_DEVICE_QUEUE_PROPERTIES,
+	CL_DEVICE_NAME, CL_DEVICE_VENDOR, CL_DRIVER_VERSION, CL_DEVICE_PROFILE, CL_DEVICE_VERSION,
+	CL_DEVICE_EXTENSIONS, CL_DEVICE_PLATFORM,
+#if defined(CL_VERSION_1_1)
+	CL_DEVICE_PREFERRED_VECTOR_WIDTH_HALF, CL_DEVICE_HOST_UNIFIED_MEMORY,
+	CL_DEVICE_NATIVE_VECTOR_WIDTH_CHAR, CL_DEVICE_NATIVE_VECTOR_WIDTH_SHORT,
+	CL_DEVICE_NATIVE_VECTOR_WIDTH_INT, CL_DEVICE_NATIVE_VECTOR_WIDTH_LONG,
+	CL_DEVICE_NATIVE_VECTOR_WIDTH_FLOAT, CL_DEVICE_NATIVE_VECTOR_WIDTH_DOUBLE,
+	CL_DEVICE_NATIVE_VECTOR_WIDTH_HALF, CL_DEVICE_OPENCL_C_VERSION,
+#endif
+#if defined(CL_VERSION_1_2)
+	CL_DEVICE_DOUBLE_FP_CONFIG, CL_DEVICE_LINKER_AVAILABLE, CL_DEVICE_BUILT_IN_KERNELS,
+	CL_DEVICE_IMAGE_MAX_BUFFER_SIZE, CL_DEVICE_IMAGE_MAX_ARRAY_SIZE, CL_DEVICE_PARENT_DEVICE,
+	CL_DEVICE_PARTITION_MAX_SUB_DEVICES, CL_DEVICE_PARTITION_PROPERTIES,
+	CL_DEVICE_PARTITION_AFFINITY_DOMAIN, CL_DEVICE_PARTITION_TYPE,
+	CL_DEVICE_PREFERRED_INTEROP_USER_SYNC, CL_DEVICE_PRINTF_BUFFER_SIZE,
+#endif
+#if defined(CL_VERSION_2_0)
+	CL_DEVICE_IMAGE_PITCH_ALIGNMENT, CL_DEVICE_IMAGE_BASE_ADDRESS_ALIGNMENT,
+	CL_DEVICE_MAX_READ_WRITE_IMAGE_ARGS, CL_DEVICE_MAX_GLOBAL_VARIABLE_SIZE,
+	CL_DEVICE_QUEUE_ON_DEVICE_PROPERTIES, CL_DEVICE_QUEUE_ON_DEVICE_PREFERRED_SIZE,
+	CL_DEVICE_QUEUE_ON_DEVICE_MAX_SIZE, CL_DEVICE_MAX_ON_DEVICE_QUEUES, CL_DEVICE_MAX_ON_DEVICE_EVENTS,
+	CL_DEVICE_SVM_CAPABILITIES, CL_DEVICE_GLOBAL_VARIABLE_PREFERRED_TOTAL_SIZE,
+	CL_DEVICE_MAX_PIPE_ARGS, CL_DEVICE_PIPE_MAX_ACTIVE_RESERVATIONS, CL_DEVICE_PIPE_MAX_PACKET_SIZE,
+	CL_DEVICE_PREFERRED_PLATFORM_ATOMIC_ALIGNMENT, CL_DEVICE_PREFERRED_GLOBAL_ATOMIC_ALIGNMENT,
+	CL_DEVICE_PREFERRED_LOCAL_ATOMIC_ALIGNMENT,
+#endif
+#if defined(CL_VERSION_2_1)
+	CL_DEVICE_IL_VERSION, CL_DEVICE_MAX_NUM_SUB_GROUPS, CL_DEVICE_SUB_GROUP_INDEPENDENT_FORWARD_PROGRESS,
+#endif
+};
+
+/// Sent by the server right after its version: every platform and device, with the info
+/// that does not change during a connection. The client answers discovery queries from it.
+struct InventoryPacket : public Packet
+{
+	InventoryPacket() noexcept : Packet(PacketType::Inventory) {}
+
+	/// An info parameter, with its value in the form of a reply to a query for it.
+	struct Info
+	{
+		uint32_t mParam;
+		std::vector<uint8_t> mValue;
+	};
+
+	struct Object
+	{
+		IDType mID;
+		std::vector<Info> mInfo;
+	};
+
+	struct Platform : public Object
+	{
+		/// The server could list the devices, so mDevices holds all of them.
+		bool mDevicesListed = false;
+		/// The devices of the platform, in the order of a CL_DEVICE_TYPE_ALL query.
+		std::vector<Object> mDevices;
+	};
+
+	std::vector<Platform> mPlatforms;
+};
+
+inline SocketStream& operator <<(SocketStream& o, const InventoryPacket::Object& object)
+{
+	o << object.mID << static_cast<uint32_t>(object.mInfo.size());
+	for (const InventoryPacket::Info& info : object.mInfo) {
+		o << info.mParam << static_cast<uint32_t>(info.mValue.size());
+		o.write(info.mValue.data(), info.mValue.size());
+	}
+	return o;
+}
+
+inline SocketStream& operator >>(SocketStream& i, InventoryPacket::Object& object)
+{
+	uint32_t count = 0;
+	i >> object.mID >> count;
+	object.mInfo.resize(count);
+	for (InventoryPacket::Info& info : object.mInfo) {
+		uint32_t size = 0;
+		i >> info.mParam >> size;
+		info.mValue.resize(size);
+		i.read(info.mValue.data(), size);
+	}
+	return i;
+}
+
+inline SocketStream& operator <<(SocketStream& o, const InventoryPacket& p)
+{
+	o << static_cast<uint32_t>(p.mPlatforms.size());
+	for (const InventoryPacket::Platform& platform : p.mPlatforms) {
+		o << static_cast<const InventoryPacket::Object&>(platform);
+		o << static_cast<uint8_t>(platform.mDevicesListed) << static_cast<uint32_t>(platform.mDevices.size());
+		for (const InventoryPacket::Object& device : platform.mDevices) o << device;
+	}
+	return o;
+}
+
+inline SocketStream& operator >>(SocketStream& i, InventoryPacket& p)
+{
+	uint32_t count = 0;
+	i >> count;
+	p.mPlatforms.resize(count);
+	for (InventoryPacket::Platform& platform : p.mPlatforms) {
+		uint8_t listed = 0;
+		i >> static_cast<InventoryPacket::Object&>(platform);
+		i >> listed >> count;
+		platform.mDevicesListed = listed != 0;
+		platform.mDevices.resize(count);
+		for (InventoryPacket::Object& device : platform.mDevices) i >> device;
+	}
+	return i;
+}
+}
+
+#endif
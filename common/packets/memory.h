@@ -30,6 +30,8 @@ struct CreateBuffer final : public Packet
 	uint32_t mSize;
 
 	IDType mContextID;
+	/// Client-allocated ID for the new buffer.
+	IDType mID;
 	bool mExpectPayload = false;
 };
 
@@ -43,6 +45,8 @@ struct CreateSubBuffer final : public Packet
 	uint32_t mCreateType;
 
 	IDType mBufferID;
+	/// Client-allocated ID for the new sub-buffer.
+	IDType mID;
 };
 
 inline SocketStream& operator <<(SocketStream& o, const CreateBuffer& b)
@@ -50,6 +54,7 @@ inline SocketStream& operator <<(SocketStream& o, const CreateBuffer& b)
 	o << b.mFlags;
 	o << b.mSize;
 	o << b.mContextID;
+	o << b.mID;
 	o << b.mExpectPayload;
 
 	return o;
@@ -60,6 +65,7 @@ inline SocketStream& operator >>(SocketStream& i, CreateBuffer& b)
 	i >> b.mFlags;
 	i >> b.mSize;
 	i >> b.mContextID;
+	i >> b.mID;
 	i >> b.mExpectPayload;
 
 	return i;
@@ -72,6 +78,7 @@ inline SocketStream& operator <<(SocketStream& o, const CreateSubBuffer& b)
 	o << b.mOffset;
 	o << b.mCreateType;
 	o << b.mBufferID;
+	o << b.mID;
 
 	return o;
 }
@@ -83,6 +90,7 @@ inline SocketStream& operator >>(SocketStream& i, CreateSubBuffer& b)
 	i >> b.mOffset;
 	i >> b.mCreateType;
 	i >> b.mBufferID;
+	i >> b.mID;
 
 	return i;
 }
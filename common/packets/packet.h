@@ -29,6 +29,8 @@ enum class PacketType : uint8_t
 {
 	/// Encodes the version of the protocol.
 	Version,
+	/// The platforms and devices of the server, sent after its version.
+	Inventory,
 
 	/// Some undetermined data burst.
 	Payload,
@@ -38,9 +40,8 @@ enum class PacketType : uint8_t
 	/// Sent when a command fails. The client throws an exception when this is received.
 	Error,
 
-	// Reference count manipulation.
-	Retain,
-	Release,
+	/// Reference count changes, batched by the client.
+	RefCounts,
 
 	// Context functions.
 	CreateContext,
@@ -113,14 +114,25 @@ enum class PacketType : uint8_t
 	/// A list of IDs, used to query platform and device IDs.
 	IDList,
 
-	/// Requests an event stream port.
-	EventStreamOpen,
-	/// Requests an event trigger.
+	/// Sent by the server when a callback triggers. It may arrive ahead of the reply to a command.
 	CallbackTrigger,
+	/// Sent by the server with the data of a non-blocking read, once the read has completed.
+	/// Like a callback trigger, it may arrive ahead of the reply to a command.
+	ReadData,
 	// Event callback registration.
 	RegisterEventCallback,
-	/// Provides callback details about an Event Callback.
-	EventCallbackTrigger,
+
+	/// Requests the server to map memory shared with a client on the same machine.
+	SharedMemoryOpen,
+
+	/// Requests an extra connection to the server, for the commands of a queue.
+	ChannelOpen,
+	/// Where to connect the requested channel, sent by the server.
+	ChannelAddress,
+	/// The first packet sent through a channel, which ties it to the connection.
+	ChannelHello,
+	/// Holds the commands that follow until another channel has been handled up to a point.
+	ChannelSync,
 
 	// Signals the server that the connection is about to be terminated.
 	Terminate = 0xFFu
@@ -19,13 +19,19 @@
 /// Defines packets to transfer generic data block.
 /// If compression is enabled, the bursts will be automatically (de)compressed
 /// if the size is above the threshold.
+/// If the stream has shared memory attached, large bursts are moved through it instead,
+/// uncompressed, and only their position goes through the socket.
 
+#include <cstring>
+#include <limits>
+#include <memory>
 #include <vector>
 
 #if defined(REMOTECL_USE_ZLIB)
 #include "compression.h"
 #endif
 #include "packet.h"
+#include "sharedmemory.h"
 
 namespace RemoteCL
 {
@@ -63,21 +69,86 @@ struct PayloadPtr : public Packet
 };
 
 /// De-serialise a payload packet directly into this pointer.
+/// A payload larger than the capacity, if one is given, is a protocol error.
 template<typename SizeT = PayloadDefaultSizeT>
 struct PayloadInto : public Packet
 {
 	PayloadInto() = delete;
-	PayloadInto(void* ptr) noexcept : Packet(PacketType::Payload), mPtr(ptr) {}
+	PayloadInto(void* ptr, std::size_t capacity = std::numeric_limits<std::size_t>::max()) noexcept :
+		Packet(PacketType::Payload), mPtr(ptr), mCapacity(capacity) {}
 
 	void* mPtr = nullptr;
+	std::size_t mCapacity;
+	/// Size of the payload, once read.
+	std::size_t mSize = 0;
 };
 
+/// Like Payload, but data that arrives through shared memory is left in place rather than copied.
+/// That data is only valid until the next payload is read; call own() to keep it longer.
+template<typename SizeT = PayloadDefaultSizeT>
+struct PayloadView : public Packet
+{
+	PayloadView() noexcept : Packet(PacketType::Payload) {}
+
+	/// Copies the data into mData, unless it is already there.
+	void own()
+	{
+		if (mData && mPtr == mData.get()) return;
+		mData.reset(new uint8_t[mSize]);
+		std::memcpy(mData.get(), mPtr, mSize);
+		mPtr = mData.get();
+	}
+
+	const void* mPtr = nullptr;
+	std::size_t mSize = 0;
+	/// Holds the data if it did not arrive through shared memory. Left uninitialised until the
+	/// data is read into it, as it is all overwritten.
+	std::unique_ptr<uint8_t[]> mData;
+};
+
+/// Finds space in the memory shared with the peer where a payload of this size can be produced,
+/// so that sending it as a PayloadPtr does not copy it.
+/// @returns nullptr if the payload must be produced elsewhere.
+inline void* SharedPayloadSpace(SharedMemory* shared, std::size_t size) noexcept
+{
+	if (shared == nullptr || size < SharedMemory::Threshold) return nullptr;
+	return shared->sendRing().next(size);
+}
+
+/// Sends the position of a payload moved through shared memory, following its size.
+/// @returns false if the payload data must follow in the stream instead.
+inline bool WriteSharedPayload(SocketStream& o, const void* data, std::size_t size)
+{
+	SharedMemory* shared = o.sharedMemory();
+	if (shared == nullptr || size < SharedMemory::Threshold) return false;
+	SharedRing& ring = shared->sendRing();
+	const uint64_t position = ring.reserve(size);
+	o << position;
+	if (position == SharedRing::NoSpace) return false;
+	uint8_t* out = ring.at(position);
+	// Skip the copy if the data was produced in place (see SharedPayloadSpace).
+	if (out != data) std::memcpy(out, data, size);
+	return true;
+}
+
+/// Reads the position written by WriteSharedPayload.
+/// @returns the payload data, or nullptr if it follows in the stream.
+inline const void* ReadSharedPayload(SocketStream& i, std::size_t size)
+{
+	SharedMemory* shared = i.sharedMemory();
+	if (shared == nullptr || size < SharedMemory::Threshold) return nullptr;
+	uint64_t position;
+	i >> position;
+	if (position == SharedRing::NoSpace) return nullptr;
+	return shared->receiveRing().acquire(position, size);
+}
+
 // PayloadPtr can only be serialised
 template<typename SizeT>
 SocketStream& operator <<(SocketStream& o, const PayloadPtr<SizeT>& p)
 {
 #if defined(REMOTECL_USE_ZLIB)
-	if (p.mSize >= Payload<>::CompressionSizeThreshold) {
+	if (p.mSize >= Payload<>::CompressionSizeThreshold && !o.sharedMemory()) {
 		// Attempt to compress the data.
 		std::vector<uint8_t> compressed = Compress(p.mPtr, p.mSize);
 		if (compressed.size() != 0 && compressed.size() < p.mSize) {
@@ -97,6 +168,7 @@ SocketStream& operator <<(SocketStream& o, const PayloadPtr<SizeT>& p)
 #endif
 
 	o << p.mSize;
+	if (WriteSharedPayload(o, p.mPtr, p.mSize)) return o;
 	if (p.mSize) o.write(p.mPtr, p.mSize);
 	return o;
 }
@@ -114,6 +186,8 @@ SocketStream& operator >>(SocketStream& i, PayloadInto<SizeT>& p)
 
 #if defined(REMOTECL_USE_ZLIB)
 	if (decompressedSize != 0) {
+		if (decompressedSize > p.mCapacity) throw Socket::Error();
+		p.mSize = decompressedSize;
 		// Read the compressed data.
 		std::vector<uint8_t> compressed;
 		compressed.resize(dataSize);
@@ -124,6 +198,13 @@ SocketStream& operator >>(SocketStream& i, PayloadInto<SizeT>& p)
 	}
 #endif
 
+	if (dataSize > p.mCapacity) throw Socket::Error();
+	p.mSize = dataSize;
+	if (const void* shared = ReadSharedPayload(i, dataSize)) {
+		std::memcpy(p.mPtr, shared, dataSize);
+		i.sharedMemory()->receiveRing().releaseAcquired();
+		return i;
+	}
 	if (dataSize) i.read(p.mPtr, dataSize);
 	return i;
 }
@@ -133,7 +214,7 @@ SocketStream& operator <<(SocketStream& o, const Payload<SizeT>& p)
 {
 #if defined(REMOTECL_USE_ZLIB)
 	// Should we try to compress the payload?
-	if (p.mData.size() >= Payload<>::CompressionSizeThreshold) {
+	if (p.mData.size() >= Payload<>::CompressionSizeThreshold && !o.sharedMemory()) {
 		std::vector<uint8_t> compressed = Compress(p.mData.data(), p.mData.size());
 		if (compressed.size() != 0 && compressed.size() < p.mData.size()) {
 			SizeT decompressedSize = p.mData.size();
@@ -149,6 +230,7 @@ SocketStream& operator <<(SocketStream& o, const Payload<SizeT>& p)
 
 	SizeT dataSize = p.mData.size();
 	o << dataSize;
+	if (WriteSharedPayload(o, p.mData.data(), dataSize)) return o;
 	o.write(p.mData.data(), dataSize);
 	return o;
 }
@@ -163,6 +245,11 @@ SocketStream& operator >>(SocketStream& i, Payload<SizeT>& p)
 
 	SizeT dataSize;
 	i >> dataSize;
+	if (const uint8_t* shared = reinterpret_cast<const uint8_t*>(ReadSharedPayload(i, dataSize))) {
+		p.mData.assign(shared, shared + dataSize);
+		i.sharedMemory()->receiveRing().releaseAcquired();
+		return i;
+	}
 	p.mData.resize(dataSize);
 	i.read(p.mData.data(), dataSize);
 
@@ -177,6 +264,37 @@ SocketStream& operator >>(SocketStream& i, Payload<SizeT>& p)
 #endif
 	return i;
 }
+
+template<typename SizeT>
+SocketStream& operator >>(SocketStream& i, PayloadView<SizeT>& p)
+{
+#if defined(REMOTECL_USE_ZLIB)
+	SizeT decompressedSize;
+	i >> decompressedSize;
+#endif
+
+	SizeT dataSize;
+	i >> dataSize;
+	p.mSize = dataSize;
+	// Left to be handed back by the next payload through shared memory.
+	if (const void* shared = ReadSharedPayload(i, dataSize)) {
+		p.mPtr = shared;
+		return i;
+	}
+	p.mData.reset(new uint8_t[dataSize]);
+	i.read(p.mData.get(), dataSize);
+
+#if defined(REMOTECL_USE_ZLIB)
+	if (decompressedSize != 0) {
+		std::unique_ptr<uint8_t[]> decompressed(new uint8_t[decompressedSize]);
+		Decompress(p.mData.get(), dataSize, decompressed.get(), decompressedSize);
+		p.mData = std::move(decompressed);
+		p.mSize = decompressedSize;
+	}
+#endif
+	p.mPtr = p.mData.get();
+	return i;
+}
 }
 
 #endif
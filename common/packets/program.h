@@ -16,8 +16,12 @@
 #if !defined(REMOTECL_PACKET_PROGRAM_H)
 #define REMOTECL_PACKET_PROGRAM_H
 
+#include <cassert>
+#include <vector>
+
 #include "streamserialise.h"
 #include "packets/packet.h"
+#include "packets/simple.h"
 #include "packets/IDs.h"
 
 namespace RemoteCL
@@ -30,6 +34,56 @@ struct IDStringPair final : public Packet
 	std::string mString;
 };
 
+struct KernelName final : public Packet
+{
+	KernelName() : Packet(PacketType::CreateKernel) {}
+
+	/// The ID of the parent program.
+	IDType mProgramID;
+	/// Client-allocated ID for the new kernel.
+	IDType mKernelID;
+	std::string mName;
+};
+
+/// How a kernel argument is passed, derived from its address qualifier.
+enum class KernelArgKind : char
+{
+	/// A global or constant buffer, passed as the ID of the memory object.
+	MemObject = 'I',
+	/// A local buffer, passed as its size.
+	LocalSize = 'S',
+	/// Anything else, passed verbatim as a payload.
+	Value = 'P'
+};
+
+/// Sent by the server on kernel creation: how each argument is passed, and the kernel
+/// info which cannot change, so that the client sets arguments and answers queries alone.
+struct KernelDescription final : public Packet
+{
+	KernelDescription() : Packet(PacketType::Payload) {}
+
+	/// One KernelArgKind per argument.
+	std::string mSignature;
+	/// The function name and attributes in the form of query replies, or empty if unknown.
+	std::string mName;
+	std::string mAttributes;
+};
+
+/// A kernel argument recorded on the client, and sent along with a kernel launch.
+struct KernelArgValue
+{
+	/// The argument index, or ~0u if this argument was never set.
+	uint32_t mIndex = ~0u;
+	KernelArgKind mKind = KernelArgKind::Value;
+	/// Depending on mKind, the memory object ID, the uint32_t local size or the raw value.
+	std::vector<uint8_t> mData;
+
+	bool operator==(const KernelArgValue& other) const noexcept
+	{
+		return mIndex == other.mIndex && mKind == other.mKind && mData == other.mData;
+	}
+};
+
 struct KernelArg final : public Packet
 {
 	KernelArg() : Packet(PacketType::SetKernelArg) {}
@@ -38,6 +92,8 @@ struct KernelArg final : public Packet
 	uint32_t mArgIndex;
 	/// The kernel ID for this argument.
 	IDType mKernelID;
+	/// Which packet carries the argument value.
+	KernelArgKind mKind;
 };
 
 struct KernelArgInfo final : public Packet
@@ -108,7 +164,6 @@ struct LinkProgram final : public Packet
 
 using BinaryProgram = SimplePacket<PacketType::CreateBinaryProgram, IDType>;
 using ProgramSource = IDStringPair<PacketType::CreateSourceProgram>;
-using KernelName = IDStringPair<PacketType::CreateKernel>;
 using BuildProgram = IDStringPair<PacketType::BuildProgram>;
 using ProgramInfo = IDParamPair<PacketType::ProgramInfo>;
 using KernelInfo = IDParamPair<PacketType::KernelInfo>;
@@ -138,6 +193,22 @@ inline SocketStream& operator >>(SocketStream& i, IDStringPair<Type>& p)
 	return i;
 }
 
+inline SocketStream& operator <<(SocketStream& o, const KernelName& p)
+{
+	o << p.mProgramID;
+	o << p.mKernelID;
+	o << p.mName;
+	return o;
+}
+
+inline SocketStream& operator >>(SocketStream& i, KernelName& p)
+{
+	i >> p.mProgramID;
+	i >> p.mKernelID;
+	i >> p.mName;
+	return i;
+}
+
 inline SocketStream& operator <<(SocketStream& o, const ProgramBuildInfo& p)
 {
 	o << p.mParam;
@@ -154,10 +225,27 @@ inline SocketStream& operator >>(SocketStream& i, ProgramBuildInfo& p)
 	return i;
 }
 
+inline SocketStream& operator <<(SocketStream& o, const KernelDescription& p)
+{
+	o << p.mSignature;
+	o << p.mName;
+	o << p.mAttributes;
+	return o;
+}
+
+inline SocketStream& operator >>(SocketStream& i, KernelDescription& p)
+{
+	i >> p.mSignature;
+	i >> p.mName;
+	i >> p.mAttributes;
+	return i;
+}
+
 inline SocketStream& operator <<(SocketStream& o, const KernelArg& arg)
 {
 	o << arg.mKernelID;
 	o << arg.mArgIndex;
+	o << static_cast<char>(arg.mKind);
 	return o;
 }
 
@@ -165,6 +253,32 @@ inline SocketStream& operator >>(SocketStream& i, KernelArg& arg)
 {
 	i >> arg.mKernelID;
 	i >> arg.mArgIndex;
+	char kind;
+	i >> kind;
+	arg.mKind = static_cast<KernelArgKind>(kind);
+	return i;
+}
+
+inline SocketStream& operator <<(SocketStream& o, const KernelArgValue& arg)
+{
+	o << arg.mIndex;
+	o << static_cast<char>(arg.mKind);
+	assert(arg.mData.size() <= std::numeric_limits<uint16_t>::max());
+	o << static_cast<uint16_t>(arg.mData.size());
+	o.write(arg.mData.data(), arg.mData.size());
+	return o;
+}
+
+inline SocketStream& operator >>(SocketStream& i, KernelArgValue& arg)
+{
+	i >> arg.mIndex;
+	char kind;
+	i >> kind;
+	arg.mKind = static_cast<KernelArgKind>(kind);
+	uint16_t size;
+	i >> size;
+	arg.mData.resize(size);
+	i.read(arg.mData.data(), size);
 	return i;
 }
 
@@ -16,37 +16,58 @@
 #if !defined(REMOTECL_PACKET_REFCOUNT_H)
 #define REMOTECL_PACKET_REFCOUNT_H
 
+#include <cstdint>
+#include <vector>
+
 #include "idtype.h"
 #include "packets/packet.h"
 
 namespace RemoteCL
 {
-template<PacketType Ty>
-struct RefCount : public Packet
+/// The change made by the host application to the reference count of an object.
+struct RefCountChange
 {
-	RefCount() noexcept : Packet(Ty) {}
-	RefCount(char objTy, IDType id) noexcept : Packet(Ty), mID(id), mObjTy(objTy) {}
-
 	IDType mID = 0;
 	char mObjTy = 'U';
+	/// Number of retains, less the number of releases.
+	int32_t mDelta = 0;
+	/// The client dropped its last reference to the object, so the ID
+	/// is no longer in use and may be recycled.
+	bool mDrop = false;
 };
 
-using Retain = RefCount<PacketType::Retain>;
-using Release = RefCount<PacketType::Release>;
+/// The reference count changes made since the last command, sent ahead of the next one.
+/// The server does not reply; any error is reported by the next synchronising call.
+struct RefCountBatch : public Packet
+{
+	RefCountBatch() noexcept : Packet(PacketType::RefCounts) {}
+
+	std::vector<RefCountChange> mChanges;
+};
 
-template<PacketType Type>
-SocketStream& operator <<(SocketStream& o, const RefCount<Type>& p)
+inline SocketStream& operator <<(SocketStream& o, const RefCountBatch& p)
 {
-	o << p.mObjTy;
-	o << p.mID;
+	o << static_cast<uint32_t>(p.mChanges.size());
+	for (const RefCountChange& change : p.mChanges) {
+		o << change.mObjTy;
+		o << change.mID;
+		o << change.mDelta;
+		o << change.mDrop;
+	}
 	return o;
 }
 
-template<PacketType Type>
-SocketStream& operator >>(SocketStream& i, RefCount<Type>& p)
+inline SocketStream& operator >>(SocketStream& i, RefCountBatch& p)
 {
-	i >> p.mObjTy;
-	i >> p.mID;
+	uint32_t count;
+	i >> count;
+	p.mChanges.resize(count);
+	for (RefCountChange& change : p.mChanges) {
+		i >> change.mObjTy;
+		i >> change.mID;
+		i >> change.mDelta;
+		i >> change.mDrop;
+	}
 	return i;
 }
 }
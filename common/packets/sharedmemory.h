@@ -0,0 +1,54 @@
+// This file is part of RemoteCL.
+
+// RemoteCL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// RemoteCL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public License
+// along with RemoteCL.  If not, see <https://www.gnu.org/licenses/>.
+
+#if !defined(REMOTECL_PACKET_SHAREDMEMORY_H)
+#define REMOTECL_PACKET_SHAREDMEMORY_H
+/// @file sharedmemory.h Defines the shared memory negotiation packet.
+
+#include <cstdint>
+#include <string>
+
+#include "packets/packet.h"
+#include "streamserialise.h"
+
+namespace RemoteCL
+{
+/// Asks the server to map the shared memory created by the client.
+/// The server replies with a SuccessPacket, after which both ends move large payloads
+/// through it, or with an ErrorPacket if it could not be mapped.
+struct OpenSharedMemory : public Packet
+{
+	OpenSharedMemory() noexcept : Packet(PacketType::SharedMemoryOpen) {}
+
+	/// Name of the shared memory object.
+	std::string mName;
+	/// Size in bytes of each of the two rings.
+	uint64_t mRingSize = 0;
+};
+
+inline SocketStream& operator <<(SocketStream& o, const OpenSharedMemory& p)
+{
+	o << p.mName << p.mRingSize;
+	return o;
+}
+
+inline SocketStream& operator >>(SocketStream& i, OpenSharedMemory& p)
+{
+	i >> p.mName >> p.mRingSize;
+	return i;
+}
+}
+
+#endif
@@ -37,6 +37,20 @@ bool VersionPacket::compressionEnabled() const noexcept
 	return match != std::end(mVersion);
 }
 
+bool VersionPacket::sharedMemoryEnabled() const noexcept
+{
+	// Search for the 's' in the version string.
+	auto match = std::find(std::begin(mVersion)+SWVersionSize, std::end(mVersion), 's');
+	return match != std::end(mVersion);
+}
+
+bool VersionPacket::channelsEnabled() const noexcept
+{
+	// Search for the 'c' in the version string.
+	auto match = std::find(std::begin(mVersion)+SWVersionSize, std::end(mVersion), 'c');
+	return match != std::end(mVersion);
+}
+
 bool VersionPacket::isCompatibleWith(const VersionPacket& v) const noexcept
 {
 	// Client/server versions must match.
@@ -52,7 +66,7 @@ bool VersionPacket::isCompatibleWith(const VersionPacket& v) const noexcept
 		return false;
 	}
 
-	// The event stream support feature may mismatch, so we don't need to check.
+	// The event stream, shared memory and channel support features may mismatch, so we don't need to check.
 
 	return true;
 }
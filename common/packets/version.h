@@ -44,6 +44,10 @@ struct VersionPacket : public Packet
 #endif
 #if defined(REMOTECL_ENABLE_ASYNC)
 		mVersion[i++] = 'e';
+		mVersion[i++] = 'c';
+#endif
+#if defined(REMOTECL_ENABLE_SHARED_MEMORY)
+		mVersion[i++] = 's';
 #endif
 		mVersion[i++] = '\0';
 	}
@@ -55,6 +59,15 @@ struct VersionPacket : public Packet
 	bool eventEnabled() const noexcept;
 	/// Checks if the compression feature is enabled.
 	bool compressionEnabled() const noexcept;
+	/// Checks if payloads can be moved through shared memory.
+	bool sharedMemoryEnabled() const noexcept;
+	/// Checks if the connection can open extra channels, each served by its own thread.
+	bool channelsEnabled() const noexcept;
+	/// Size in bytes of the IDType used by this end.
+	std::size_t idSize() const noexcept
+	{
+		return mVersion[3];
+	}
 
 	// Allow a total of 64 bytes to encode RemoteCL version and features.
 	// This should be sufficient. If more data is required in the future, a second
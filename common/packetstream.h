@@ -17,21 +17,50 @@
 #define REMOTECL_PACKETSTREAM_H
 /// @file packetstream.h
 
+#include <chrono>
+#include <functional>
+
+#include "packets/callbacks.h"
 #include "packets/packet.h"
+#include "packets/payload.h"
 #include "packets/simple.h"
 #include "socketstream.h"
 
 namespace RemoteCL
 {
 /// Transfers packets across a socket.
+/// Written packets are held back until flushed, forming a batch. A batch is flushed
+/// explicitly, or implicitly when waiting on incoming packets.
 class PacketStream
 {
 public:
-	PacketStream(Socket socket) : mStream(std::move(socket)) {}
+	/// @param bufferSize Initial size of the stream buffers (see SocketStream).
+	PacketStream(Socket socket, std::size_t bufferSize = SocketStream::DefaultBufferSize) :
+		mStream(std::move(socket), bufferSize) {}
+
+	/// Statistics on the batches of packets sent through this stream.
+	struct BatchStats
+	{
+		uint64_t batches = 0;
+		uint64_t packets = 0;
+		uint64_t bytes = 0;
+		/// Number of packets in the largest batch.
+		uint64_t largest = 0;
+	};
+
+	/// Handles the callback triggers sent by the peer on its own initiative.
+	using CallbackHandler = std::function<void(const CallbackTriggerPacket&)>;
+	/// Claims the non-blocking read whose data the peer sent back, and gives where that data
+	/// goes, or nullptr to drop it. The data is read in straight after, by the same thread.
+	using ReadDataHandler = std::function<void*(const ReadDataPacket&)>;
 
 	template<typename PacketTy>
 	void read(PacketTy&& packet)
 	{
+		// The peer may be waiting on the current batch before replying.
+		if (mStream.available() == 0) flush();
+		const bool reply = !IsNotice(packet.mType);
+		if (reply) handleNotices(true);
 		PacketType ty; mStream >> ty;
 		if (ty == PacketType::Error) {
 			RemoteCL::ErrorPacket e;
@@ -43,6 +72,8 @@ public:
 		}
 		assert(ty == packet.mType);
 		mStream >> packet;
+		// Notices received along with the reply would otherwise wait on the next one.
+		if (reply) handleNotices(false);
 	}
 
 	/// Reads the incoming packet.
@@ -59,6 +90,11 @@ public:
 	template<typename PacketTy>
 	PacketStream& write(const PacketTy& p)
 	{
+		std::unique_lock<std::mutex> lock = mStream.writeLock();
+		if (mPendingPackets++ == 0) {
+			mBatchStart = std::chrono::steady_clock::now();
+			mBatchFirstByte = mStream.bytesWritten();
+		}
 		mStream << p.mType;
 		mStream << p;
 		return *this;
@@ -67,16 +103,138 @@ public:
 	/// Blocks until there is an incoming packet and returns its type.
 	PacketType nextPacketTy() noexcept
 	{
+		try {
+			if (mStream.available() == 0) flush();
+		} catch (...) {
+			return PacketType::Terminate;
+		}
 		auto ty = mStream.peek();
 		if (ty == -1) return PacketType::Terminate;
 		return static_cast<PacketType>(ty);
 	}
 
-	void flush() { mStream.flush(); }
+	/// Sends out the current batch.
+	void flush()
+	{
+		std::unique_lock<std::mutex> lock = mStream.writeLock();
+		if (mPendingPackets != 0) {
+			mStats.batches++;
+			mStats.packets += mPendingPackets;
+			mStats.bytes += mStream.bytesWritten() - mBatchFirstByte;
+			if (mPendingPackets > mStats.largest) mStats.largest = mPendingPackets;
+			mPendingPackets = 0;
+		}
+		mStream.flush();
+	}
+
+	/// Number of bytes received, but not read yet.
+	std::size_t available() const noexcept { return mStream.available(); }
+	/// Waits until there is incoming data, with a timeout in milliseconds (-1 for none).
+	/// Only looks at the socket, so it can be called while another thread reads the stream.
+	bool poll(int timeout) const { return mStream.socket().poll(timeout); }
+	/// The connection, to wait on it along with others (see Socket::poll).
+	const Socket& socket() const noexcept { return mStream.socket(); }
+
+	/// Positions in the stream, as total numbers of bytes (see SocketStream).
+	uint64_t bytesWritten() const noexcept { return mStream.bytesWritten(); }
+	uint64_t bytesFlushed() const noexcept { return mStream.bytesFlushed(); }
+	uint64_t bytesRead() const noexcept { return mStream.bytesRead(); }
+
+	/// Lets other threads write packets to this stream, in between those of the owner.
+	void shareWrites() { mStream.shareWrites(); }
+
+	/// Tells the peer where each batch ends (see SocketStream::frameWrites()).
+	void frameWrites() noexcept { mStream.frameWrites(); }
+	/// Reads the batches of a peer which frames its writes.
+	void frameReads() noexcept { mStream.frameReads(); }
+	/// Receives what has arrived without waiting (see SocketStream::receiveBatch()).
+	/// @returns true if the next batch of packets can be read without waiting on the peer.
+	bool receiveBatch() { return mStream.receiveBatch(); }
+	/// Checks if the whole of the next batch of packets has been received.
+	bool batchBuffered() const noexcept { return mStream.batchBuffered(); }
+
+	/// Sets the handler of the callback triggers the peer sends between its replies.
+	/// read() hands over those that arrive ahead of or along with the packet it waits on.
+	void setCallbackHandler(CallbackHandler handler) { mCallbackHandler = std::move(handler); }
+	/// Sets the handler of the read data the peer sends between its replies, like the triggers.
+	void setReadDataHandler(ReadDataHandler handler) { mReadDataHandler = std::move(handler); }
+
+	/// Waits on the next packet the peer sends on its own initiative, and hands it over.
+	/// @throws Socket::Error if a packet of another type comes in instead.
+	void readNotice()
+	{
+		if (mStream.available() == 0) flush();
+		PacketType ty; mStream >> ty;
+		if (ty == PacketType::CallbackTrigger) {
+			CallbackTriggerPacket trigger;
+			mStream >> trigger;
+			if (mCallbackHandler) mCallbackHandler(trigger);
+		} else if (ty == PacketType::ReadData) {
+			ReadDataPacket header;
+			mStream >> header;
+			void* out = mReadDataHandler ? mReadDataHandler(header) : nullptr;
+			if (out != nullptr) {
+				PayloadInto<> data(out);
+				mStream >> data;
+			} else {
+				Payload<> dropped;
+				mStream >> dropped;
+			}
+		} else {
+			throw Socket::Error();
+		}
+	}
+
+	/// Number of packets written since the last flush.
+	uint32_t pendingPackets() const noexcept { return mPendingPackets; }
+	/// Number of bytes written since the last flush.
+	uint64_t pendingBytes() const noexcept
+	{
+		return mPendingPackets ? mStream.bytesWritten() - mBatchFirstByte : 0;
+	}
+	/// When the first packet of the current batch was written.
+	std::chrono::steady_clock::time_point batchStart() const noexcept { return mBatchStart; }
+
+	const BatchStats& stats() const noexcept { return mStats; }
+
+	/// Moves large payloads through this memory shared with the peer from now on.
+	/// Both ends must attach it at the same point in the stream.
+	void attach(std::unique_ptr<SharedMemory> sharedMemory) noexcept
+	{
+		mStream.attach(std::move(sharedMemory));
+	}
+	/// The shared memory carrying large payloads, or nullptr if they go through the socket.
+	SharedMemory* sharedMemory() const noexcept { return mStream.sharedMemory(); }
 
 private:
+	/// Checks if the peer sends packets of this type on its own initiative.
+	static bool IsNotice(PacketType ty) noexcept
+	{
+		return ty == PacketType::CallbackTrigger || ty == PacketType::ReadData;
+	}
+
+	/// Hands the notices at the front of the incoming data to their handlers.
+	/// @param wait Wait on incoming data, rather than only look at what was received.
+	void handleNotices(bool wait)
+	{
+		if (!mCallbackHandler && !mReadDataHandler) return;
+		while ((wait || mStream.available() != 0) &&
+		       IsNotice(static_cast<PacketType>(mStream.peek()))) {
+			readNotice();
+		}
+	}
+
 	/// The underlying buffer for the socket.
 	SocketStream mStream;
+	CallbackHandler mCallbackHandler;
+	ReadDataHandler mReadDataHandler;
+
+	/// Number of packets in the current batch.
+	uint32_t mPendingPackets = 0;
+	/// Value of mStream.bytesWritten() when the current batch started.
+	uint64_t mBatchFirstByte = 0;
+	std::chrono::steady_clock::time_point mBatchStart;
+	BatchStats mStats;
 };
 }
 
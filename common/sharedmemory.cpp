@@ -0,0 +1,169 @@
+// This file is part of RemoteCL.
+
+// RemoteCL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// RemoteCL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public License
+// along with RemoteCL.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "sharedmemory.h"
+
+#include <cerrno>
+#include <cstdint> // SIZE_MAX
+#include <new> // placement new
+#include <system_error>
+
+#include "hints.h"
+#include "socket.h"
+
+#if defined(REMOTECL_ENABLE_SHARED_MEMORY)
+	#include <fcntl.h> // O_* constants
+	#include <sys/mman.h>
+	#include <sys/stat.h> // fstat
+	#include <unistd.h>
+#endif
+
+using namespace RemoteCL;
+
+uint64_t SharedRing::placement(std::size_t size) const noexcept
+{
+	const uint64_t offset = mHead % mCapacity;
+	// Payloads are contiguous, so skip the end of the ring if this one does not fit there.
+	return offset + size <= mCapacity ? mHead : mHead - offset + mCapacity;
+}
+
+void* SharedRing::next(std::size_t size) const noexcept
+{
+	const uint64_t position = placement(size);
+	const uint64_t tail = mControl->mTail.load(std::memory_order_acquire);
+	if (size > mCapacity || position + size - tail > mCapacity) return nullptr;
+	return at(position);
+}
+
+uint64_t SharedRing::reserve(std::size_t size) noexcept
+{
+	if (next(size) == nullptr) return NoSpace;
+	const uint64_t position = placement(size);
+	mHead = position + size;
+	return position;
+}
+
+const void* SharedRing::acquire(uint64_t position, std::size_t size)
+{
+	if (Unlikely(size > mCapacity || position % mCapacity + size > mCapacity)) {
+		throw Socket::Error();
+	}
+	release(position);
+	mAcquiredEnd = position + size;
+	return at(position);
+}
+
+#if defined(REMOTECL_ENABLE_SHARED_MEMORY)
+namespace
+{
+/// Closes a file descriptor when leaving scope.
+struct FileCloser
+{
+	~FileCloser() { if (fd >= 0) ::close(fd); }
+	int fd;
+};
+
+std::system_error LastError()
+{
+	return std::system_error(errno, std::generic_category());
+}
+}
+
+SharedMemory::SharedMemory(uint64_t ringSize)
+{
+	// The name only needs to be unique while the peer opens it.
+	static std::atomic<unsigned> counter{0};
+	mName = "/remotecl-" + std::to_string(getpid()) + '-' + std::to_string(counter++);
+	FileCloser file{shm_open(mName.c_str(), O_RDWR|O_CREAT|O_EXCL, 0600)};
+	if (file.fd < 0) throw LastError();
+	mLinked = true;
+	try {
+		map(file.fd, ringSize, true);
+	} catch (...) {
+		unlink();
+		throw;
+	}
+}
+
+SharedMemory::SharedMemory(const std::string& name, uint64_t ringSize)
+{
+	FileCloser file{shm_open(name.c_str(), O_RDWR, 0)};
+	if (file.fd < 0) throw LastError();
+	map(file.fd, ringSize, false);
+}
+
+SharedMemory::~SharedMemory()
+{
+	unlink();
+	if (mMapping) munmap(mMapping, mMappingSize);
+}
+
+void SharedMemory::unlink() noexcept
+{
+	if (mLinked) shm_unlink(mName.c_str());
+	mLinked = false;
+}
+
+void SharedMemory::map(int fd, uint64_t ringSize, bool creator)
+{
+	const std::size_t controlSize = 2 * sizeof(SharedRing::Control);
+	if (ringSize == 0 || ringSize > (SIZE_MAX - controlSize) / 2) {
+		throw std::system_error(EINVAL, std::generic_category());
+	}
+	mMappingSize = controlSize + 2 * ringSize;
+	// The creator sizes the region. The size is checked on the other end, as mapping
+	// beyond the end of the file would fault on access.
+	if (creator && ftruncate(fd, mMappingSize) != 0) throw LastError();
+	struct stat info;
+	if (fstat(fd, &info) != 0) throw LastError();
+	if (static_cast<uint64_t>(info.st_size) < mMappingSize) {
+		throw std::system_error(EINVAL, std::generic_category());
+	}
+
+	mMapping = mmap(nullptr, mMappingSize, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if (mMapping == MAP_FAILED) {
+		mMapping = nullptr;
+		throw LastError();
+	}
+
+	auto* control = reinterpret_cast<SharedRing::Control*>(mMapping);
+	uint8_t* data = reinterpret_cast<uint8_t*>(mMapping) + controlSize;
+	if (creator) {
+		// A fresh mapping is zero-filled, but the atomics must still be constructed.
+		new (&control[0]) SharedRing::Control();
+		new (&control[1]) SharedRing::Control();
+		control[0].mTail.store(0);
+		control[1].mTail.store(0);
+	}
+	SharedRing first(&control[0], data, ringSize);
+	SharedRing second(&control[1], data + ringSize, ringSize);
+	mSend = creator ? first : second;
+	mReceive = creator ? second : first;
+}
+#else
+SharedMemory::SharedMemory(uint64_t)
+{
+	throw std::system_error(ENOSYS, std::generic_category());
+}
+
+SharedMemory::SharedMemory(const std::string&, uint64_t)
+{
+	throw std::system_error(ENOSYS, std::generic_category());
+}
+
+SharedMemory::~SharedMemory() = default;
+
+void SharedMemory::unlink() noexcept {}
+#endif
@@ -0,0 +1,128 @@
+// This file is part of RemoteCL.
+
+// RemoteCL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// RemoteCL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public License
+// along with RemoteCL.  If not, see <https://www.gnu.org/licenses/>.
+
+#if !defined(REMOTECL_SHAREDMEMORY_H)
+#define REMOTECL_SHAREDMEMORY_H
+/// @file sharedmemory.h
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace RemoteCL
+{
+/// A single-producer, single-consumer ring of bytes in memory shared by the client and server.
+/// Space is reserved by the writer, whose peer is told the position of the data through the
+/// socket. The reader hands space back in the order it was reserved.
+class SharedRing
+{
+public:
+	/// Returned by reserve() when the ring is too full.
+	static constexpr uint64_t NoSpace = ~uint64_t(0);
+
+	/// State shared between the writer and the reader of a ring.
+	struct Control
+	{
+		/// Position up to which the reader is done with the data.
+		alignas(64) std::atomic<uint64_t> mTail;
+	};
+
+	SharedRing(Control* control, uint8_t* data, uint64_t capacity) noexcept :
+		mControl(control), mData(data), mCapacity(capacity) {}
+
+	/// Where the next reserve() of this size would place its data, or nullptr if it would fail.
+	/// Allows data to be produced in place before it is sent.
+	void* next(std::size_t size) const noexcept;
+	/// Reserves contiguous space for this many bytes.
+	/// @returns the position of the space, or NoSpace.
+	uint64_t reserve(std::size_t size) noexcept;
+
+	/// Retrieves incoming data at this position. Any data preceding it is handed back to the writer.
+	/// @throws Socket::Error if the peer sent a position outside of the ring.
+	const void* acquire(uint64_t position, std::size_t size);
+	/// Hands the data retrieved by the last acquire() back to the writer.
+	void releaseAcquired() noexcept
+	{
+		release(mAcquiredEnd);
+	}
+
+	/// Pointer to the data at this position.
+	uint8_t* at(uint64_t position) const noexcept
+	{
+		return mData + position % mCapacity;
+	}
+
+private:
+	/// Position of the next reservation, rounded up so that it does not wrap around.
+	uint64_t placement(std::size_t size) const noexcept;
+	/// Hands the data up to this position back to the writer.
+	void release(uint64_t end) noexcept
+	{
+		mControl->mTail.store(end, std::memory_order_release);
+	}
+
+	Control* mControl;
+	uint8_t* mData;
+	uint64_t mCapacity;
+	/// Writer-side position of the next reservation.
+	uint64_t mHead = 0;
+	/// Reader-side end of the data last acquired.
+	uint64_t mAcquiredEnd = 0;
+};
+
+/// A memory region mapped by both ends of a connection on the same machine.
+/// It holds one SharedRing per direction and carries the larger payloads, while
+/// packets keep going through the socket.
+class SharedMemory
+{
+public:
+	/// Payloads smaller than this go through the socket.
+	static constexpr std::size_t Threshold = 4096;
+
+	/// Creates a new region with rings of this many bytes, named so that the peer can open it.
+	/// @throws std::system_error if shared memory is unavailable.
+	explicit SharedMemory(uint64_t ringSize);
+	/// Opens the region created by the peer.
+	/// @throws std::system_error if the region could not be opened.
+	SharedMemory(const std::string& name, uint64_t ringSize);
+	SharedMemory(const SharedMemory&) = delete;
+	SharedMemory& operator=(const SharedMemory&) = delete;
+	~SharedMemory();
+
+	/// Name of the region for the peer to open, until unlink() is called.
+	const std::string& name() const noexcept { return mName; }
+	/// Removes the name of the region. The mappings stay valid.
+	void unlink() noexcept;
+
+	/// Ring for outgoing payloads.
+	SharedRing& sendRing() noexcept { return mSend; }
+	/// Ring for incoming payloads.
+	SharedRing& receiveRing() noexcept { return mReceive; }
+
+private:
+	/// Maps the region and sets up the rings; the creator sends on the first one.
+	void map(int fd, uint64_t ringSize, bool creator);
+
+	std::string mName;
+	bool mLinked = false;
+	void* mMapping = nullptr;
+	std::size_t mMappingSize = 0;
+	SharedRing mSend{nullptr, nullptr, 1};
+	SharedRing mReceive{nullptr, nullptr, 1};
+};
+}
+
+#endif
@@ -15,18 +15,28 @@
 
 #include "socket.h"
 
+#include <algorithm> // std::min
 #include <cassert>
+#include <cerrno>
 #include <cstring>
 #include <iostream>
+#include <vector>
 #include "hints.h"
 
 #if defined(_MSC_VER)
 	#include <WinSock2.h>
 	#include <WS2tcpip.h>
+	#include <afunix.h>
 #else
+	#include <fcntl.h>
 	#include <unistd.h>
 	#include <arpa/inet.h>
 	#include <netdb.h> // addrinfo
+	#include <netinet/tcp.h> // TCP_NODELAY
+	#include <poll.h>
+	#include <sys/socket.h> // sendmsg
+	#include <sys/uio.h> // iovec
+	#include <sys/un.h> // sockaddr_un
 #endif
 
 using namespace RemoteCL;
@@ -59,6 +69,57 @@ public:
 private:
 	addrinfo* mInfo;
 };
+
+/// Fills in the address of a Unix domain socket, or throws if the path does not fit.
+sockaddr_un LocalAddress(const char* path)
+{
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	if (std::strlen(path) >= sizeof(address.sun_path)) {
+		std::cerr << "Socket path " << path << " is too long" << std::endl;
+		throw Socket::Error();
+	}
+	std::strcpy(address.sun_path, path);
+	return address;
+}
+
+/// Connects this socket without waiting on it for longer than timeout milliseconds.
+bool ConnectWithin(Socket::SocketTy socket, const sockaddr* address, socklen_t length, int timeout)
+{
+#if defined(_MSC_VER)
+	u_long nonBlocking = 1;
+	if (ioctlsocket(socket, FIONBIO, &nonBlocking) != 0) return false;
+	bool connected = ::connect(socket, address, length) == 0;
+	if (!connected && WSAGetLastError() == WSAEWOULDBLOCK) {
+		WSAPOLLFD descriptor = {socket, POLLWRNORM, 0};
+		if (WSAPoll(&descriptor, 1, timeout) == 1) {
+			int error = 0;
+			int size = sizeof(error);
+			connected = getsockopt(socket, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&error), &size) == 0 &&
+			            error == 0;
+		}
+	}
+	nonBlocking = 0;
+	return ioctlsocket(socket, FIONBIO, &nonBlocking) == 0 && connected;
+#else
+	const int flags = fcntl(socket, F_GETFL);
+	if (flags < 0 || fcntl(socket, F_SETFL, flags | O_NONBLOCK) != 0) return false;
+	bool connected = ::connect(socket, address, length) == 0;
+	if (!connected && errno == EINPROGRESS) {
+		pollfd descriptor = {socket, POLLOUT, 0};
+		int ready;
+		do {
+			ready = ::poll(&descriptor, 1, timeout);
+		} while (ready < 0 && errno == EINTR);
+		if (ready == 1) {
+			int error = 0;
+			socklen_t size = sizeof(error);
+			connected = getsockopt(socket, SOL_SOCKET, SO_ERROR, &error, &size) == 0 && error == 0;
+		}
+	}
+	return fcntl(socket, F_SETFL, flags) == 0 && connected;
+#endif
+}
 }
 
 RemoteCL::Socket::Socket()
@@ -70,19 +131,25 @@ RemoteCL::Socket::Socket()
 	if (mSocket == InvalidSocket) {
 		throw Error();
 	}
-#if !defined(REMOTECL_DISABLE_KEEP_ALIVE)
 #if defined(_MSC_VER)
 	using ValTy = const char*;
 #else // everyone else
 	using ValTy = const void*;
 #endif // _MSC_VER
 	int val = -1;
+#if !defined(REMOTECL_DISABLE_KEEP_ALIVE)
 	int result = setsockopt(mSocket, SOL_SOCKET, SO_KEEPALIVE, reinterpret_cast<ValTy>(&val), sizeof(val));
 	if (result != 0) {
 		// This isn't a fatal failure; use the socket as-is.
 		std::cerr << "Could not enable socket keep-alive." << std::endl;
 	}
 #endif // REMOTECL_DISABLE_KEEP_ALIVE
+	// Commands are often sent without waiting on a reply. With Nagle's algorithm, each of those
+	// would be held back until the previous one is acknowledged, which the peer delays.
+	// Accepted sockets inherit this option from the listening socket.
+	if (setsockopt(mSocket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<ValTy>(&val), sizeof(val)) != 0) {
+		std::cerr << "Could not disable Nagle's algorithm on socket." << std::endl;
+	}
 }
 
 RemoteCL::Socket::Socket(uint16_t port) : Socket()
@@ -91,12 +158,14 @@ RemoteCL::Socket::Socket(uint16_t port) : Socket()
 	serverAddress.sin_family = AF_INET;
 	serverAddress.sin_addr.s_addr = INADDR_ANY;
 	serverAddress.sin_port = htons(port);
-	if (::bind(mSocket, reinterpret_cast<sockaddr*>(&serverAddress), sizeof(serverAddress)) != 0) {
+	// Listen straight away, so that clients told about this port can connect before accept().
+	if (::bind(mSocket, reinterpret_cast<sockaddr*>(&serverAddress), sizeof(serverAddress)) != 0 ||
+	    listen(mSocket, SOMAXCONN) != 0) {
 		throw Error();
 	}
 }
 
-RemoteCL::Socket::Socket(const char* hostname, uint16_t port) : Socket()
+RemoteCL::Socket::Socket(const char* hostname, uint16_t port, int timeout) : Socket()
 {
 	// Resolve the hostname.
 	AddressInfo host(hostname);
@@ -107,22 +176,52 @@ RemoteCL::Socket::Socket(const char* hostname, uint16_t port) : Socket()
 		sockaddr_in serverAddress = {};
 		serverAddress = *reinterpret_cast<sockaddr_in*>(info->ai_addr);
 		serverAddress.sin_port = htons(port);
-		if (::connect(mSocket, reinterpret_cast<sockaddr*>(&serverAddress), sizeof(serverAddress)) == 0) {
+		const sockaddr* address = reinterpret_cast<sockaddr*>(&serverAddress);
+		if (timeout < 0 ? ::connect(mSocket, address, sizeof(serverAddress)) == 0 :
+		                  ConnectWithin(mSocket, address, sizeof(serverAddress), timeout)) {
 			// Connected
 			return;
 		}
+		if (timeout >= 0) {
+			// The attempt may still be under way; the socket cannot try another address.
+			break;
+		}
 		info = info->ai_next;
 	}
 
 	throw Error();
 }
 
-RemoteCL::Socket RemoteCL::Socket::accept()
+RemoteCL::Socket RemoteCL::Socket::listenLocal(const char* path)
 {
-	if (listen(mSocket, 5) != 0) {
+	const sockaddr_un address = LocalAddress(path);
+	Socket server(::socket(AF_UNIX, SOCK_STREAM, 0));
+	if (server.mSocket == InvalidSocket) {
+		throw Error();
+	}
+	if (::bind(server.mSocket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 ||
+	    listen(server.mSocket, SOMAXCONN) != 0) {
 		throw Error();
 	}
-	sockaddr_in clientAddress;
+	return server;
+}
+
+RemoteCL::Socket RemoteCL::Socket::connectLocal(const char* path)
+{
+	const sockaddr_un address = LocalAddress(path);
+	Socket client(::socket(AF_UNIX, SOCK_STREAM, 0));
+	if (client.mSocket == InvalidSocket) {
+		throw Error();
+	}
+	if (::connect(client.mSocket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+		throw Error();
+	}
+	return client;
+}
+
+RemoteCL::Socket RemoteCL::Socket::accept()
+{
+	sockaddr_storage clientAddress;
 	socklen_t clilen = sizeof(clientAddress);
 	SocketTy clientSockFD = ::accept(mSocket, reinterpret_cast<sockaddr*>(&clientAddress), &clilen);
 	if (clientSockFD < 0) {
@@ -131,17 +230,76 @@ RemoteCL::Socket RemoteCL::Socket::accept()
 	return Socket(clientSockFD);
 }
 
-void RemoteCL::Socket::send(const void* data, std::size_t size)
+void RemoteCL::Socket::send(const void* first, std::size_t firstSize, const void* second, std::size_t secondSize,
+                            bool more)
 {
-	const auto written = ::send(mSocket, reinterpret_cast<const char*>(data), size, 0);
-	if (written < 0) {
-		// Socket likely closed.
-		throw Error();
-	}
+#if defined(_MSC_VER)
+	WSABUF parts[2];
+	parts[0].buf = const_cast<CHAR*>(reinterpret_cast<const CHAR*>(first));
+	parts[0].len = static_cast<ULONG>(firstSize);
+	parts[1].buf = const_cast<CHAR*>(reinterpret_cast<const CHAR*>(second));
+	parts[1].len = static_cast<ULONG>(secondSize);
+	(void)more;
+#else
+	iovec parts[2];
+	parts[0].iov_base = const_cast<void*>(first);
+	parts[0].iov_len = firstSize;
+	parts[1].iov_base = const_cast<void*>(second);
+	parts[1].iov_len = secondSize;
 
-	// This assertion might trigger if the socket disconnected.
-	// We may want to throw an exception instead.
-	assert(static_cast<std::size_t>(written) == size && "Socket buffer full - should retry here");
+	int flags = 0;
+#if defined(MSG_NOSIGNAL)
+	// A closed peer should make this throw, rather than kill the process with SIGPIPE.
+	flags |= MSG_NOSIGNAL;
+#endif
+#if defined(MSG_MORE)
+	if (more) flags |= MSG_MORE;
+#else
+	(void)more;
+#endif
+#endif // _MSC_VER
+
+	// Index of the first part with data left to send.
+	std::size_t part = 0;
+	while (true) {
+#if defined(_MSC_VER)
+		while (part != 2 && parts[part].len == 0) ++part;
+		if (part == 2) return;
+		DWORD written = 0;
+		if (WSASend(mSocket, &parts[part], static_cast<DWORD>(2 - part), &written, 0, nullptr, nullptr) != 0) {
+			// Socket likely closed.
+			throw Error();
+		}
+		// The socket buffer may have taken only part of the data; skip past what was sent.
+		while (written != 0) {
+			const ULONG step = std::min<ULONG>(written, parts[part].len);
+			parts[part].buf += step;
+			parts[part].len -= step;
+			written -= step;
+			if (parts[part].len == 0) ++part;
+		}
+#else
+		while (part != 2 && parts[part].iov_len == 0) ++part;
+		if (part == 2) return;
+		msghdr message = {};
+		message.msg_iov = &parts[part];
+		message.msg_iovlen = 2 - part;
+		auto written = ::sendmsg(mSocket, &message, flags);
+		if (written < 0) {
+			if (errno == EINTR) continue;
+			// Socket likely closed.
+			throw Error();
+		}
+		// The socket buffer may have taken only part of the data; skip past what was sent.
+		while (written != 0) {
+			const std::size_t step = std::min<std::size_t>(written, parts[part].iov_len);
+			parts[part].iov_base = reinterpret_cast<char*>(parts[part].iov_base) + step;
+			parts[part].iov_len -= step;
+			written -= step;
+			if (parts[part].iov_len == 0) ++part;
+		}
+#endif
+	}
 }
 
 std::size_t RemoteCL::Socket::receive(void* data, std::size_t available)
@@ -154,6 +312,55 @@ std::size_t RemoteCL::Socket::receive(void* data, std::size_t available)
 	return bytesRead;
 }
 
+bool RemoteCL::Socket::poll(int timeout) const
+{
+#if defined(_MSC_VER)
+	WSAPOLLFD descriptor = {mSocket, POLLIN, 0};
+	const int ready = WSAPoll(&descriptor, 1, timeout);
+#else
+	pollfd descriptor = {mSocket, POLLIN, 0};
+	int ready;
+	do {
+		ready = ::poll(&descriptor, 1, timeout);
+	} while (ready < 0 && errno == EINTR);
+#endif
+	if (ready < 0) throw Error();
+	// A closed connection counts as incoming data, so that the next receive() reports it.
+	return ready != 0;
+}
+
+bool RemoteCL::Socket::poll(const Socket* const* sockets, std::size_t count, int timeout)
+{
+#if defined(_MSC_VER)
+	std::vector<WSAPOLLFD> descriptors(count);
+	for (std::size_t i = 0; i < count; ++i) {
+		descriptors[i] = {sockets[i]->mSocket, POLLIN, 0};
+	}
+	const int ready = WSAPoll(descriptors.data(), static_cast<ULONG>(count), timeout);
+#else
+	std::vector<pollfd> descriptors(count);
+	for (std::size_t i = 0; i < count; ++i) {
+		descriptors[i] = {sockets[i]->mSocket, POLLIN, 0};
+	}
+	int ready;
+	do {
+		ready = ::poll(descriptors.data(), count, timeout);
+	} while (ready < 0 && errno == EINTR);
+#endif
+	if (ready < 0) throw Error();
+	return ready != 0;
+}
+
+uint16_t RemoteCL::Socket::localPort() const
+{
+	sockaddr_in address = {};
+	socklen_t length = sizeof(address);
+	if (getsockname(mSocket, reinterpret_cast<sockaddr*>(&address), &length) != 0) {
+		throw Error();
+	}
+	return ntohs(address.sin_port);
+}
+
 Socket::PeerName RemoteCL::Socket::getPeerName() noexcept
 {
 	sockaddr_storage addr;
@@ -170,6 +377,9 @@ Socket::PeerName RemoteCL::Socket::getPeerName() noexcept
 	} else if (addr.ss_family == AF_INET6) {
 		// port = ntohs(s6->sin6_port);
 		inet_ntop(AF_INET6, &s6->sin6_addr, name.data, sizeof(name.data));
+	} else if (addr.ss_family == AF_UNIX) {
+		// Unix domain clients are usually unnamed.
+		std::strcpy(name.data, "local socket");
 	} else {
 		assert(false);
 		Unreachable();
@@ -185,4 +395,5 @@ void RemoteCL::Socket::close() noexcept
 #define closesocket(X) ::close(X)
 #endif
 	closesocket(mSocket);
+	mSocket = InvalidSocket;
 }
@@ -27,7 +27,7 @@
 
 namespace RemoteCL
 {
-/// Wraps a TCP Stream socket.
+/// Wraps a TCP or Unix domain stream socket.
 class Socket
 {
 public:
@@ -58,32 +58,60 @@ public:
 		char data[256];
 	};
 
-	/// Opens a server socket on this port.
+	/// Opens a server socket on this port, listening with the largest backlog allowed.
 	explicit Socket(uint16_t port);
 	/// Opens a client socket to this hostname and port.
-	explicit Socket(const char* hostname, uint16_t port);
+	/// @param timeout Milliseconds to wait at most on the connection, or -1 to wait for as
+	///        long as the system tries.
+	explicit Socket(const char* hostname, uint16_t port, int timeout = -1);
+	/// Opens a Unix domain server socket at this path. Fails if a file already exists there.
+	static Socket listenLocal(const char* path);
+	/// Opens a Unix domain client socket to the server at this path.
+	static Socket connectLocal(const char* path);
 	Socket(const Socket&) = delete;
 	Socket(Socket&& o) noexcept { std::swap(o.mSocket, mSocket); }
 	~Socket() noexcept { if (mSocket != InvalidSocket) close(); }
 
 	Socket& operator=(const Socket&) = delete;
 
-	/// Accepts an incoming connection.
+	/// Accepts an incoming connection. Several processes may accept on the same server socket.
 	Socket accept();
 	/// Closes this socket.
 	void close() noexcept;
 
-	/// Send this data burst (blocing).
-	void send(const void* data, std::size_t size);
+	/// Sends this data burst (blocking).
+	/// @param more More data follows straight away, so the socket may hold this back to
+	///        send it in the same segment (MSG_MORE).
+	void send(const void* data, std::size_t size, bool more = false)
+	{
+		send(data, size, nullptr, 0, more);
+	}
+	/// Sends both data bursts in order (blocking), gathered into as few system calls as the
+	/// socket allows. Partial writes are retried until everything is sent.
+	void send(const void* first, std::size_t firstSize, const void* second, std::size_t secondSize,
+	          bool more = false);
 	/// Receives at most these many bytes.
 	/// @param data where the received bytes are stored.
 	/// @param available Maximum number of bytes to receive.
 	/// @returns the number of bytes received.
 	std::size_t receive(void* data, std::size_t available);
+	/// Waits until there is incoming data, or the connection closed.
+	/// @param timeout Milliseconds to wait at most, or -1 to wait indefinitely.
+	/// @returns false if the timeout elapsed first.
+	bool poll(int timeout) const;
+	/// Waits until any of these sockets has incoming data, like poll().
+	/// @returns false if the timeout elapsed first.
+	static bool poll(const Socket* const* sockets, std::size_t count, int timeout);
+
+	/// The port a TCP socket is bound to, such as the one picked for port 0.
+	uint16_t localPort() const;
 
 	/// Returns the host name connected to this socket.
 	PeerName getPeerName() noexcept;
 
+	/// The underlying OS socket, to wait on it with the platform's polling functions.
+	SocketTy handle() const noexcept { return mSocket; }
+
 private:
 	Socket();
 	explicit Socket(SocketTy socket) noexcept : mSocket(socket) {}
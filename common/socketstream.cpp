@@ -21,28 +21,50 @@
 
 using namespace RemoteCL;
 
+constexpr std::size_t SocketStream::DefaultBufferSize;
+constexpr std::size_t SocketStream::MinBufferSize;
+constexpr std::size_t SocketStream::MaxBufferSize;
+constexpr std::size_t SocketStream::FrameHeaderSize;
+constexpr uint32_t SocketStream::FrameEndsBatch;
+constexpr std::size_t SocketStream::MaxFrameSize;
+
+SocketStream::SocketStream(Socket socket, std::size_t bufferSize) :
+	mDirectSize(std::min(std::max(bufferSize, MinBufferSize), MaxBufferSize)),
+	mWriteBuffer(mDirectSize), mReadBuffer(mDirectSize), mSocket(std::move(socket))
+{
+}
+
 void SocketStream::read(void* source, std::size_t count)
 {
 	uint8_t* s = reinterpret_cast<uint8_t*>(source);
+	mBytesRead += count;
 
 	while (count != 0) {
+		if (mFramedReads && mFrameLeft == 0) {
+			readFrameHeader();
+			continue;
+		}
+		/// The part of the data which is in the current frame.
+		const std::size_t wanted = mFramedReads ? std::min(count, mFrameLeft) : count;
 		if (mAvailable == 0) {
-			if (count >= BufferSize) {
+			if (wanted >= mDirectSize) {
 				// read directly into the output - no point in caching.
-				const std::size_t bytesRead = mSocket.receive(s, count);
+				const std::size_t bytesRead = receive(s, wanted);
+				if (bytesRead == 0) throw Socket::Error();
 				s += bytesRead;
 				count -= bytesRead;
+				if (mFramedReads) mFrameLeft -= bytesRead;
 				continue;
 			}
 			readMoreData();
 			if (mAvailable == 0) throw Socket::Error();
 		}
 
-		assert(mAvailable <= BufferSize);
+		assert(mAvailable <= mReadBuffer.size());
 		assert(mAvailable != 0 && "Didn't we just try to read more data in?");
 
 		/// The real data size we will be transferring on this iteration.
-		const std::size_t readSize = std::min<std::size_t>(count, mAvailable);
+		const std::size_t readSize = std::min<std::size_t>(wanted, mAvailable);
 		assert(readSize != 0 && "Must always read something");
 		assert(readSize <= mAvailable && "std::min didn't work.");
 		std::memcpy(s, &mReadBuffer[mReadOffset], readSize);
@@ -50,57 +72,168 @@ void SocketStream::read(void* source, std::size_t count)
 		mReadOffset += readSize;
 		mAvailable -= readSize;
 		count -= readSize;
+		if (mFramedReads) mFrameLeft -= readSize;
 
-		if (mReadOffset == BufferSize) {
+		if (mReadOffset == mReadBuffer.size()) {
 			assert(mAvailable == 0);
 		} else {
-			assert(mReadOffset < BufferSize && "Went around the buffer.");
+			assert(mReadOffset < mReadBuffer.size() && "Went around the buffer.");
+		}
+	}
+}
+
+void SocketStream::readFrameHeader()
+{
+	// Headers are not counted in bytesRead(), as the peer does not count them as written.
+	uint32_t header;
+	uint8_t* h = reinterpret_cast<uint8_t*>(&header);
+	for (std::size_t i = 0; i < sizeof(header); ++i) {
+		if (mAvailable == 0) {
+			readMoreData();
+			if (mAvailable == 0) throw Socket::Error();
+		}
+		h[i] = mReadBuffer[mReadOffset++];
+		--mAvailable;
+	}
+	mFrameLeft = header & ~FrameEndsBatch;
+	mFrameEndsBatch = (header & FrameEndsBatch) != 0;
+}
+
+bool SocketStream::batchBuffered() const noexcept
+{
+	assert(mFramedReads);
+	std::size_t offset = mReadOffset;
+	std::size_t left = mAvailable;
+	std::size_t frameLeft = mFrameLeft;
+	bool endsBatch = mFrameEndsBatch;
+	// An empty frame which ends the batch the last packets were read from does not start another.
+	bool data = frameLeft != 0;
+	while (true) {
+		if (left < frameLeft) return false;
+		offset += frameLeft;
+		left -= frameLeft;
+		if (endsBatch && data) return true;
+
+		if (left < FrameHeaderSize) return false;
+		uint32_t header;
+		std::memcpy(&header, &mReadBuffer[offset], sizeof(header));
+		offset += FrameHeaderSize;
+		left -= FrameHeaderSize;
+		frameLeft = header & ~FrameEndsBatch;
+		endsBatch = (header & FrameEndsBatch) != 0;
+		data = data || frameLeft != 0;
+	}
+}
+
+bool SocketStream::receiveBatch()
+{
+	if (batchBuffered()) return true;
+	// Make room for the rest after what has been received so far.
+	if (mReadOffset != 0) {
+		std::memmove(mReadBuffer.data(), &mReadBuffer[mReadOffset], mAvailable);
+		mReadOffset = 0;
+	}
+	while (mSocket.poll(0)) {
+		if (mAvailable == mReadBuffer.size()) {
+			// The rest is received while the batch is read, as it would be without the buffer.
+			// The reader waits on it then, however slowly it arrives.
+			if (mReadBuffer.size() == MaxBufferSize) return true;
+			mReadBuffer.resize(std::min(mReadBuffer.size() * 2, MaxBufferSize));
 		}
+		const std::size_t received = mSocket.receive(&mReadBuffer[mAvailable], mReadBuffer.size() - mAvailable);
+		// Closed: reading finds out.
+		if (received == 0) return true;
+		mAvailable += received;
+		if (batchBuffered()) return true;
 	}
+	return false;
 }
 
 void SocketStream::readMoreData()
 {
 	assert(mAvailable == 0 && "You still have data to go through - read that first.");
-	assert(mAvailable < BufferSize && "Buffer is already full - should not call this.");
+	if (mReadBufferFilled && mReadBuffer.size() < MaxBufferSize) {
+		mReadBuffer.resize(std::min(mReadBuffer.size() * 2, MaxBufferSize));
+	}
 	mReadOffset = 0;
-	const std::size_t bytesRead = mSocket.receive(mReadBuffer, BufferSize);
-	assert(bytesRead <= BufferSize && "received out of buffer.");
+	const std::size_t bytesRead = receive(mReadBuffer.data(), mReadBuffer.size());
+	assert(bytesRead <= mReadBuffer.size() && "received out of buffer.");
 	mAvailable = bytesRead;
+	mReadBufferFilled = bytesRead == mReadBuffer.size();
+}
+
+std::size_t SocketStream::receive(void* data, std::size_t available)
+{
+	if (!mWriteMutex) {
+		flush();
+		return mSocket.receive(data, available);
+	}
+	// The other writers of a shared stream flush before they let go of it, so the one holding
+	// it sends whatever is buffered. It is not waited on: it may be blocked until the peer
+	// reads, and the peer until this end does.
+	std::unique_lock<std::mutex> lock(*mWriteMutex, std::try_to_lock);
+	if (lock.owns_lock()) flush();
+	if (lock.owns_lock()) lock.unlock();
+	return mSocket.receive(data, available);
 }
 
 void SocketStream::write(const void* out, std::size_t n)
 {
 	const uint8_t* s = reinterpret_cast<const uint8_t*>(out);
 
-	// No point in buffering the output if we'd have to flush straight away.
-	if (static_cast<std::size_t>(n) >= BufferSize) {
-		if (mWriteOffset != 0) flushWriteBuffer();
-		// Just write out the whole output directly into the socket.
-		mSocket.send(s, n);
+	// No point in buffering large output.
+	if (n >= mDirectSize) {
+		mBytesWritten += n;
+		if (mWriteStart == 0) {
+			// Send what is buffered (usually the packet header) and the output in one go.
+			mSocket.send(mWriteBuffer.data(), mWriteOffset, s, n);
+			mWriteOffset = 0;
+			mBytesFlushed.store(mBytesWritten, std::memory_order_release);
+			return;
+		}
+		// Likewise, in frames which leave the batch open: the rest of the packet follows.
+		while (n != 0) {
+			const std::size_t size = std::min(n, MaxFrameSize - (mWriteOffset - mWriteStart));
+			const uint32_t header = static_cast<uint32_t>(mWriteOffset - mWriteStart + size);
+			std::memcpy(mWriteBuffer.data(), &header, sizeof(header));
+			mSocket.send(mWriteBuffer.data(), mWriteOffset, s, size);
+			mWriteOffset = mWriteStart;
+			s += size;
+			n -= size;
+		}
+		mFrameOpen = true;
+		mBytesFlushed.store(mBytesWritten, std::memory_order_release);
 		return;
 	}
 
+	// Batches of small packets grow the buffer, rather than go out in pieces.
+	if (n > mWriteBuffer.size() - mWriteOffset && mWriteBuffer.size() < MaxBufferSize) {
+		mWriteBuffer.resize(std::min(mWriteBuffer.size() * 2, MaxBufferSize));
+	}
+
 	/// How many bytes are left to be written.
 	std::size_t leftToWrite = n;
 	// This will loop at most twice, since a write larger than the buffer
 	// will have already been written out to the socket.
 	while (leftToWrite != 0) {
 		/// Available size on the output buffer.
-		const std::size_t available = BufferSize - mWriteOffset;
+		const std::size_t available = mWriteBuffer.size() - mWriteOffset;
 		/// How much data we can write in this go:
 		const std::size_t writeSize = std::min<std::size_t>(available, leftToWrite);
 
 		// Write as much data as possible in this iteration.
 		std::memcpy(&mWriteBuffer[mWriteOffset], s, writeSize);
 		mWriteOffset += writeSize;
-		assert(mWriteOffset <= BufferSize && "Wrote past end of WriteBuffer");
+		// Counted as it is buffered, so that a flush along the way covers exactly what was sent.
+		mBytesWritten += writeSize;
+		assert(mWriteOffset <= mWriteBuffer.size() && "Wrote past end of WriteBuffer");
 		// Advance source buffer.
 		s += writeSize;
 
 		// Ensure that we don't leave the buffer completely full.
-		if (mWriteOffset == BufferSize) {
-			flushWriteBuffer();
+		// The rest of the output stays buffered, to be sent before we wait on the peer.
+		if (mWriteOffset == mWriteBuffer.size()) {
+			flushWriteBuffer(leftToWrite != writeSize, false);
 		}
 
 		assert(leftToWrite >= writeSize && "Wrote past the end of buffer?");
@@ -108,9 +241,16 @@ void SocketStream::write(const void* out, std::size_t n)
 	}
 }
 
-void RemoteCL::SocketStream::flushWriteBuffer()
+void RemoteCL::SocketStream::flushWriteBuffer(bool more, bool endBatch)
 {
-	assert(mWriteOffset != 0);
-	mSocket.send(mWriteBuffer, mWriteOffset);
-	mWriteOffset = 0;
+	assert(mWriteOffset != mWriteStart || mFrameOpen);
+	if (mWriteStart != 0) {
+		// An empty frame still ends a batch left open by a direct send.
+		const uint32_t header = static_cast<uint32_t>(mWriteOffset - mWriteStart) | (endBatch ? FrameEndsBatch : 0);
+		std::memcpy(mWriteBuffer.data(), &header, sizeof(header));
+		mFrameOpen = !endBatch;
+	}
+	mSocket.send(mWriteBuffer.data(), mWriteOffset, more);
+	mWriteOffset = mWriteStart;
+	mBytesFlushed.store(mBytesWritten, std::memory_order_release);
 }
@@ -17,8 +17,13 @@
 #define REMOTECL_SOCKETSTREAM_H
 /// @file socketstream.h
 
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <type_traits>
+#include <vector>
 
+#include "sharedmemory.h"
 #include "socket.h"
 
 namespace RemoteCL
@@ -28,11 +33,16 @@ namespace RemoteCL
 class SocketStream final
 {
 public:
-	SocketStream(Socket socket) noexcept : mSocket(std::move(socket)) {}
+	/// @param bufferSize Initial size of the read and write buffers in bytes, clamped to
+	///        [MinBufferSize, MaxBufferSize]. Reads and writes at least this large bypass them.
+	explicit SocketStream(Socket socket, std::size_t bufferSize = DefaultBufferSize);
 	~SocketStream() noexcept = default;
 
-	/// Size of the read and write buffers in bytes.
-	static constexpr std::size_t BufferSize = 1024;
+	/// Default initial size of the read and write buffers in bytes.
+	static constexpr std::size_t DefaultBufferSize = 64 << 10;
+	static constexpr std::size_t MinBufferSize = 1 << 10;
+	/// The buffers grow up to this size when bursts of small packets overflow them.
+	static constexpr std::size_t MaxBufferSize = 1 << 20;
 
 	/// Sets this data for output.
 	void write(const void* s, std::size_t n);
@@ -40,7 +50,76 @@ public:
 	void read(void* s, std::size_t count);
 
 	/// Flushes the writes.
-	void flush() { if (mWriteOffset) { flushWriteBuffer(); } }
+	void flush() { if (mWriteOffset != mWriteStart || mFrameOpen) { flushWriteBuffer(); } }
+
+	/// Sends the data written from now on in frames, which tell the peer where the batches
+	/// of packets end, so that it can tell if it has received the whole of one (see
+	/// receiveBatch()). Each flush ends a batch. Call before anything is written; the peer
+	/// must call frameReads().
+	void frameWrites() noexcept
+	{
+		mWriteStart = FrameHeaderSize;
+		mWriteOffset = mWriteStart;
+	}
+	/// Reads the data sent by a peer which called frameWrites().
+	void frameReads() noexcept
+	{
+		mFramedReads = true;
+	}
+	/// Receives the data which has arrived, without waiting on more. Only for framed reads.
+	/// @returns true if the next batch is to be read: it has been received whole, or the
+	/// connection is closed, or it does not fit in the read buffer, in which case reading it
+	/// waits on the rest.
+	bool receiveBatch();
+	/// Checks if the whole of the next batch has been received. Only for framed reads.
+	bool batchBuffered() const noexcept;
+
+	/// Total number of bytes written into this stream.
+	uint64_t bytesWritten() const noexcept
+	{
+		return mBytesWritten;
+	}
+	/// Total number of bytes handed to the socket. Safe to call from any thread.
+	uint64_t bytesFlushed() const noexcept
+	{
+		return mBytesFlushed.load(std::memory_order_acquire);
+	}
+	/// Total number of bytes read out of this stream.
+	uint64_t bytesRead() const noexcept
+	{
+		return mBytesRead;
+	}
+
+	/// Moves large payloads through this memory shared with the peer from now on.
+	/// Both ends must attach it at the same point in the stream.
+	void attach(std::unique_ptr<SharedMemory> sharedMemory) noexcept
+	{
+		mSharedMemory = std::move(sharedMemory);
+	}
+	/// The shared memory carrying large payloads, or nullptr if they go through the socket.
+	SharedMemory* sharedMemory() const noexcept
+	{
+		return mSharedMemory.get();
+	}
+
+	/// Lets other threads write to this stream, between the packets of the owner.
+	/// Every write of a packet, and every flush, then holds writeLock(). The other threads
+	/// must flush their packets before they let go of the lock (see receive()).
+	void shareWrites()
+	{
+		mWriteMutex.reset(new std::mutex());
+	}
+	/// Locks out the other writers of a shared stream. Does nothing if the stream is not shared.
+	std::unique_lock<std::mutex> writeLock()
+	{
+		return mWriteMutex ? std::unique_lock<std::mutex>(*mWriteMutex) : std::unique_lock<std::mutex>();
+	}
+
+	/// The connection, to wait on incoming data without reading it.
+	const Socket& socket() const noexcept
+	{
+		return mSocket;
+	}
 
 	/// How many characters available for non-blocking read.
 	std::size_t available() const noexcept
@@ -52,6 +131,7 @@ public:
 	char peek() noexcept
 	{
 		try {
+			while (mFramedReads && mFrameLeft == 0) readFrameHeader();
 			if (available() == 0) readMoreData();
 			if (available() == 0) return -1;
 		} catch (...) {
@@ -82,26 +162,68 @@ public:
 	}
 
 private:
-	/// Fills as much of mBuffer as possible from the incoming socket.
+	/// Size of the header of a frame: its length, and FrameEndsBatch.
+	static constexpr std::size_t FrameHeaderSize = sizeof(uint32_t);
+	/// Set in the header of the last frame of a batch.
+	static constexpr uint32_t FrameEndsBatch = 1u << 31;
+	/// Frames are at most this long.
+	static constexpr std::size_t MaxFrameSize = FrameEndsBatch - 1;
+
+	/// Reads the header of the next frame.
+	void readFrameHeader();
+	/// Fills as much of mReadBuffer as possible from the incoming socket.
+	/// If the previous fill took up all of it, the peer likely had more queued, so the
+	/// buffer grows first.
 	void readMoreData();
+	/// Receives directly from the socket. Any pending writes are flushed first, as the
+	/// peer may be waiting on them before it sends anything. Does not wait on another
+	/// writer of a shared stream, which flushes them itself.
+	std::size_t receive(void* data, std::size_t available);
 
 	/// Sends all pending data and resets the writeOffset;
-	void flushWriteBuffer();
+	/// @param more The rest of a write follows, so the socket may hold this data back.
+	/// @param endBatch The data ends a batch of packets, if the writes are framed.
+	void flushWriteBuffer(bool more = false, bool endBatch = true);
+
+	/// Reads and writes at least this large bypass the buffers.
+	std::size_t mDirectSize;
 
 	/// Buffer for outgoing data. Unlike the ReadBuffer, the write buffer is not circular.
-	char mWriteBuffer[BufferSize];
+	std::vector<char> mWriteBuffer;
 	/// Number of bytes left to be flushed out.
-	uint16_t mWriteOffset = 0;
+	std::size_t mWriteOffset = 0;
+	/// Where the data starts in mWriteBuffer: after room for the frame header, if framed.
+	std::size_t mWriteStart = 0;
+	/// The last frame sent did not end a batch.
+	bool mFrameOpen = false;
+	/// Total number of bytes written, flushed or not.
+	uint64_t mBytesWritten = 0;
+	/// Total number of bytes sent out of mWriteBuffer, or directly.
+	std::atomic<uint64_t> mBytesFlushed{0};
 
 	/// Buffer for data waiting to be read.
-	char mReadBuffer[BufferSize];
+	std::vector<char> mReadBuffer;
 	/// Current offset into buffer where the read head is.
-	uint16_t mReadOffset = 0;
+	std::size_t mReadOffset = 0;
 	/// How many bytes are available for reading.
-	uint16_t mAvailable = 0;
+	std::size_t mAvailable = 0;
+	/// The last fill of mReadBuffer took up all of it.
+	bool mReadBufferFilled = false;
+	/// Total number of bytes read.
+	uint64_t mBytesRead = 0;
+	/// The data is read in frames.
+	bool mFramedReads = false;
+	/// Bytes of the current frame which are left to be read.
+	std::size_t mFrameLeft = 0;
+	/// The current frame ends a batch.
+	bool mFrameEndsBatch = false;
 
 	/// The owned network socket.
 	Socket mSocket;
+	/// Memory shared with a peer on the same machine, if any.
+	std::unique_ptr<SharedMemory> mSharedMemory;
+	/// Serialises the writers of a shared stream, or nullptr.
+	std::unique_ptr<std::mutex> mWriteMutex;
 };
 }
 
@@ -0,0 +1,234 @@
+// This file is part of RemoteCL.
+
+// RemoteCL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// RemoteCL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public License
+// along with RemoteCL.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "instance.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "hints.h"
+#include "packets/channel.h"
+#include "packets/simple.h"
+
+using namespace RemoteCL;
+using namespace RemoteCL::Server;
+
+namespace
+{
+/// How long to wait on the client to connect a channel it asked for, in milliseconds.
+constexpr int ChannelTimeout = 5000;
+/// How often the connections of the channels are checked for those which took too long.
+constexpr int AcceptInterval = 100;
+}
+
+void ServerInstance::publishProgress(uint64_t bytes)
+{
+	ConnectionState& state = *mState;
+	{
+		std::unique_lock<std::mutex> lock(state.mProgressMutex);
+		if (mChannel >= state.mProgress.size()) return;
+		state.mProgress[mChannel] = bytes;
+	}
+	state.mProgressCondition.notify_all();
+}
+
+void ServerInstance::syncChannel()
+{
+	ChannelSync packet = mStream.read<ChannelSync>();
+	// The replies to the commands handled so far go out first; the client may be waiting on them.
+	mStream.flush();
+	ConnectionState& state = *mState;
+	std::unique_lock<std::mutex> lock(state.mProgressMutex);
+	if (Unlikely(packet.mChannel >= state.mProgress.size() || packet.mChannel == mChannel)) {
+		deferError(CL_INVALID_VALUE);
+		return;
+	}
+	state.mProgressCondition.wait(lock, [&]{ return state.mProgress[packet.mChannel] >= packet.mBytes; });
+}
+
+uint32_t ServerInstance::acceptHello(uint64_t token)
+{
+	if (mStream.nextPacketTy() != PacketType::ChannelHello) return NoChannel;
+	const ChannelHello hello = mStream.read<ChannelHello>();
+	if (hello.mToken != token) return NoChannel;
+	return hello.mChannel;
+}
+
+void ServerInstance::openChannel()
+{
+	mStream.read<OpenChannel>();
+#if defined(REMOTECL_ENABLE_ASYNC)
+	if (mChannel != 0) {
+		// Channels are opened through the connection itself.
+		mStream.write<ErrorPacket>(CL_INVALID_OPERATION);
+		return;
+	}
+
+	ChannelAddressPacket reply;
+	try {
+		if (!mChannelListener) {
+			std::random_device random;
+			mChannelToken = (uint64_t(random()) << 32) | random();
+			if (mConfig.mLocalPath.empty()) {
+				// Any free port will do.
+				mChannelListener.reset(new Socket(uint16_t(0)));
+			} else {
+				// Next to the socket of the server, under a name of its own.
+				std::string path = mConfig.mLocalPath + '.' + std::to_string(random());
+				mChannelListener.reset(new Socket(Socket::listenLocal(path.c_str())));
+				mChannelPath = std::move(path);
+			}
+		}
+		reply.mPath = mChannelPath;
+		if (mChannelPath.empty()) reply.mPort = mChannelListener->localPort();
+	} catch (const Socket::Error&) {
+		std::clog << "Could not open a channel listener\n";
+		mStream.write<ErrorPacket>(CL_OUT_OF_RESOURCES);
+		return;
+	} catch (const std::exception& e) {
+		std::clog << "Could not open a channel listener: " << e.what() << '\n';
+		mStream.write<ErrorPacket>(CL_OUT_OF_RESOURCES);
+		return;
+	}
+	reply.mToken = mChannelToken;
+	{
+		std::unique_lock<std::mutex> lock(mState->mProgressMutex);
+		reply.mChannel = static_cast<uint32_t>(mState->mProgress.size());
+		// Reserved until the channel is connected; nothing can have handled it so far.
+		mState->mProgress.push_back(0);
+	}
+	// The client may take its time to connect; this channel goes on meanwhile.
+	try {
+		std::unique_lock<std::mutex> lock(mAcceptMutex);
+		mPendingChannels.emplace(reply.mChannel, std::chrono::steady_clock::now() +
+		                                         std::chrono::milliseconds(ChannelTimeout));
+		if (!mAccepting) {
+			// The previous acceptor has given up the lock for good, if there was one.
+			if (mAcceptThread.joinable()) mAcceptThread.join();
+			mAcceptThread = std::thread(&ServerInstance::acceptChannels, this);
+			mAccepting = true;
+		}
+	} catch (const std::system_error& e) {
+		std::clog << "Could not start a channel: " << e.what() << '\n';
+		{
+			std::unique_lock<std::mutex> lock(mAcceptMutex);
+			mPendingChannels.erase(reply.mChannel);
+		}
+		{
+			std::unique_lock<std::mutex> lock(mState->mProgressMutex);
+			mState->mProgress.pop_back();
+		}
+		mStream.write<ErrorPacket>(CL_OUT_OF_RESOURCES);
+		return;
+	}
+	mStream.write(reply).flush();
+#else
+	mStream.write<ErrorPacket>(CL_INVALID_OPERATION);
+#endif
+}
+
+#if defined(REMOTECL_ENABLE_ASYNC)
+void ServerInstance::acceptChannels()
+{
+	using Clock = std::chrono::steady_clock;
+	using Connection = std::pair<std::unique_ptr<ServerInstance>, Clock::time_point>;
+	// The connections which have not said which channel they are yet, with the time they
+	// are dropped at. Anyone can connect to the listener; none of them holds up the others.
+	std::vector<Connection> connecting;
+	std::vector<const Socket*> sockets;
+	while (true) {
+		const Clock::time_point now = Clock::now();
+		{
+			std::unique_lock<std::mutex> lock(mAcceptMutex);
+			for (auto it = mPendingChannels.begin(); it != mPendingChannels.end();) {
+				if (!mClosing && it->second > now) {
+					++it;
+					continue;
+				}
+				if (!mClosing) std::clog << "Client did not connect its channel\n";
+				// The other channels must not wait on one which never comes.
+				{
+					std::unique_lock<std::mutex> progressLock(mState->mProgressMutex);
+					mState->mProgress[it->first] = UINT64_MAX;
+				}
+				mState->mProgressCondition.notify_all();
+				it = mPendingChannels.erase(it);
+			}
+			if (mPendingChannels.empty()) {
+				mAccepting = false;
+				return;
+			}
+		}
+		connecting.erase(std::remove_if(connecting.begin(), connecting.end(),
+		                                [now](const Connection& c) { return c.second <= now; }),
+		                 connecting.end());
+
+		sockets.assign(1, mChannelListener.get());
+		for (const Connection& c : connecting) {
+			sockets.push_back(&c.first->mStream.socket());
+		}
+		try {
+			if (!Socket::poll(sockets.data(), sockets.size(), AcceptInterval)) continue;
+			if (mChannelListener->poll(0)) {
+				connecting.emplace_back(std::unique_ptr<ServerInstance>(
+					new ServerInstance(mChannelListener->accept(), mConfig, mState, NoChannel)),
+					now + std::chrono::milliseconds(ChannelTimeout));
+			}
+		} catch (const Socket::Error&) {
+			std::clog << "Could not accept a channel connection\n";
+			continue;
+		}
+
+		for (auto it = connecting.begin(); it != connecting.end();) {
+			std::unique_ptr<ServerInstance>& channel = it->first;
+			uint32_t index = NoChannel;
+			try {
+				// Only read the hello once all of it is there, so that a stranger cannot stall this.
+				if (!channel->mStream.receiveBatch()) {
+					++it;
+					continue;
+				}
+				index = channel->acceptHello(mChannelToken);
+			} catch (const Socket::Error&) {
+				// Gone before it said anything.
+			}
+			std::unique_lock<std::mutex> lock(mAcceptMutex);
+			if (index != NoChannel && !mClosing && mPendingChannels.erase(index) != 0) {
+				channel->mChannel = index;
+				channel->publishProgress(channel->mStream.bytesRead());
+				try {
+					mChannelThreads.emplace_back([](std::unique_ptr<ServerInstance> instance) {
+						try {
+							instance->run();
+						} catch (const Socket::Error&) {
+							// The client is gone.
+						}
+					}, std::move(channel));
+				} catch (const std::system_error& e) {
+					// Its instance ends here, which tells the other channels not to wait on it.
+					std::clog << "Could not start a channel: " << e.what() << '\n';
+				}
+			}
+			it = connecting.erase(it);
+		}
+	}
+}
+#endif
@@ -16,6 +16,8 @@
 
 #include "instance.h"
 
+#include <cstring> // std::memcpy
+
 using namespace RemoteCL;
 using namespace RemoteCL::Server;
 
@@ -24,8 +26,71 @@ using namespace RemoteCL::Server;
 #include "hints.h"
 #include "packets/device.h"
 #include "packets/IDs.h"
+#include "packets/inventory.h"
 #include "packets/payload.h"
 
+void ServerInstance::warmUp() noexcept
+{
+	// The ICD loader keeps the platforms it loaded, so errors here just leave the work to the client.
+	cl_uint platformCount = 0;
+	if (clGetPlatformIDs(0, nullptr, &platformCount) != CL_SUCCESS || platformCount == 0) return;
+	std::vector<cl_platform_id> platforms(platformCount);
+	if (clGetPlatformIDs(platformCount, platforms.data(), nullptr) != CL_SUCCESS) return;
+	for (cl_platform_id platform : platforms) {
+		cl_uint deviceCount = 0;
+		if (clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, 0, nullptr, &deviceCount) != CL_SUCCESS) continue;
+		std::vector<cl_device_id> devices(deviceCount);
+		clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, deviceCount, devices.data(), nullptr);
+	}
+}
+
+void ServerInstance::sendInventory()
+{
+	InventoryPacket inventory;
+	// Any query which fails is left out, and the client sends it to us instead.
+	cl_uint platformCount = 0;
+	if (clGetPlatformIDs(0, nullptr, &platformCount) != CL_SUCCESS) platformCount = 0;
+	std::vector<cl_platform_id> platforms(platformCount);
+	if (platformCount != 0 && clGetPlatformIDs(platformCount, platforms.data(), nullptr) != CL_SUCCESS) {
+		platforms.clear();
+	}
+
+	std::vector<uint8_t> value;
+	for (cl_platform_id platform : platforms) {
+		inventory.mPlatforms.emplace_back();
+		InventoryPacket::Platform& entry = inventory.mPlatforms.back();
+		entry.mID = getIDFor(platform);
+		for (cl_platform_info param : InventoryPlatformInfo) {
+			if (platformInfo(platform, param, value) == CL_SUCCESS) {
+				entry.mInfo.push_back({param, std::move(value)});
+			}
+			value.clear();
+		}
+
+		cl_uint deviceCount = 0;
+		cl_int err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, 0, nullptr, &deviceCount);
+		if (err == CL_DEVICE_NOT_FOUND) {
+			entry.mDevicesListed = true;
+			continue;
+		}
+		std::vector<cl_device_id> devices(deviceCount);
+		if (err != CL_SUCCESS ||
+		    clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, deviceCount, devices.data(), nullptr) != CL_SUCCESS) {
+			continue;
+		}
+		entry.mDevicesListed = true;
+		for (cl_device_id device : devices) {
+			entry.mDevices.push_back({getIDFor(device), {}});
+			for (cl_device_info param : InventoryDeviceInfo) {
+				if (deviceInfo(device, param, value) == CL_SUCCESS) {
+					entry.mDevices.back().mInfo.push_back({param, std::move(value)});
+				}
+				value.clear();
+			}
+		}
+	}
+	mStream.write(inventory);
+}
 
 void ServerInstance::sendDeviceList()
 {
@@ -58,34 +123,27 @@ void ServerInstance::sendDeviceList()
 	mStream.write(list);
 }
 
-void ServerInstance::getDeviceInfo()
+cl_int ServerInstance::deviceInfo(cl_device_id device, uint32_t param, std::vector<uint8_t>& value)
 {
-	GetDeviceInfo query = mStream.read<GetDeviceInfo>();
-	cl_device_id device = getObj<cl_device_id>(query.mID);
-
-	switch (query.mData) {
+	switch (param) {
 		// These queries must be ID-translated.
 		case CL_DEVICE_PLATFORM: {
 			cl_platform_id platform = nullptr;
-			std::size_t retSize = 0;
-			cl_int err = clGetDeviceInfo(device, CL_DEVICE_PLATFORM, sizeof(platform), &platform, &retSize);
-			if (Unlikely(err != CL_SUCCESS)) {
-				mStream.write<ErrorPacket>(err);
-				return;
-			}
-			mStream.write<IDPacket>(getIDFor(platform));
-			break;
+			cl_int err = clGetDeviceInfo(device, CL_DEVICE_PLATFORM, sizeof(platform), &platform, nullptr);
+			if (Unlikely(err != CL_SUCCESS)) return err;
+			const IDType id = getIDFor(platform);
+			value.resize(sizeof(id));
+			std::memcpy(value.data(), &id, sizeof(id));
+			return CL_SUCCESS;
 		}
 		case CL_DEVICE_PARENT_DEVICE: {
 			cl_device_id parent = nullptr;
-			std::size_t retSize = 0;
-			cl_int err = clGetDeviceInfo(device, CL_DEVICE_PARENT_DEVICE, sizeof(parent), &parent, &retSize);
-			if (Unlikely(err != CL_SUCCESS)) {
-				mStream.write<ErrorPacket>(err);
-				return;
-			}
-			mStream.write<IDPacket>(getIDFor(parent));
-			break;
+			cl_int err = clGetDeviceInfo(device, CL_DEVICE_PARENT_DEVICE, sizeof(parent), &parent, nullptr);
+			if (Unlikely(err != CL_SUCCESS)) return err;
+			const IDType id = getIDFor(parent);
+			value.resize(sizeof(id));
+			std::memcpy(value.data(), &id, sizeof(id));
+			return CL_SUCCESS;
 		}
 
 		// These queries must be std::size_t translated.
@@ -106,45 +164,50 @@ void ServerInstance::getDeviceInfo()
 #endif
 		case CL_DEVICE_MAX_PARAMETER_SIZE:
 		case CL_DEVICE_MAX_WORK_GROUP_SIZE: {
-			std::size_t value = 0;
-			std::size_t retSize = 0;
-			cl_int err = clGetDeviceInfo(device, query.mData, sizeof(value), &value, &retSize);
-			if (Unlikely(err != CL_SUCCESS)) {
-				mStream.write<ErrorPacket>(err);
-				return;
-			}
-			mStream.write(SimplePacket<PacketType::Payload, uint64_t>(value));
-			break;
+			std::size_t size = 0;
+			cl_int err = clGetDeviceInfo(device, param, sizeof(size), &size, nullptr);
+			if (Unlikely(err != CL_SUCCESS)) return err;
+			const uint64_t translated = size;
+			value.resize(sizeof(translated));
+			std::memcpy(value.data(), &translated, sizeof(translated));
+			return CL_SUCCESS;
 		}
 		case CL_DEVICE_MAX_WORK_ITEM_SIZES: {
-			std::size_t sizes[3];
 			std::size_t retSize = 0;
-			cl_int err = clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(sizes), sizes, &retSize);
-			if (Unlikely(err != CL_SUCCESS)) {
-				mStream.write<ErrorPacket>(err);
-				return;
+			cl_int err = clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES, 0, nullptr, &retSize);
+			if (Unlikely(err != CL_SUCCESS)) return err;
+			std::vector<std::size_t> sizes(retSize / sizeof(std::size_t));
+			err = clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES, retSize, sizes.data(), nullptr);
+			if (Unlikely(err != CL_SUCCESS)) return err;
+			value.resize(sizes.size() * sizeof(uint64_t));
+			for (std::size_t i = 0; i < sizes.size(); ++i) {
+				const uint64_t translated = sizes[i];
+				std::memcpy(value.data() + i * sizeof(uint64_t), &translated, sizeof(translated));
 			}
-			uint64_t translated[3];
-			translated[0] = sizes[0];
-			translated[1] = sizes[1];
-			translated[2] = sizes[2];
-			mStream.write(PayloadPtr<uint8_t>(translated, 3));
-			break;
+			return CL_SUCCESS;
 		}
 
 		// Return the raw data.
 		default: {
 			std::size_t retSize = 0;
-			clGetDeviceInfo(device, query.mData, 0, nullptr, &retSize);
-			std::vector<uint8_t> data;
-			data.resize(retSize);
-			cl_int err = clGetDeviceInfo(device, query.mData, data.size(), data.data(), &retSize);
-			if (Unlikely(err != CL_SUCCESS)) {
-				mStream.write<ErrorPacket>(err);
-				return;
-			}
-			mStream.write(PayloadPtr<>(data.data(), retSize));
-			break;
+			cl_int err = clGetDeviceInfo(device, param, 0, nullptr, &retSize);
+			if (Unlikely(err != CL_SUCCESS)) return err;
+			value.resize(retSize);
+			return clGetDeviceInfo(device, param, value.size(), value.data(), nullptr);
 		}
 	}
 }
+
+void ServerInstance::getDeviceInfo()
+{
+	GetDeviceInfo query = mStream.read<GetDeviceInfo>();
+	cl_device_id device = getObj<cl_device_id>(query.mID);
+
+	std::vector<uint8_t> value;
+	cl_int err = deviceInfo(device, query.mData, value);
+	if (Unlikely(err != CL_SUCCESS)) {
+		mStream.write<ErrorPacket>(err);
+		return;
+	}
+	mStream.write(PayloadPtr<>(value.data(), value.size()));
+}
@@ -31,30 +31,21 @@ namespace
 {
 struct CallbackBlock
 {
-	ServerInstance *instance;
+	/// Holds on to the outbox, as the instance may have ended by the time the callback runs.
+	std::shared_ptr<ServerInstance::Outbox> outbox;
 	/// Client-side ID for the callback.
 	IDType ID;
 };
 
 void CL_CALLBACK EventCallback(cl_event, cl_int code, void* data)
 {
-	CallbackBlock *block = reinterpret_cast<CallbackBlock*>(data);
-	block->instance->triggerEventCallback(code, block->ID);
-	// Block should probably be deleted here - we're currently leaking it.
-	// Is it possible for the same event to be executed more than once?
+	std::unique_ptr<CallbackBlock> block(reinterpret_cast<CallbackBlock*>(data));
+	// Only queued: the callback must not wait on the client.
+	// Each registration is called once, so the block goes with it.
+	block->outbox->sendTrigger(block->ID, code);
 }
 }
 
-void ServerInstance::triggerEventCallback(cl_int code, IDType callbackID) noexcept
-{
-	std::unique_lock<std::mutex> lock(mEventMutex);
-	if (!mEventStream) return;
-	// Tell the client there's an incoming event.
-	mEventStream->write<CallbackTriggerPacket>(callbackID);
-	// The client will dipatch to a handler which will receive this packet:
-	mEventStream->write<TriggerEventCallback>(code).flush();
-}
-
 void ServerInstance::registerEventCallback()
 {
 	try {
@@ -62,14 +53,20 @@ void ServerInstance::registerEventCallback()
 
 		cl_event event = getObj<cl_event>(P.mEventID);
 		// Create an event block
-		CallbackBlock *block = new CallbackBlock;
+		std::unique_ptr<CallbackBlock> block(new CallbackBlock);
 		block->ID = P.mCallbackID;
-		block->instance = this;
+		block->outbox = mOutbox;
 
-		cl_int err = clSetEventCallback(event, P.mCBType, EventCallback, reinterpret_cast<void*>(block));
+		cl_int err = clSetEventCallback(event, P.mCBType, EventCallback, reinterpret_cast<void*>(block.get()));
 		if (Unlikely(err != CL_SUCCESS)) {
 			mStream.write<ErrorPacket>(err);
+			return;
 		}
+		// Owned by the callback from now on.
+		block.release();
+		// Matches the reference the client keeps on its handle. It releases both
+		// once the callback has run.
+		clRetainEvent(event);
 		mStream.write<SuccessPacket>({});
 	} catch (...) {
 		mStream.write<ErrorPacket>(CL_OUT_OF_HOST_MEMORY);
@@ -89,6 +86,13 @@ void ServerInstance::enqueueKernel()
 		}
 	}
 
+	// The launch would fail anyway if an argument could not be set; report that instead.
+	cl_int argErr = applyKernelArgs(E.mKernelID, E.mArgs);
+	if (Unlikely(argErr != CL_SUCCESS)) {
+		deferError(argErr);
+		return;
+	}
+
 	cl_kernel kernel = getObj<cl_kernel>(E.mKernelID);
 	cl_command_queue queue = getObj<cl_command_queue>(E.mQueueID);
 	cl_event command;
@@ -104,29 +108,29 @@ void ServerInstance::enqueueKernel()
 	cl_int retCode = clEnqueueNDRangeKernel(queue, kernel, E.mWorkDim,
 	                                        globalOffset, globalSize, localSize,
 	                                        events.size(), events.data(), retEvent);
+	// The client does not wait on a reply; errors are reported on the next synchronisation point.
 	if (Unlikely(retCode != CL_SUCCESS)) {
-		mStream.write<ErrorPacket>(retCode);
+		deferError(retCode);
 		return;
 	}
 
 	if (retEvent) {
-		mStream.write<IDPacket>(getIDFor(*retEvent));
+		bindID(E.mEventID, *retEvent);
 	}
-	mStream.write<SuccessPacket>({});
 }
 
 void ServerInstance::createUserEvent()
 {
 	CreateUserEvent P = mStream.read<CreateUserEvent>();
-	cl_context context = getObj<cl_context>(P);
+	cl_context context = getObj<cl_context>(P.mID);
 
 	cl_int err = CL_SUCCESS;
 	cl_event event = clCreateUserEvent(context, &err);
 	if (Unlikely(err != CL_SUCCESS)) {
-		mStream.write<ErrorPacket>(err);
+		deferError(err);
 		return;
 	}
-	mStream.write<IDPacket>(getIDFor(event));
+	bindID(P.mData, event);
 }
 
 void ServerInstance::setUserEventStatus()
@@ -216,7 +220,7 @@ void ServerInstance::waitForEvents()
 	cl_int retCode = clWaitForEvents(events.size(), events.data());
 	if (Unlikely(retCode != CL_SUCCESS)) {
 		mStream.write<ErrorPacket>(retCode);
-	} else {
+	} else if (!reportDeferredError()) {
 		mStream.write<SuccessPacket>({});
 	}
 }
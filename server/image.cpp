@@ -123,6 +123,9 @@ void ServerInstance::readImage()
 	data.mData.resize(pixelSize * region[0] * region[1] * region[2]);
 	void* ptr = data.mData.data();
 
+	// Reads always reply synchronously, so report any pending error now.
+	if (reportDeferredError()) return;
+
 	err = clEnqueueReadImage(queue, image, packet.mBlock, origin, region,
 	                         packet.mRowPitch, packet.mSlicePitch, ptr,
 	                         events.size(), events.data(), event);
@@ -132,7 +135,7 @@ void ServerInstance::readImage()
 		return;
 	}
 	if (packet.mWantEvent) {
-		mStream.write<IDPacket>(getIDFor(retEvent));
+		bindID(packet.mEventID, retEvent);
 	}
 
 	mStream.write(data);
@@ -172,23 +175,57 @@ void ServerInstance::writeImage()
 	const uint32_t dataSize = pixelSize * region[0] * region[1] * region[2];
 	// Report and receive the image data.
 	mStream.write<SimplePacket<PacketType::Payload, uint32_t>>({dataSize}).flush();
-	Payload<> imageData = mStream.read<Payload<>>();
+	const std::size_t rowSize = pixelSize * region[0];
+	const std::vector<ImageChunk> chunks = SplitImageWrite(packet.mRegion, rowSize);
+	PayloadView<> imageData;
+	if (chunks.size() > 1) {
+		const bool packed = (packet.mRowPitch == 0 || packet.mRowPitch == rowSize) &&
+		                    (packet.mSlicePitch == 0 || packet.mSlicePitch == rowSize * region[1]);
+		// The event would be the one of the last chunk.
+		if (!packet.mWantEvent && packed) {
+			err = writeChunks(queue, dataSize, std::max(WriteChunkSize, rowSize),
+				[&](std::size_t index, std::size_t, std::size_t size, const void* data, cl_event* event) {
+					if (Unlikely(index >= chunks.size())) throw Socket::Error();
+					const ImageChunk& chunk = chunks[index];
+					if (Unlikely(size != chunk.mSlices * chunk.mRows * rowSize)) throw Socket::Error();
+					const std::size_t chunkOrigin[3] = {origin[0], origin[1] + chunk.mRow, origin[2] + chunk.mSlice};
+					const std::size_t chunkRegion[3] = {region[0], chunk.mRows, chunk.mSlices};
+					return clEnqueueWriteImage(queue, image, false, chunkOrigin, chunkRegion, 0, 0, data,
+					                           events.size(), events.data(), event);
+				}, packet.mBlock);
+			if (Unlikely(err != CL_SUCCESS)) mStream.write<ErrorPacket>(err);
+			else mStream.write<SuccessPacket>({});
+			return;
+		}
+		// The chunks are put back together for a single write.
+		imageData.mData.reset(new uint8_t[dataSize]);
+		receiveChunks(imageData.mData.get(), dataSize);
+		imageData.mPtr = imageData.mData.get();
+		imageData.mSize = dataSize;
+	} else {
+		// Data moved through shared memory is handed to the driver in place, unless the write does
+		// not block, in which case the data is kept until its event completes.
+		mStream.read(imageData);
+		if (!packet.mBlock) imageData.own();
+	}
 
-	cl_event* event = packet.mWantEvent ? &retEvent : nullptr;
+	cl_event* event = packet.mWantEvent || !packet.mBlock ? &retEvent : nullptr;
 	// Perform the write
 	err = clEnqueueWriteImage(queue, image, packet.mBlock, origin, region,
-	                          packet.mRowPitch, packet.mSlicePitch, imageData.mData.data(),
+	                          packet.mRowPitch, packet.mSlicePitch, imageData.mPtr,
 	                          events.size(), events.data(), event);
 
 	if (Unlikely(err != CL_SUCCESS)) {
 		mStream.write<ErrorPacket>(err);
 		return;
 	}
+	if (!packet.mBlock) KeepUntilComplete(retEvent, std::move(imageData.mData));
 	if (packet.mWantEvent) {
-		mStream.write<IDPacket>(getIDFor(retEvent));
-	} else {
-		mStream.write<SuccessPacket>({});
+		bindID(packet.mEventID, retEvent);
+	} else if (!packet.mBlock) {
+		clReleaseEvent(retEvent);
 	}
+	mStream.write<SuccessPacket>({});
 }
 
 void ServerInstance::getImageInfo()
@@ -15,7 +15,10 @@
 
 #include "instance.h"
 
+#include <cstdint>
+#include <cstdio> // std::remove
 #include <iostream>
+#include <system_error>
 
 #include "CL/cl.h"
 
@@ -28,17 +31,195 @@
 #include "packets/IDs.h"
 #include "packets/payload.h"
 #include "packets/event.h"
+#include "packets/sharedmemory.h"
 #include "packets/terminate.h"
 
 using namespace RemoteCL;
 using namespace RemoteCL::Server;
 
-ServerInstance::ServerInstance(Socket socket) : mStream(std::move(socket))
+namespace
+{
+/// Checks if the client waits on a reply to commands of this type. Reads and writes are only
+/// acknowledged if they block, which their handlers check once they have read the command.
+bool IsAcknowledged(PacketType ty) noexcept
+{
+	switch (ty) {
+		case PacketType::CreateBuffer:
+		case PacketType::CreateSubBuffer:
+		case PacketType::FillBuffer:
+		case PacketType::SetKernelArg:
+		case PacketType::EnqueueKernel:
+		case PacketType::CreateUserEvent:
+		case PacketType::RefCounts:
+		case PacketType::ChannelSync:
+			return false;
+		default:
+			return true;
+	}
+}
+}
+
+ServerInstance::ServerInstance(Socket socket, const ServerConfig& config) :
+	ServerInstance(std::move(socket), config, std::make_shared<ConnectionState>(), 0)
 {
 	mStream.write<VersionPacket>({});
+	// Sent along with the version, as most clients start by querying all of it.
+	sendInventory();
 	mStream.flush();
 }
 
+ServerInstance::ServerInstance(Socket socket, const ServerConfig& config,
+                               std::shared_ptr<ConnectionState> state, uint32_t channel) :
+	mStream(std::move(socket), config.mBufferSize), mOutbox(std::make_shared<Outbox>(mStream)),
+	mConfig(config), mState(std::move(state)), mChannel(channel)
+{
+	// Callbacks trigger on other threads, and are sent between the replies.
+	mStream.shareWrites();
+	// The client tells where its batches of commands end.
+	mStream.frameReads();
+}
+
+ServerInstance::~ServerInstance()
+{
+	mOutbox->close();
+	// The other channels may be waiting on this one.
+	publishProgress(UINT64_MAX);
+	{
+		std::unique_lock<std::mutex> lock(mAcceptMutex);
+		mClosing = true;
+	}
+	if (mAcceptThread.joinable()) mAcceptThread.join();
+	for (std::thread& thread : mChannelThreads) {
+		thread.join();
+	}
+	if (!mChannelPath.empty()) std::remove(mChannelPath.c_str());
+}
+
+void ServerInstance::Outbox::expectRead()
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	mPendingReads++;
+}
+
+bool ServerInstance::Outbox::readsPending()
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	return mPendingReads != 0;
+}
+
+void ServerInstance::Outbox::sendReadData(uint32_t readID, cl_int status, std::vector<uint8_t> data) noexcept
+{
+	post(Message{true, readID, status, std::move(data)});
+}
+
+void ServerInstance::Outbox::sendTrigger(uint32_t callbackID, cl_int status) noexcept
+{
+	post(Message{false, callbackID, status, {}});
+}
+
+void ServerInstance::Outbox::post(Message message) noexcept
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	if (mStream == nullptr) {
+		// The client is gone.
+		if (message.mIsRead) mPendingReads--;
+		return;
+	}
+	try {
+		if (!mThread.joinable()) mThread = std::thread(&Outbox::run, this);
+		mQueue.push_back(std::move(message));
+		mCondition.notify_one();
+		return;
+	} catch (...) {
+		// Without a thread to send it, send it from here, holding off close() meanwhile.
+	}
+	send(*mStream, message);
+	if (message.mIsRead) mPendingReads--;
+}
+
+void ServerInstance::Outbox::run() noexcept
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	while (true) {
+		mCondition.wait(lock, [this] { return mStream == nullptr || !mQueue.empty(); });
+		if (mStream == nullptr) return;
+		Message message = std::move(mQueue.front());
+		mQueue.pop_front();
+		// The stream stays until close() has joined this thread.
+		PacketStream& stream = *mStream;
+		lock.unlock();
+		send(stream, message);
+		lock.lock();
+		if (message.mIsRead) mPendingReads--;
+	}
+}
+
+void ServerInstance::Outbox::send(PacketStream& stream, const Message& message) noexcept
+{
+	try {
+		// Sent in between the replies of the instance, and flushed before the stream is let go
+		// of, so that the instance does not wait on it to flush its own (see SocketStream::receive).
+		if (!message.mIsRead) {
+			stream.write(CallbackTriggerPacket(message.mID, message.mStatus)).flush();
+		} else if (message.mStatus == CL_COMPLETE) {
+			stream.write(ReadDataPacket(message.mID, message.mStatus, message.mData.data(),
+			                            static_cast<uint32_t>(message.mData.size()))).flush();
+		} else {
+			stream.write(ReadDataPacket(message.mID, message.mStatus)).flush();
+		}
+	} catch (const Socket::Error&) {
+		// The client is gone.
+	}
+}
+
+void ServerInstance::Outbox::close() noexcept
+{
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		mStream = nullptr;
+		for (const Message& message : mQueue) {
+			if (message.mIsRead) mPendingReads--;
+		}
+		mQueue.clear();
+		mCondition.notify_one();
+	}
+	if (mThread.joinable()) mThread.join();
+}
+
+void* ServerInstance::payloadSpace(std::size_t size)
+{
+	// The data of non-blocking reads goes through the same memory, from other threads.
+	if (mOutbox->readsPending()) return nullptr;
+	return SharedPayloadSpace(mStream.sharedMemory(), size);
+}
+
+void ServerInstance::deferError(cl_int err) noexcept
+{
+	if (mDeferredError == CL_SUCCESS) mDeferredError = err;
+}
+
+void ServerInstance::dropID(IDType id)
+{
+	ConnectionState& state = *mState;
+	std::unique_lock<std::mutex> lock(state.mObjectsMutex);
+	std::vector<void*>& objects = (id & ClientIDFlag) != 0 ? state.mClientObjects : state.mObjects;
+	const std::size_t index = id & ~ClientIDFlag;
+	if (Unlikely(id == NullID || index >= objects.size())) return;
+
+	auto it = state.mIDs.find(objects[index]);
+	if (it != state.mIDs.end() && it->second == id) state.mIDs.erase(it);
+	objects[index] = nullptr;
+	if ((id & ClientIDFlag) == 0) state.mFreeIDs.push_back(id);
+}
+
+bool ServerInstance::reportDeferredError()
+{
+	if (Likely(mDeferredError == CL_SUCCESS)) return false;
+	mStream.write<ErrorPacket>(mDeferredError);
+	mDeferredError = CL_SUCCESS;
+	return true;
+}
+
 void ServerInstance::sendPlatformList()
 {
 	mStream.read<GetPlatformIDs>();
@@ -61,21 +242,22 @@ void ServerInstance::sendPlatformList()
 	mStream.write(list);
 }
 
+cl_int ServerInstance::platformInfo(cl_platform_id platform, uint32_t param, std::vector<uint8_t>& value)
+{
+	size_t replySize = 0;
+	cl_int errCode = clGetPlatformInfo(platform, param, 0, nullptr, &replySize);
+	if (Unlikely(errCode != CL_SUCCESS)) return errCode;
+	value.resize(replySize);
+	return clGetPlatformInfo(platform, param, value.size(), value.data(), nullptr);
+}
+
 void ServerInstance::getPlatformInfo()
 {
 	GetPlatformInfo packet = mStream.read<GetPlatformInfo>();
 	cl_platform_id platform = getObj<cl_platform_id>(packet.mID);
 
-	size_t replySize = 0;
-	cl_int errCode = clGetPlatformInfo(platform, packet.mData, 0, nullptr, &replySize);
-	if (Unlikely(errCode != CL_SUCCESS)) {
-		mStream.write<ErrorPacket>(errCode);
-		return;
-	}
-
-	Payload<uint8_t> reply;
-	reply.mData.resize(replySize);
-	errCode = clGetPlatformInfo(platform, packet.mData, replySize, reply.mData.data(), &replySize);
+	Payload<> reply;
+	cl_int errCode = platformInfo(platform, packet.mData, reply.mData);
 	if (Unlikely(errCode != CL_SUCCESS)) {
 		mStream.write<ErrorPacket>(errCode);
 		return;
@@ -83,56 +265,30 @@ void ServerInstance::getPlatformInfo()
 	mStream.write(reply);
 }
 
-void ServerInstance::createEventStream()
+void ServerInstance::openSharedMemory()
 {
-	// Discard the packet - no payload.
-	mStream.read<OpenEventStream>();
-
-	std::unique_lock<std::mutex> lock(mEventMutex);
-
-	// Attempt to open a listening socket on a random port.
-	// Try 16 times.
-	uint8_t triesLeft = 16;
-	do {
-		triesLeft--;
-		try {
-			// Use the range 49152–65535 (ephemeral ports) which IANA does not reserve.
-			// This reduces the probability of clashes with other services.
-			const uint16_t PortMin = 49152;
-			const uint16_t PortMax = 65535;
-			uint16_t port = (std::rand()%((PortMax - PortMin) + 1)) + PortMin;
-			Socket socket(port);
-			// If the socket bind succeeds, tell the client this port.
-			// We won't be trying again anymore.
-			triesLeft = 0;
-			mStream.write<SimplePacket<PacketType::Payload, uint16_t>>(port).flush();
-			// There is a chance, however small, that the client will try to connect
-			// before we go into "accept()", but there's nothing we can do about it.
-			std::unique_ptr<PacketStream> stream(new PacketStream(socket.accept()));
-			// If opening the stream succeeded, replace the existing event stream.
-			mEventStream = std::move(stream);
-			return;
-		} catch (const Socket::Error&) {
-			// The socket failed to bind, we'll try again (maybe).
-		} catch (...) {
-			// any other error, we give up.
-			break;
-		}
-	} while (triesLeft != 0);
-
-	// Couldn't open a socket - tell the client to continue without one.
-	mStream.write<SimplePacket<PacketType::Payload, uint16_t>>(0);
+	OpenSharedMemory packet = mStream.read<OpenSharedMemory>();
+
+	std::unique_ptr<SharedMemory> sharedMemory;
+	try {
+		sharedMemory.reset(new SharedMemory(packet.mName, packet.mRingSize));
+	} catch (const std::system_error& e) {
+		// Not fatal; payloads keep going through the socket.
+		std::clog << "Could not map the client's shared memory: " << e.what() << '\n';
+		mStream.write<ErrorPacket>(CL_OUT_OF_RESOURCES);
+		return;
+	}
+	mStream.write<SuccessPacket>({});
+	mStream.attach(std::move(sharedMemory));
 }
 
 bool ServerInstance::handleNextPacket()
 {
-	switch (mStream.nextPacketTy()) {
+	const PacketType ty = mStream.nextPacketTy();
+	mReplyExpected = IsAcknowledged(ty);
+	switch (ty) {
 		case PacketType::Terminate:
 			std::clog << "Client terminated connection. ";
-			if (mEventStream) {
-				mEventStream->write<TerminatePacket>({});
-				mEventStream.reset();
-			}
 			return false;
 
 		case PacketType::GetDeviceIDs:
@@ -278,20 +434,23 @@ bool ServerInstance::handleNextPacket()
 			setUserEventStatus();
 			break;
 
-		case PacketType::Release:
-			handleRelease();
-			break;
-		case PacketType::Retain:
-			handleRetain();
+		case PacketType::RefCounts:
+			handleRefCounts();
 			break;
 
 		case PacketType::RegisterEventCallback:
 			registerEventCallback();
 			break;
 
-		case PacketType::EventStreamOpen:
-			// This should only happen once, but not a real issue if called multiple times.
-			createEventStream();
+		case PacketType::SharedMemoryOpen:
+			openSharedMemory();
+			break;
+
+		case PacketType::ChannelOpen:
+			openChannel();
+			break;
+		case PacketType::ChannelSync:
+			syncChannel();
 			break;
 
 		case PacketType:: Payload:
@@ -303,8 +462,11 @@ bool ServerInstance::handleNextPacket()
 		case PacketType::Error:
 		case PacketType::IDList:
 		case PacketType::Version:
+		case PacketType::Inventory:
 		case PacketType::CallbackTrigger:
-		case PacketType::EventCallbackTrigger:
+		case PacketType::ReadData:
+		case PacketType::ChannelAddress:
+		case PacketType::ChannelHello:
 			// The client shouldn't send these packet types.
 			std::cerr << "Unexpected packet\n";
 			// This will terminate the connection with the client.
@@ -316,6 +478,13 @@ bool ServerInstance::handleNextPacket()
 }
 
 void ServerInstance::run()
+{
+	while (serve()) {
+		// The next serve() waits for more packets.
+	}
+}
+
+bool ServerInstance::serve()
 {
 	bool shouldContinue = true;
 	do {
@@ -323,8 +492,20 @@ void ServerInstance::run()
 			shouldContinue = handleNextPacket();
 		} catch (const std::bad_alloc&) {
 			// Technically it's server memory as the client might actually have enough.
-			mStream.write<ErrorPacket>(CL_OUT_OF_HOST_MEMORY);
+			// An error packet in place of no reply would be taken for the reply to a later command.
+			if (mReplyExpected) mStream.write<ErrorPacket>(CL_OUT_OF_HOST_MEMORY);
+			else deferError(CL_OUT_OF_HOST_MEMORY);
 		}
-		mStream.flush();
-	} while (shouldContinue);
+		// Commands on the other channels may wait on this one.
+		if (mChannel != 0 || !mChannelThreads.empty()) publishProgress(mStream.bytesRead());
+		// Replies are flushed once every buffered command has been handled, so a batch
+		// of commands from the client is answered with a single send.
+	} while (shouldContinue && mStream.batchBuffered());
+	mStream.flush();
+	return shouldContinue;
+}
+
+bool ServerInstance::receive()
+{
+	return mStream.receiveBatch();
 }
@@ -21,37 +21,160 @@
 #include "idtype.h"
 #include "socket.h"
 #include "packetstream.h"
-#include "CL/cl_platform.h"
+#include "staging.h"
+#include "CL/cl.h"
 
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
 #include <mutex>
 #include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <unordered_map>
 
 namespace RemoteCL
 {
+struct KernelArgValue;
+
 namespace Server
 {
+/// Settings shared by all the connections of a server, from its command line.
+struct ServerConfig
+{
+	/// The Unix domain socket path the server listens on, or empty if it listens on a TCP port.
+	std::string mLocalPath;
+	/// Initial size of the connection stream buffers.
+	std::size_t mBufferSize = SocketStream::DefaultBufferSize;
+};
+
+/// The state of a connection shared by the instances serving its channels.
+struct ConnectionState
+{
+	/// List of allocated CL objects. The entry of NullID stays empty.
+	std::vector<void*> mObjects{nullptr};
+	/// List of CL objects created under a client-allocated ID, indexed without the ClientIDFlag.
+	std::vector<void*> mClientObjects;
+	/// Reverse index of both tables.
+	std::unordered_map<void*, IDType> mIDs;
+	/// Dropped entries of mObjects, ready for reuse.
+	std::vector<IDType> mFreeIDs;
+	/// Serialises accesses to the object tables above.
+	std::mutex mObjectsMutex;
+
+	/// Number of bytes handled by each channel, by index. The main channel is 0. Set to the
+	/// largest value once the channel is closed, so that nothing waits on it any more.
+	std::vector<uint64_t> mProgress{0};
+	std::mutex mProgressMutex;
+	std::condition_variable mProgressCondition;
+
+	/// Pinned host memory staging the buffer transfers of every channel.
+	StagingPool mStaging;
+};
+
 class ServerInstance
 {
 public:
-	ServerInstance(Socket socket);
+	ServerInstance(Socket socket, const ServerConfig& config = ServerConfig());
+	/// Stops the non-blocking reads still in flight from sending their data, and waits on
+	/// the channels of the connection to close.
+	~ServerInstance();
+
+	/// Loads the OpenCL platforms and enumerates their devices ahead of the first client,
+	/// so that a process started before its connection does not pay for it on the first call.
+	static void warmUp() noexcept;
 
+	/// Serves the client until it disconnects.
 	void run();
+	/// Handles the next packet and any other batches of them already received whole, then
+	/// flushes the replies. Only blocks if no packet has been received yet, or to wait on the
+	/// rest of a batch.
+	/// @returns false once the client has disconnected.
+	bool serve();
+	/// Receives the packets which have arrived, without waiting on more.
+	/// @returns true if serve() can handle the next batch without waiting on the client for
+	/// long, or if the client has disconnected.
+	bool receive();
+
+	/// Sends the packets the server sends on its own initiative: the data of the non-blocking
+	/// reads once they complete, and callback triggers. They are queued from the threads of the
+	/// event callbacks, which must not block on the socket, and sent by a thread of its own,
+	/// started with the first of them. The callbacks hold on to it, as they may run after the
+	/// instance ends.
+	class Outbox
+	{
+	public:
+		explicit Outbox(PacketStream& stream) noexcept : mStream(&stream) {}
+		Outbox(const Outbox&) = delete;
+		Outbox& operator=(const Outbox&) = delete;
+
+		/// Counts a read whose data is going to be sent.
+		void expectRead();
+		/// Checks if the data of some reads has not been sent yet.
+		bool readsPending();
+		/// Queues the data of a read, or its failure, for the client.
+		void sendReadData(uint32_t readID, cl_int status, std::vector<uint8_t> data) noexcept;
+		/// Queues a callback trigger for the client.
+		void sendTrigger(uint32_t callbackID, cl_int status) noexcept;
+		/// Drops what has not been sent yet, and waits on the sending thread.
+		void close() noexcept;
+
+	private:
+		struct Message
+		{
+			/// Either the data of a read, or a callback trigger.
+			bool mIsRead;
+			uint32_t mID;
+			cl_int mStatus;
+			std::vector<uint8_t> mData;
+		};
+
+		void post(Message message) noexcept;
+		/// Sends the queued packets until the outbox is closed.
+		void run() noexcept;
+		/// Writes a packet out. The caller must not hold mMutex.
+		static void send(PacketStream& stream, const Message& message) noexcept;
 
-	/// Signals the client application that an event callback has triggered.
-	void triggerEventCallback(cl_int code, IDType callbackID) noexcept;
-	void triggerProgramCallback(IDType callbackID) noexcept;
+		/// The stream to send the packets through, or nullptr once the instance has ended.
+		PacketStream* mStream;
+		std::deque<Message> mQueue;
+		/// Number of reads whose data has not been sent yet.
+		std::size_t mPendingReads = 0;
+		std::mutex mMutex;
+		std::condition_variable mCondition;
+		std::thread mThread;
+	};
 
 private:
+	/// The index of no channel, for channel connections which have not said which one they are.
+	static constexpr uint32_t NoChannel = UINT32_MAX;
+
+	/// Serves a channel of the connection of another instance, which shares its state.
+	ServerInstance(Socket socket, const ServerConfig& config, std::shared_ptr<ConnectionState> state,
+	               uint32_t channel);
+
 	/// Waits for the next packet. Called continuously as long as it return true;
 	bool handleNextPacket();
 
+	/// Writes every platform and device, with their unchanging info, for the client.
+	void sendInventory();
 	void sendPlatformList();
+	/// Retrieves the value of a platform info parameter, as sent to the client.
+	cl_int platformInfo(cl_platform_id platform, uint32_t param, std::vector<uint8_t>& value);
 	void getPlatformInfo();
 	void sendDeviceList();
+	/// Retrieves the value of a device info parameter, as sent to the client: IDs and sizes
+	/// are translated into IDType and uint64_t.
+	cl_int deviceInfo(cl_device_id device, uint32_t param, std::vector<uint8_t>& value);
 	void getDeviceInfo();
 
-	void handleRetain();
-	void handleRelease();
+	/// Retains or releases the object of this type.
+	cl_int changeRefCount(char objTy, IDType id, bool retain);
+	/// Applies the reference count changes batched by the client, deferring any error.
+	void handleRefCounts();
 
 	void createContext();
 	void createContextFromType();
@@ -76,6 +199,8 @@ private:
 	void createKernels();
 	void cloneKernel();
 	void setKernelArg();
+	/// Sets the kernel arguments recorded by the client, which accompany a launch.
+	cl_int applyKernelArgs(IDType kernelID, const std::vector<KernelArgValue>& args);
 	void getKernelInfo();
 	void getKernelArgInfo();
 	void getKernelWGInfo();
@@ -86,10 +211,33 @@ private:
 	void getImageInfo();
 
 	void createBuffer();
+	/// Creates a buffer whose CL_MEM_COPY_HOST_PTR data arrives in chunks, and writes each of
+	/// them to the device as it arrives.
+	/// @returns the buffer, or nullptr with the error in errCode.
+	cl_mem createBufferFromChunks(cl_context context, cl_mem_flags flags, std::size_t size,
+	                              cl_int& errCode);
 	void createSubBuffer();
 	void readBuffer();
+	/// Sends the data of a large blocking read in chunks, each as soon as it has been read off
+	/// the device, while the next ones are being read.
+	void sendReadChunks(cl_command_queue queue, cl_mem buffer, std::size_t offset, std::size_t size,
+	                    const std::vector<cl_event>& events);
 	void readBufferRect();
 	void writeBuffer();
+	/// Enqueues the non-blocking write of a chunk to the device, given the index of the chunk,
+	/// its offset in the data, its size and its data, and returns the event of the write.
+	using ChunkWriter = std::function<cl_int(std::size_t index, std::size_t offset, std::size_t size,
+	                                         const void* data, cl_event* event)>;
+	/// Writes the data of a large write to the device chunk by chunk, as it arrives.
+	/// @param chunkSize The size of the largest chunk.
+	/// @param wait Wait for the device to have the data. Otherwise, each chunk is kept until its
+	///        write completes.
+	/// @returns the first error, if any.
+	cl_int writeChunks(cl_command_queue queue, std::size_t size, std::size_t chunkSize,
+	                   const ChunkWriter& write, bool wait);
+	/// Receives the chunks of a large write into one piece of memory, or drops them if data
+	/// is nullptr.
+	void receiveChunks(uint8_t* data, std::size_t size);
 	void fillBuffer();
 
 	void getMemObjInfo();
@@ -103,39 +251,119 @@ private:
 	void setUserEventStatus();
 	void registerEventCallback();
 
-	void createEventStream();
+	void openSharedMemory();
+
+	/// Opens another channel to the connection, and serves it from a new thread.
+	void openChannel();
+	/// Waits until another channel has been handled up to the point given by the client.
+	void syncChannel();
+	/// Reads the first packet of a channel, once it has been received.
+	/// @returns the index of the channel it connects, or NoChannel if it is not a ChannelHello
+	/// with this token.
+	uint32_t acceptHello(uint64_t token);
+	/// Accepts the connections of the channels opened and not connected yet, and starts serving
+	/// each of them. Runs on mAcceptThread until there are none left.
+	void acceptChannels();
+	/// Records how far the channel has been handled, for the others to wait on.
+	void publishProgress(uint64_t bytes);
+
+	/// Records an error raised by a command for which the client does not wait on a reply.
+	/// Only the first error is kept until it is reported.
+	void deferError(cl_int err) noexcept;
+	/// Sends the pending deferred error, if any, in place of a synchronous reply.
+	/// @returns true if an error packet was written.
+	bool reportDeferredError();
+
+	/// Finds space in the memory shared with the client where a reply payload of this size
+	/// can be produced, if it is safe to do so (see SharedPayloadSpace).
+	void* payloadSpace(std::size_t size);
 
 	PacketStream mStream;
+	std::shared_ptr<Outbox> mOutbox;
+
+	/// First error raised by an un-acknowledged command, or CL_SUCCESS (0).
+	cl_int mDeferredError = 0;
+	/// The client waits on a reply to the command being handled.
+	bool mReplyExpected = true;
 
-	/// Used to serialise event signals.
-	std::mutex mEventMutex;
-	/// The event stream connection, if available.
-	std::unique_ptr<PacketStream> mEventStream;
+	const ServerConfig mConfig;
+
+	std::shared_ptr<ConnectionState> mState;
+	/// Index of the channel served by this instance; 0 for the instance of the connection.
+	/// NoChannel until a channel connection has said which channel it is.
+	uint32_t mChannel;
+	/// Where the client connects the channels it opens, once it has opened one.
+	std::unique_ptr<Socket> mChannelListener;
+	/// The Unix domain socket path of mChannelListener, if it is one.
+	std::string mChannelPath;
+	uint64_t mChannelToken = 0;
+	/// Guards the members below, and mChannelThreads once mAcceptThread has started.
+	std::mutex mAcceptMutex;
+	/// The channels opened and not connected yet, by index, with the time they are given up at.
+	std::unordered_map<uint32_t, std::chrono::steady_clock::time_point> mPendingChannels;
+	/// Runs acceptChannels() while mAccepting is set.
+	std::thread mAcceptThread;
+	bool mAccepting = false;
+	/// Tells mAcceptThread to give up on the pending channels, as the connection is closing.
+	bool mClosing = false;
+	/// Threads serving the channels opened through this instance.
+	std::vector<std::thread> mChannelThreads;
 
 	/// Retrieves or assigns an ID for this object.
 	template<typename T>
 	IDType getIDFor(T obj)
 	{
 		static_assert(std::is_pointer<T>::value, "Must be a pointer type");
+		if (obj == nullptr) return NullID;
+		ConnectionState& state = *mState;
+		std::unique_lock<std::mutex> lock(state.mObjectsMutex);
+		auto it = state.mIDs.find(obj);
+		if (it != state.mIDs.end()) return it->second;
+
+		// Not assigned yet. Prefer recycling the ID of a dropped object.
 		IDType id;
-		for (id = 0; id < mObjects.size(); id++) {
-			if (mObjects[id] == obj) return id;
+		if (!state.mFreeIDs.empty()) {
+			id = state.mFreeIDs.back();
+			state.mFreeIDs.pop_back();
+			state.mObjects[id] = obj;
+		} else {
+			if (state.mObjects.size() >= ClientIDFlag) throw std::bad_alloc();
+			id = static_cast<IDType>(state.mObjects.size());
+			state.mObjects.push_back(obj);
 		}
-		// Not assigned yet.
-		mObjects.push_back(obj);
+		state.mIDs.emplace(obj, id);
 		return id;
 	}
 
+	/// Binds this object to an ID allocated by the client.
+	template<typename T>
+	void bindID(IDType id, T obj)
+	{
+		static_assert(std::is_pointer<T>::value, "Must be a pointer type");
+		assert((id & ClientIDFlag) != 0 && "Not a client-allocated ID");
+		ConnectionState& state = *mState;
+		std::unique_lock<std::mutex> lock(state.mObjectsMutex);
+		const std::size_t index = id & ~ClientIDFlag;
+		if (state.mClientObjects.size() <= index) state.mClientObjects.resize(index+1);
+		state.mClientObjects[index] = obj;
+		state.mIDs[obj] = id;
+	}
+
+	/// Forgets the object for this ID, once the client released its last reference.
+	/// Server-allocated IDs are recycled here; the client recycles its own.
+	void dropID(IDType id);
+
 	/// Retrieves the object for this ID.
 	template<typename T>
 	T getObj(IDType id)
 	{
-		if (id >= mObjects.size()) return nullptr;
-		return reinterpret_cast<T>(mObjects[id]);
+		ConnectionState& state = *mState;
+		std::unique_lock<std::mutex> lock(state.mObjectsMutex);
+		const std::vector<void*>& objects = (id & ClientIDFlag) != 0 ? state.mClientObjects : state.mObjects;
+		const std::size_t index = id & ~ClientIDFlag;
+		if (index >= objects.size()) return nullptr;
+		return reinterpret_cast<T>(objects[index]);
 	}
-
-	/// List of allocated CL objects.
-	std::vector<void*> mObjects;
 };
 } // namespace server
 } // namespace RemoteCL
@@ -14,18 +14,32 @@
 // along with RemoteCL.  If not, see <https://www.gnu.org/licenses/>.
 
 #include <iostream>
+#include <cerrno>
 #include <cstring> // std::strcmp
 #include <cstdlib> // std::strtoul
+#include <cstdio> // std::remove
+#include <set>
+#include <string>
 #if defined(REMOTECL_SERVER_USE_THREADS)
 #include <thread>
 #else
 #include <unistd.h> // for fork()
 #include <signal.h>
+#include <sys/wait.h>
+#if defined(__linux__)
+#include <sys/prctl.h>
+#endif
 #endif
 #include <system_error>
+#if !defined(_MSC_VER)
+#include <sys/stat.h> // lstat
+#endif
 
 #include "instance.h"
 #include "socket.h"
+#if defined(REMOTECL_SERVER_EPOLL)
+#include "sessions.h"
+#endif
 
 using namespace RemoteCL;
 using namespace RemoteCL::Server;
@@ -43,18 +57,113 @@ void IgnoreSigChild()
 		std::cerr << "Unable to set ignore child signals - child processes will become zombies." << std::endl;
 	}
 }
+
+/// Write end of the pipe through which the pre-forked workers tell the server that they took
+/// a connection, by sending their PID. The server sends itself 0 once a worker exits.
+int gWorkerPipe = -1;
+
+void NotifyWorkerExit(int)
+{
+	const int savedErrno = errno;
+	const pid_t exited = 0;
+	if (write(gWorkerPipe, &exited, sizeof(exited)) < 0) {
+		// The server reaps the worker with the next one that exits.
+	}
+	errno = savedErrno;
+}
+
+/// Keeps this many worker processes waiting on the server socket, each warmed up ahead of
+/// its connection and serving just that one. Returns in the workers once they are done.
+void RunPreforked(Socket& server, const ServerConfig& config, unsigned long workers)
+{
+	int notifications[2];
+	if (pipe(notifications) != 0) {
+		throw std::system_error(errno, std::generic_category(), "Unable to create the worker pipe");
+	}
+	gWorkerPipe = notifications[1];
+	struct sigaction action = {};
+	action.sa_handler = NotifyWorkerExit;
+	action.sa_flags = SA_NOCLDSTOP|SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	if (sigaction(SIGCHLD, &action, nullptr) != 0) {
+		throw std::system_error(errno, std::generic_category(), "Unable to watch the workers");
+	}
+
+	// The workers waiting for a connection.
+	std::set<pid_t> idle;
+	while (true) {
+		while (idle.size() < workers) {
+			pid_t child = fork();
+			if (child == 0) {
+				close(notifications[0]);
+				signal(SIGCHLD, SIG_DFL);
+#if defined(__linux__)
+				// Idle workers stop with the server, but a worker keeps its connection.
+				prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+				ServerInstance::warmUp();
+				try {
+					// The kernel hands each connection to one of the workers blocked here.
+					Socket client = server.accept();
+#if defined(__linux__)
+					prctl(PR_SET_PDEATHSIG, 0);
+#endif
+					server.close();
+					// The server forks the replacement of this worker straight away.
+					const pid_t self = getpid();
+					if (write(notifications[1], &self, sizeof(self)) < 0) {
+						// The server replaces this worker once it exits instead.
+					}
+					close(notifications[1]);
+					std::clog << "Incoming connection from " << client.getPeerName().data
+					          << " to PID " << self << '\n';
+					ServerInstance(std::move(client), config).run();
+					std::clog << "Child instance " << self << " exiting.\n";
+				}
+				catch (const std::system_error& e) {
+					std::clog << "System error while starting client handler: " << e.what() << std::endl;
+				}
+				catch (const Socket::Error&) {
+					std::clog << "Incoming connection lost\n";
+				}
+				return;
+			} else if (child == -1) {
+				std::cerr << "Worker fork failed; retrying once a worker is taken or exits.\n";
+				// Without a worker left to wait on, retry in a while.
+				if (idle.empty()) sleep(1);
+				break;
+			}
+			idle.insert(child);
+		}
+		if (idle.empty()) continue;
+
+		pid_t worker;
+		if (read(notifications[0], &worker, sizeof(worker)) != sizeof(worker)) continue;
+		if (worker != 0) {
+			// That worker took a connection.
+			idle.erase(worker);
+			continue;
+		}
+		// Reap the workers that exited, and replace those which had not taken a connection.
+		pid_t exited;
+		while ((exited = waitpid(-1, nullptr, WNOHANG)) > 0) {
+			idle.erase(exited);
+		}
+	}
+}
 }
 #endif
 
 int main(int argc, char* argv[])
 {
-#if !defined(REMOTECL_SERVER_USE_THREADS)
-	// We don't care about child processes ending.
-	IgnoreSigChild();
-#endif
 	uint16_t port = Socket::DefaultPort;
+	ServerConfig config;
+	const std::string& localPath = config.mLocalPath;
+	// Serve all connections from this process with this many workers, if not 0.
+	unsigned long workers = 0;
+	// Keep this many warmed-up processes waiting for connections, if not 0.
+	unsigned long preforked = 0;
 	for (int i = 1; i < argc; ++i) {
-		// The only argument we currently support is "--port".
 		if (std::strcmp(argv[i], "--port") == 0) {
 			++i;
 			if (i == argc) {
@@ -68,10 +177,69 @@ int main(int argc, char* argv[])
 				std::cerr << "Couldn't understand port number " << argv[i] << '\n';
 				return -1;
 			}
+		} else if (std::strcmp(argv[i], "--unix") == 0) {
+			++i;
+			if (i == argc) {
+				std::cerr << "Missing argument for --unix.\n";
+				return -1;
+			}
+			config.mLocalPath = argv[i];
+		} else if (std::strcmp(argv[i], "--buffer") == 0) {
+			++i;
+			if (i == argc) {
+				std::cerr << "Missing argument for --buffer.\n";
+				return -1;
+			}
+			char* end;
+			const unsigned long kib = std::strtoul(argv[i], &end, 10);
+			if (*end != '\0' || end == argv[i]) {
+				std::cerr << "Couldn't understand buffer size " << argv[i] << '\n';
+				return -1;
+			}
+			config.mBufferSize = kib << 10;
+#if defined(REMOTECL_SERVER_EPOLL)
+		} else if (std::strcmp(argv[i], "--workers") == 0) {
+			++i;
+			if (i == argc) {
+				std::cerr << "Missing argument for --workers.\n";
+				return -1;
+			}
+			char* end;
+			workers = std::strtoul(argv[i], &end, 10);
+			if (*end != '\0' || end == argv[i] || workers == 0) {
+				std::cerr << "Couldn't understand worker count " << argv[i] << '\n';
+				return -1;
+			}
+#endif
+#if !defined(REMOTECL_SERVER_USE_THREADS)
+		} else if (std::strcmp(argv[i], "--prefork") == 0) {
+			++i;
+			if (i == argc) {
+				std::cerr << "Missing argument for --prefork.\n";
+				return -1;
+			}
+			char* end;
+			preforked = std::strtoul(argv[i], &end, 10);
+			if (*end != '\0' || end == argv[i] || preforked == 0) {
+				std::cerr << "Couldn't understand worker count " << argv[i] << '\n';
+				return -1;
+			}
+#endif
 		} else if (std::strcmp(argv[i], "--help") == 0) {
 			std::cout << "RemoteCL server binary. Start with:\n";
-			std::cout << argv[0] << " [--port number]\n";
+			std::cout << argv[0] << " [--port number | --unix path] [--buffer KiB]\n";
 			std::cout << "where the default port is " << Socket::DefaultPort << '\n';
+			std::cout << "--unix listens on a Unix domain socket at path, for clients on this machine.\n";
+			std::cout << "--buffer sets the initial size of the connection buffers (default "
+			          << (SocketStream::DefaultBufferSize >> 10) << ").\n";
+#if defined(REMOTECL_SERVER_EPOLL)
+			std::cout << "--workers serves all connections from this process, with that many threads\n"
+			          << "running their commands, rather than starting a process per connection.\n";
+#endif
+#if !defined(REMOTECL_SERVER_USE_THREADS)
+			std::cout << "--prefork keeps that many processes with OpenCL loaded waiting for connections,\n"
+			          << "rather than starting a process once a connection comes in.\n";
+#endif
 			return 0;
 		} else {
 			std::cerr << "Unknown argument " << argv[i] << "\n";
@@ -79,10 +247,61 @@ int main(int argc, char* argv[])
 		}
 	}
 
-	std::clog << "Opening server port at " << port << '\n';
+	if (localPath.empty()) {
+		std::clog << "Opening server port at " << port << '\n';
+	} else {
+		std::clog << "Opening server socket at " << localPath << '\n';
+		// Remove the socket file left behind by a previous server, but not a file of another kind.
+#if !defined(_MSC_VER)
+		struct stat status;
+		if (lstat(localPath.c_str(), &status) == 0) {
+			if (!S_ISSOCK(status.st_mode)) {
+				std::cerr << localPath << " exists and is not a socket.\n";
+				return -1;
+			}
+			std::remove(localPath.c_str());
+		}
+#else
+		std::remove(localPath.c_str());
+#endif
+	}
+
+	if (workers != 0 && preforked != 0) {
+		std::cerr << "--workers and --prefork cannot be used together.\n";
+		return -1;
+	}
+
+#if !defined(REMOTECL_SERVER_USE_THREADS)
+	// Pre-forked workers are waited on; otherwise, we don't care about child processes ending.
+	if (preforked == 0) IgnoreSigChild();
+#endif
 
 	try {
-		Socket server(port);
+		Socket server = localPath.empty() ? Socket(port) : Socket::listenLocal(localPath.c_str());
+#if !defined(REMOTECL_SERVER_USE_THREADS)
+		if (preforked != 0) {
+			std::clog << "Pre-forking " << preforked << " workers\n";
+			try {
+				RunPreforked(server, config, preforked);
+			} catch (const std::system_error& e) {
+				std::cerr << e.what() << '\n';
+				return -1;
+			}
+			return 0;
+		}
+#endif
+#if defined(REMOTECL_SERVER_EPOLL)
+		if (workers != 0) {
+			std::clog << "Serving connections with " << workers << " workers\n";
+			try {
+				SessionLoop(config, workers).run(server);
+			} catch (const std::system_error& e) {
+				std::cerr << "Unable to start the session loop: " << e.what() << '\n';
+				return -1;
+			}
+			return 0;
+		}
+#endif
 
 		bool running = true;
 		do {
@@ -90,8 +309,8 @@ int main(int argc, char* argv[])
 				Socket client = server.accept();
 				std::clog << "Incoming connection from " << client.getPeerName().data << '\n';
 #if defined(REMOTECL_SERVER_USE_THREADS)
-				std::thread([](Socket socket){ServerInstance(std::move(socket)).run();},
-				            std::move(client)).detach();
+				std::thread([](Socket socket, ServerConfig config){ServerInstance(std::move(socket), config).run();},
+				            std::move(client), config).detach();
 #else
 				pid_t child = fork();
 				if (child == 0) {
@@ -100,7 +319,7 @@ int main(int argc, char* argv[])
 					// The accept loop no longer makes sense.
 					running = false;
 					// off we go.
-					ServerInstance(std::move(client)).run();
+					ServerInstance(std::move(client), config).run();
 					// This log message does not get printed if the
 					// instance dies through an exception.
 					std::clog << "Child instance " << getpid() << " exiting.\n";
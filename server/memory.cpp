@@ -19,14 +19,47 @@
 
 #include "packets/memory.h"
 #include "packets/IDs.h"
+#include "packets/callbacks.h"
 #include "packets/commands.h"
 #include "packets/payload.h"
 
 #include "hints.h"
 
+#include <algorithm>
+
 using namespace RemoteCL;
 using namespace RemoteCL::Server;
 
+namespace
+{
+/// A non-blocking read, whose data is sent back to the client once it has completed.
+struct BackgroundRead
+{
+	std::shared_ptr<ServerInstance::Outbox> mOutbox;
+	uint32_t mReadID;
+	std::vector<uint8_t> mData;
+};
+
+/// Blocking reads larger than this are sent in chunks (see ServerInstance::sendReadChunks).
+constexpr std::size_t ReadChunkThreshold = 8 << 20;
+/// Bounds of the chunk size, which adapts to whether the device or the connection is slower.
+constexpr std::size_t MinReadChunk = 4 << 20;
+constexpr std::size_t MaxReadChunk = 16 << 20;
+/// Number of chunks read ahead of the one being sent, plus one.
+constexpr std::size_t ReadChunkSlots = 3;
+/// Number of chunks being written to the device while the next one arrives, plus one.
+constexpr std::size_t WriteChunkSlots = 3;
+
+void CL_CALLBACK ReadCompleteCallback(cl_event event, cl_int status, void* data)
+{
+	std::unique_ptr<BackgroundRead> read(static_cast<BackgroundRead*>(data));
+	// Only queued: the callback must not wait on the client.
+	read->mOutbox->sendReadData(read->mReadID, status, std::move(read->mData));
+	// Drop the reference taken for this callback.
+	clReleaseEvent(event);
+}
+}
+
 void ServerInstance::createBuffer()
 {
 	CreateBuffer packet = mStream.read<CreateBuffer>();
@@ -34,20 +67,73 @@ void ServerInstance::createBuffer()
 	cl_context context = getObj<cl_context>(packet.mContextID);
 	cl_mem_flags flags = packet.mFlags;
 	std::size_t size = packet.mSize;
-	std::vector<uint8_t> hostData;
-	void* hostDataPtr = nullptr;
-	if (packet.mExpectPayload) {
-		Payload<> payload = mStream.read<Payload<>>();
-		hostData = std::move(payload.mData);
-		hostDataPtr = hostData.data();
-	}
 	cl_int errCode = CL_SUCCESS;
-	cl_mem buffer = clCreateBuffer(context, flags, size, hostDataPtr, &errCode);
+	cl_mem buffer;
+	if (packet.mExpectPayload && size > WriteChunkThreshold) {
+		buffer = createBufferFromChunks(context, flags, size, errCode);
+	} else {
+		// The implementation copies the data on creation, so it can be used in place.
+		PayloadView<> hostData;
+		if (packet.mExpectPayload) mStream.read(hostData);
+		buffer = clCreateBuffer(context, flags, size, const_cast<void*>(hostData.mPtr), &errCode);
+	}
+	// The client does not wait on creation; a failure leaves the ID unbound.
 	if (Unlikely(errCode != CL_SUCCESS)) {
-		mStream.write<ErrorPacket>(errCode);
+		deferError(errCode);
 	} else {
-		mStream.write<IDPacket>(getIDFor(buffer));
+		bindID(packet.mID, buffer);
+	}
+}
+
+cl_mem ServerInstance::createBufferFromChunks(cl_context context, cl_mem_flags flags, std::size_t size,
+                                              cl_int& errCode)
+{
+	// The chunks are written through a queue of the server, on the first device of the context.
+	cl_command_queue queue = nullptr;
+#if defined(CL_VERSION_1_2)
+	// Unless the host may not write the buffer.
+	if ((flags & (CL_MEM_HOST_READ_ONLY | CL_MEM_HOST_NO_ACCESS)) == 0)
+#endif
+	{
+		std::size_t devicesSize = 0;
+		errCode = clGetContextInfo(context, CL_CONTEXT_DEVICES, 0, nullptr, &devicesSize);
+		std::vector<cl_device_id> devices(devicesSize / sizeof(cl_device_id));
+		if (errCode == CL_SUCCESS && !devices.empty()) {
+			errCode = clGetContextInfo(context, CL_CONTEXT_DEVICES, devicesSize, devices.data(), nullptr);
+		}
+		if (errCode == CL_SUCCESS && !devices.empty()) {
+			queue = clCreateCommandQueue(context, devices[0], 0, &errCode);
+			if (errCode != CL_SUCCESS) queue = nullptr;
+		}
+	}
+	if (queue == nullptr) {
+		// The chunks are put back together, for the implementation to copy on creation.
+		std::unique_ptr<uint8_t[]> data(new uint8_t[size]);
+		receiveChunks(data.get(), size);
+		return clCreateBuffer(context, flags, size, data.get(), &errCode);
+	}
+
+	cl_mem buffer = clCreateBuffer(context, flags & ~CL_MEM_COPY_HOST_PTR, size, nullptr, &errCode);
+	try {
+		if (errCode == CL_SUCCESS) {
+			errCode = writeChunks(queue, size, WriteChunkSize,
+				[&](std::size_t, std::size_t offset, std::size_t chunkSize, const void* data, cl_event* event) {
+					return clEnqueueWriteBuffer(queue, buffer, false, offset, chunkSize, data, 0, nullptr, event);
+				}, true);
+		} else {
+			receiveChunks(nullptr, size);
+		}
+	} catch (...) {
+		if (errCode == CL_SUCCESS) clReleaseMemObject(buffer);
+		clReleaseCommandQueue(queue);
+		throw;
+	}
+	clReleaseCommandQueue(queue);
+	if (Unlikely(errCode != CL_SUCCESS) && buffer != nullptr) {
+		clReleaseMemObject(buffer);
+		buffer = nullptr;
 	}
+	return buffer;
 }
 
 void ServerInstance::createSubBuffer()
@@ -63,15 +149,16 @@ void ServerInstance::createSubBuffer()
 	cl_int errCode = CL_SUCCESS;
 	cl_mem sub = clCreateSubBuffer(buffer, flags, type, &region, &errCode);
 	if (Unlikely(errCode != CL_SUCCESS)) {
-		mStream.write<ErrorPacket>(errCode);
+		deferError(errCode);
 	} else {
-		mStream.write<IDPacket>(getIDFor(sub));
+		bindID(packet.mID, sub);
 	}
 }
 
 void ServerInstance::readBuffer()
 {
 	ReadBuffer packet = mStream.read<ReadBuffer>();
+	mReplyExpected = packet.mReadID == 0;
 
 	std::vector<cl_event> events;
 	if (packet.mExpectEventList) {
@@ -82,16 +169,73 @@ void ServerInstance::readBuffer()
 		}
 	}
 
+	cl_mem buffer = getObj<cl_mem>(packet.mBufferID);
+	cl_command_queue queue = getObj<cl_command_queue>(packet.mQueueID);
+
+	if (packet.mReadID != 0) {
+		// The client does not wait on a non-blocking read; its data follows once it completes.
+		std::unique_ptr<BackgroundRead> read;
+		try {
+			read.reset(new BackgroundRead{mOutbox, packet.mReadID, {}});
+			read->mData.resize(packet.mSize);
+		} catch (const std::bad_alloc&) {
+			deferError(CL_OUT_OF_HOST_MEMORY);
+			mStream.write(ReadDataPacket(packet.mReadID, CL_OUT_OF_HOST_MEMORY));
+			return;
+		}
+		cl_event command;
+		cl_int err = clEnqueueReadBuffer(queue, buffer, false, packet.mOffset,
+		                                 packet.mSize, read->mData.data(),
+		                                 events.size(), events.data(), &command);
+		if (Unlikely(err != CL_SUCCESS)) {
+			deferError(err);
+			// Let the client know the data is not coming.
+			mStream.write(ReadDataPacket(packet.mReadID, err));
+			return;
+		}
+		if (packet.mWantEvent) {
+			bindID(packet.mEventID, command);
+			// The callback holds its own reference, whatever the client does with the event.
+			clRetainEvent(command);
+		}
+		mOutbox->expectRead();
+		err = clSetEventCallback(command, CL_COMPLETE, ReadCompleteCallback, read.get());
+		if (Unlikely(err != CL_SUCCESS)) {
+			// Hand the data over once the read completes, from this thread.
+			cl_int waited = clWaitForEvents(1, &command);
+			ReadCompleteCallback(command, waited == CL_SUCCESS ? CL_COMPLETE : waited, read.release());
+			return;
+		}
+		read.release();
+		return;
+	}
+
+	// Read straight into the memory shared with the client, if possible, or else into staging
+	// memory, which is sent from where it is.
+	StagingPool::Lease staging;
 	std::vector<uint8_t> data;
-	data.resize(packet.mSize);
+	void* out = payloadSpace(packet.mSize);
+	if (out == nullptr && packet.mSize > ReadChunkThreshold && !packet.mWantEvent) {
+		// The event would not be the one of a single read.
+		if (reportDeferredError()) return;
+		sendReadChunks(queue, buffer, packet.mOffset, packet.mSize, events);
+		return;
+	}
+	if (out == nullptr) {
+		staging = mState->mStaging.acquire(queue, packet.mSize);
+		out = staging.data();
+	}
+	if (out == nullptr) {
+		data.resize(packet.mSize);
+		out = data.data();
+	}
 
 	cl_event retEvent;
 	cl_event* event = packet.mWantEvent ? &retEvent : nullptr;
-	cl_mem buffer = getObj<cl_mem>(packet.mBufferID);
-	cl_command_queue queue = getObj<cl_command_queue>(packet.mQueueID);
-	// We don't support background reading of buffer data, so block the command.
+	// Blocking reads reply synchronously, so report any pending error now.
+	if (reportDeferredError()) return;
 	cl_int err = clEnqueueReadBuffer(queue, buffer, true, packet.mOffset,
-	                                 packet.mSize, data.data(),
+	                                 packet.mSize, out,
 	                                 events.size(), events.data(), event);
 
 	if (Unlikely(err != CL_SUCCESS)) {
@@ -99,9 +243,80 @@ void ServerInstance::readBuffer()
 		return;
 	}
 	if (packet.mWantEvent) {
-		mStream.write<IDPacket>(getIDFor(retEvent));
+		bindID(packet.mEventID, retEvent);
 	}
-	mStream.write<PayloadPtr<>>({data.data(), data.size()});
+	mStream.write<PayloadPtr<>>({out, packet.mSize});
+}
+
+void ServerInstance::sendReadChunks(cl_command_queue queue, cl_mem buffer, std::size_t offset,
+                                    std::size_t size, const std::vector<cl_event>& events)
+{
+	struct Slot
+	{
+		StagingPool::Lease mStaging;
+		std::unique_ptr<uint8_t[]> mData;
+		void* mPtr = nullptr;
+		std::size_t mSize = 0;
+		/// The read of the chunk in the slot, or nullptr if the slot is not being read into.
+		cl_event mEvent = nullptr;
+	};
+	Slot slots[ReadChunkSlots];
+	const std::size_t slotSize = std::min(size, MaxReadChunk);
+	for (Slot& slot : slots) {
+		slot.mStaging = mState->mStaging.acquire(queue, slotSize);
+		slot.mPtr = slot.mStaging.data();
+		if (slot.mPtr == nullptr) {
+			slot.mData.reset(new uint8_t[slotSize]);
+			slot.mPtr = slot.mData.get();
+		}
+	}
+
+	std::size_t chunk = MinReadChunk;
+	std::size_t enqueued = 0;
+	cl_int err = CL_SUCCESS;
+	auto enqueue = [&](Slot& slot) {
+		slot.mSize = std::min(chunk, size - enqueued);
+		err = clEnqueueReadBuffer(queue, buffer, false, offset + enqueued, slot.mSize, slot.mPtr,
+		                          events.size(), events.data(), &slot.mEvent);
+		if (Unlikely(err != CL_SUCCESS)) {
+			slot.mEvent = nullptr;
+			return false;
+		}
+		enqueued += slot.mSize;
+		return true;
+	};
+
+	for (Slot& slot : slots) {
+		if (enqueued == size || !enqueue(slot)) break;
+	}
+	clFlush(queue);
+	std::size_t current = 0;
+	while (err == CL_SUCCESS && slots[current].mEvent) {
+		Slot& slot = slots[current];
+		current = (current + 1) % ReadChunkSlots;
+		cl_int status = CL_QUEUED;
+		clGetEventInfo(slot.mEvent, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, nullptr);
+		err = clWaitForEvents(1, &slot.mEvent);
+		clReleaseEvent(slot.mEvent);
+		slot.mEvent = nullptr;
+		if (Unlikely(err != CL_SUCCESS)) break;
+
+		mStream.write<PayloadPtr<>>({slot.mPtr, slot.mSize}).flush();
+		// A chunk read before it was needed means the connection is the slower: larger chunks
+		// then take fewer sends. Otherwise, smaller ones get the data moving sooner.
+		if (status == CL_COMPLETE) chunk = std::min(chunk * 2, MaxReadChunk);
+		else chunk = std::max(chunk / 2, MinReadChunk);
+		if (enqueued < size && enqueue(slot)) clFlush(queue);
+	}
+
+	// The reads still in flight after a failure must be done with the slots before they go.
+	for (Slot& slot : slots) {
+		if (!slot.mEvent) continue;
+		clWaitForEvents(1, &slot.mEvent);
+		clReleaseEvent(slot.mEvent);
+	}
+	// The client stops at the error, whatever it has received.
+	if (Unlikely(err != CL_SUCCESS)) mStream.write<ErrorPacket>(err);
 }
 
 void ServerInstance::readBufferRect()
@@ -117,40 +332,53 @@ void ServerInstance::readBufferRect()
 		}
 	}
 
+	cl_mem buffer = getObj<cl_mem>(packet.mBufferID);
+	cl_command_queue queue = getObj<cl_command_queue>(packet.mQueueID);
+
+	StagingPool::Lease staging;
 	std::vector<uint8_t> data;
 	size_t row_pitch = packet.mHostRowPitch > 0 ? packet.mHostRowPitch : packet.mRegion[0];
 	size_t slice_pitch = packet.mHostSlicePitch > 0 ? packet.mHostSlicePitch : packet.mRegion[1] * row_pitch;
 	size_t dataSize = slice_pitch * packet.mRegion[2];
-	data.resize(dataSize);
+	void* out = payloadSpace(dataSize);
+	if (out == nullptr) {
+		staging = mState->mStaging.acquire(queue, dataSize);
+		out = staging.data();
+	}
+	if (out == nullptr) {
+		data.resize(dataSize);
+		out = data.data();
+	}
 
 	cl_event retEvent;
 	cl_event* event = packet.mWantEvent ? &retEvent : nullptr;
-	cl_mem buffer = getObj<cl_mem>(packet.mBufferID);
-	cl_command_queue queue = getObj<cl_command_queue>(packet.mQueueID);
 	std::size_t bufferOrigin[3] = {packet.mBufferOrigin[0], packet.mBufferOrigin[1],
 								   packet.mBufferOrigin[2]};
 	std::size_t hostOrigin[3] = {packet.mHostOrigin[0], packet.mHostOrigin[1],
 								 packet.mHostOrigin[2]};
 	std::size_t region[3] = {packet.mRegion[0], packet.mRegion[1], packet.mRegion[2]};
+	// Reads always reply synchronously, so report any pending error now.
+	if (reportDeferredError()) return;
 	// We don't support background reading of buffer data, so block the command.
 	cl_int err = clEnqueueReadBufferRect(queue, buffer, true, bufferOrigin, hostOrigin, region,
 	                                     packet.mBufferRowPitch, packet.mBufferSlicePitch,
 	                                     packet.mHostRowPitch, packet.mHostSlicePitch,
-	                                     data.data(), events.size(), events.data(), event);
+	                                     out, events.size(), events.data(), event);
 
 	if (Unlikely(err != CL_SUCCESS)) {
 		mStream.write<ErrorPacket>(err);
 		return;
 	}
 	if (packet.mWantEvent) {
-		mStream.write<IDPacket>(getIDFor(retEvent));
+		bindID(packet.mEventID, retEvent);
 	}
-	mStream.write<PayloadPtr<>>({data.data(), data.size()});
+	mStream.write<PayloadPtr<>>({out, dataSize});
 }
 
 void ServerInstance::writeBuffer()
 {
 	WriteBuffer packet = mStream.read<WriteBuffer>();
+	mReplyExpected = packet.mBlock;
 
 	std::vector<cl_event> events;
 	if (packet.mExpectEventList) {
@@ -161,24 +389,201 @@ void ServerInstance::writeBuffer()
 		}
 	}
 
-	Payload<> data = mStream.read<Payload<>>();
-
-	cl_event retEvent;
-	cl_event* event = packet.mWantEvent ? &retEvent : nullptr;
 	cl_mem buffer = getObj<cl_mem>(packet.mBufferID);
 	cl_command_queue queue = getObj<cl_command_queue>(packet.mQueueID);
+
+	const bool chunked = packet.mSize > WriteChunkThreshold;
+	if (chunked && !packet.mWantEvent) {
+		// A blocking write is a synchronisation point for the client, which a pending error stops.
+		if (packet.mBlock && mDeferredError != CL_SUCCESS) {
+			receiveChunks(nullptr, packet.mSize);
+			reportDeferredError();
+			return;
+		}
+		const cl_int err = writeChunks(queue, packet.mSize, WriteChunkSize,
+			[&](std::size_t, std::size_t offset, std::size_t size, const void* data, cl_event* event) {
+				return clEnqueueWriteBuffer(queue, buffer, false, packet.mOffset + offset, size, data,
+				                            events.size(), events.data(), event);
+			}, packet.mBlock);
+		if (packet.mBlock) {
+			if (Unlikely(err != CL_SUCCESS)) mStream.write<ErrorPacket>(err);
+			else mStream.write<SuccessPacket>({});
+		} else if (Unlikely(err != CL_SUCCESS)) {
+			deferError(err);
+		}
+		return;
+	}
+
+	// Data moved through shared memory is handed to the driver in place. The data of other
+	// blocking writes is received straight into the buffer, or else into staging memory.
+	const bool direct = !chunked && packet.mBlock && !mStream.sharedMemory() &&
+	                    packet.mSize >= StagingPool::MinSize;
+	// The event would be the one of the unmap, and a deferred error must stop the write.
+	if (direct && !packet.mWantEvent && mDeferredError == CL_SUCCESS) {
+		cl_int err = CL_SUCCESS;
+		void* mapped = clEnqueueMapBuffer(queue, buffer, CL_TRUE, CL_MAP_WRITE_INVALIDATE_REGION,
+		                                  packet.mOffset, packet.mSize,
+		                                  events.size(), events.data(), nullptr, &err);
+		if (err == CL_SUCCESS) {
+			mStream.read(PayloadInto<>(mapped, packet.mSize));
+			cl_event unmapped;
+			err = clEnqueueUnmapMemObject(queue, buffer, mapped, 0, nullptr, &unmapped);
+			if (Likely(err == CL_SUCCESS)) {
+				// The data must be in the buffer for the commands of the other queues.
+				err = clWaitForEvents(1, &unmapped);
+				clReleaseEvent(unmapped);
+			}
+			if (Unlikely(err != CL_SUCCESS)) mStream.write<ErrorPacket>(err);
+			else mStream.write<SuccessPacket>({});
+			return;
+		}
+		// Otherwise, the write reports why the buffer cannot be written.
+	}
+	StagingPool::Lease staging;
+	if (direct) staging = mState->mStaging.acquire(queue, packet.mSize);
+	PayloadView<> data;
+	if (staging.data()) {
+		mStream.read(PayloadInto<>(staging.data(), packet.mSize));
+		data.mPtr = staging.data();
+		data.mSize = packet.mSize;
+	} else if (chunked) {
+		// The chunks are put back together for a single write, whose event is returned.
+		data.mData.reset(new uint8_t[packet.mSize]);
+		receiveChunks(data.mData.get(), packet.mSize);
+		data.mPtr = data.mData.get();
+		data.mSize = packet.mSize;
+	} else {
+		mStream.read(data);
+		// The driver may read the data of a non-blocking write after the next payload has arrived.
+		if (!packet.mBlock) data.own();
+	}
+
+	// A blocking write is a synchronisation point for the client.
+	if (packet.mBlock && reportDeferredError()) return;
+
+	cl_event retEvent;
+	// The data of a non-blocking write is kept until its event completes.
+	cl_event* event = packet.mWantEvent || !packet.mBlock ? &retEvent : nullptr;
 	cl_int err = clEnqueueWriteBuffer(queue, buffer, packet.mBlock, packet.mOffset,
-	                                  data.mData.size(), data.mData.data(),
+	                                  data.mSize, data.mPtr,
 	                                  events.size(), events.data(), event);
 
+	// Non-blocking writes are not acknowledged.
 	if (Unlikely(err != CL_SUCCESS)) {
-		mStream.write<ErrorPacket>(err);
+		if (packet.mBlock) mStream.write<ErrorPacket>(err);
+		else deferError(err);
 		return;
 	}
+	if (!packet.mBlock) KeepUntilComplete(retEvent, std::move(data.mData));
 	if (packet.mWantEvent) {
-		mStream.write<IDPacket>(getIDFor(retEvent));
+		bindID(packet.mEventID, retEvent);
+	} else if (!packet.mBlock) {
+		clReleaseEvent(retEvent);
+	}
+	if (packet.mBlock) {
+		mStream.write<SuccessPacket>({});
+	}
+}
+
+cl_int ServerInstance::writeChunks(cl_command_queue queue, std::size_t size, std::size_t chunkSize,
+                                   const ChunkWriter& write, bool wait)
+{
+	if (!wait) {
+		// Nothing is waited on: each chunk gets memory of its own, freed once its write completes.
+		cl_int err = CL_SUCCESS;
+		std::size_t index = 0;
+		for (std::size_t received = 0; received < size; ++index) {
+			// Every chunk is read, even once the write has failed.
+			PayloadView<> chunk;
+			mStream.read(chunk);
+			if (Unlikely(chunk.mSize == 0 || chunk.mSize > chunkSize || chunk.mSize > size - received)) {
+				throw Socket::Error();
+			}
+			if (err == CL_SUCCESS) {
+				chunk.own();
+				cl_event event;
+				err = write(index, received, chunk.mSize, chunk.mPtr, &event);
+				if (Likely(err == CL_SUCCESS)) {
+					KeepUntilComplete(event, std::move(chunk.mData));
+					clReleaseEvent(event);
+					clFlush(queue);
+				}
+			}
+			received += chunk.mSize;
+		}
+		return err;
+	}
+
+	struct Slot
+	{
+		StagingPool::Lease mStaging;
+		std::unique_ptr<uint8_t[]> mData;
+		void* mPtr = nullptr;
+		/// The write of the chunk in the slot, or nullptr if the slot is free.
+		cl_event mEvent = nullptr;
+	};
+	Slot slots[WriteChunkSlots];
+	cl_int err = CL_SUCCESS;
+	// Waits for the device to have the data of the slot.
+	auto complete = [&err](Slot& slot) {
+		if (!slot.mEvent) return;
+		const cl_int waited = clWaitForEvents(1, &slot.mEvent);
+		if (err == CL_SUCCESS) err = waited;
+		clReleaseEvent(slot.mEvent);
+		slot.mEvent = nullptr;
+	};
+
+	try {
+		std::size_t index = 0;
+		for (std::size_t received = 0; received < size; ++index) {
+			Slot& slot = slots[index % WriteChunkSlots];
+			complete(slot);
+			if (slot.mPtr == nullptr) {
+				slot.mStaging = mState->mStaging.acquire(queue, chunkSize);
+				slot.mPtr = slot.mStaging.data();
+				if (slot.mPtr == nullptr) {
+					slot.mData.reset(new uint8_t[chunkSize]);
+					slot.mPtr = slot.mData.get();
+				}
+			}
+
+			// Every chunk is read, even once the write has failed.
+			PayloadInto<> chunk(slot.mPtr, chunkSize);
+			mStream.read(chunk);
+			if (Unlikely(chunk.mSize == 0 || chunk.mSize > size - received)) throw Socket::Error();
+			if (err == CL_SUCCESS) {
+				err = write(index, received, chunk.mSize, slot.mPtr, &slot.mEvent);
+				if (Unlikely(err != CL_SUCCESS)) slot.mEvent = nullptr;
+				else clFlush(queue);
+			}
+			received += chunk.mSize;
+		}
+	} catch (...) {
+		// The device must be done with the slots before they go.
+		for (Slot& slot : slots) complete(slot);
+		throw;
+	}
+	// The data must be in the buffer for the commands of the other queues, too.
+	for (Slot& slot : slots) complete(slot);
+	return err;
+}
+
+void ServerInstance::receiveChunks(uint8_t* data, std::size_t size)
+{
+	for (std::size_t received = 0; received < size;) {
+		std::size_t chunkSize;
+		if (data != nullptr) {
+			PayloadInto<> chunk(data + received, size - received);
+			mStream.read(chunk);
+			chunkSize = chunk.mSize;
+		} else {
+			PayloadView<> dropped;
+			mStream.read(dropped);
+			chunkSize = dropped.mSize;
+		}
+		if (Unlikely(chunkSize == 0)) throw Socket::Error();
+		received += chunkSize;
 	}
-	mStream.write<SuccessPacket>({});
 }
 
 void ServerInstance::fillBuffer()
@@ -202,14 +607,14 @@ void ServerInstance::fillBuffer()
 	                                 packet.mPatternSize, packet.mOffset, packet.mSize,
 	                                 events.size(), events.data(), event);
 
+	// Fills are not acknowledged.
 	if (Unlikely(err != CL_SUCCESS)) {
-		mStream.write<ErrorPacket>(err);
+		deferError(err);
 		return;
 	}
 	if (packet.mWantEvent) {
-		mStream.write<IDPacket>(getIDFor(retEvent));
+		bindID(packet.mEventID, retEvent);
 	}
-	mStream.write<SuccessPacket>({});
 }
 
 void ServerInstance::getMemObjInfo()
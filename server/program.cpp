@@ -25,6 +25,9 @@
 
 #include "hints.h"
 
+#include <cstring>
+#include <limits>
+#include <memory>
 #include <vector>
 
 using namespace RemoteCL;
@@ -34,28 +37,70 @@ namespace
 {
 struct CallbackBlock
 {
-	ServerInstance *instance;
+	/// Holds on to the outbox, as the instance may have ended by the time the callback runs.
+	std::shared_ptr<ServerInstance::Outbox> outbox;
 	/// Client-side ID for the callback.
 	IDType ID;
 };
 
 void CL_CALLBACK ProgramCallback(cl_program, void* data)
 {
-	CallbackBlock *block = reinterpret_cast<CallbackBlock*>(data);
-	block->instance->triggerProgramCallback(block->ID);
-	// Block should probably be deleted here - we're currently leaking it.
-	// Is it possible for the same event to be executed more than once?
+	std::unique_ptr<CallbackBlock> block(reinterpret_cast<CallbackBlock*>(data));
+	// Only queued: the callback must not wait on the client.
+	// It is called once per build, which gets a block of its own.
+	block->outbox->sendTrigger(block->ID, CL_SUCCESS);
 }
 
 using ProgramCallbackFn = void (CL_CALLBACK *) (cl_program, void*);
+
+/// Describes how each argument of the kernel is passed, so that the client can set
+/// arguments without querying them first.
+cl_int GetKernelSignature(cl_kernel kernel, std::string& signature)
+{
+	cl_uint numArgs = 0;
+	cl_int err = clGetKernelInfo(kernel, CL_KERNEL_NUM_ARGS, sizeof(numArgs), &numArgs, nullptr);
+	if (Unlikely(err != CL_SUCCESS)) return err;
+
+	signature.resize(numArgs);
+	for (cl_uint i = 0; i < numArgs; ++i) {
+		cl_kernel_arg_address_qualifier AS;
+		err = clGetKernelArgInfo(kernel, i, CL_KERNEL_ARG_ADDRESS_QUALIFIER, sizeof(AS), &AS, nullptr);
+		if (Unlikely(err != CL_SUCCESS)) return err;
+
+		KernelArgKind kind = KernelArgKind::Value;
+		if (AS == CL_KERNEL_ARG_ADDRESS_GLOBAL || AS == CL_KERNEL_ARG_ADDRESS_CONSTANT) {
+			kind = KernelArgKind::MemObject;
+		} else if (AS == CL_KERNEL_ARG_ADDRESS_LOCAL) {
+			kind = KernelArgKind::LocalSize;
+		}
+		signature[i] = static_cast<char>(kind);
+	}
+	return CL_SUCCESS;
 }
 
-void ServerInstance::triggerProgramCallback(IDType callbackID) noexcept
+/// Reads a string info value of the kernel, terminator included. Left empty if the query fails.
+void GetKernelString(cl_kernel kernel, cl_kernel_info param, std::string& value)
 {
-	std::unique_lock<std::mutex> lock(mEventMutex);
-	if (!mEventStream) return;
-	// Tell the client there's an incoming event.
-	mEventStream->write<CallbackTriggerPacket>(callbackID);
+	std::size_t size = 0;
+	if (clGetKernelInfo(kernel, param, 0, nullptr, &size) != CL_SUCCESS ||
+	    size > std::numeric_limits<uint16_t>::max()) {
+		return;
+	}
+	value.resize(size);
+	if (clGetKernelInfo(kernel, param, size, &value[0], nullptr) != CL_SUCCESS) value.clear();
+}
+
+/// Describes the kernel for the client: its signature, and the info which cannot change.
+cl_int DescribeKernel(cl_kernel kernel, KernelDescription& description)
+{
+	cl_int err = GetKernelSignature(kernel, description.mSignature);
+	if (Unlikely(err != CL_SUCCESS)) return err;
+	GetKernelString(kernel, CL_KERNEL_FUNCTION_NAME, description.mName);
+#if defined(CL_VERSION_1_2)
+	GetKernelString(kernel, CL_KERNEL_ATTRIBUTES, description.mAttributes);
+#endif
+	return CL_SUCCESS;
+}
 }
 
 void ServerInstance::compileProgram()
@@ -81,24 +126,27 @@ void ServerInstance::compileProgram()
 		headerNames.push_back(name.c_str());
 	}
 
-	void* userData = nullptr;
+	std::unique_ptr<CallbackBlock> block;
 	ProgramCallbackFn fnPtr = nullptr;
 
 	if (packet.mHasCallback) {
-		auto* block = new CallbackBlock;
+		block.reset(new CallbackBlock);
 		block->ID = packet.mCallbackID;
-		userData = static_cast<void*>(block);
+		block->outbox = mOutbox;
 		fnPtr = &ProgramCallback;
 	}
 
 	cl_int err =
 		clCompileProgram(program, devices.size(), devices.data(),
 		                 packet.mOptions.c_str(), headers.size(),
-		                 headers.data(), headerNames.data(), fnPtr, userData);
+		                 headers.data(), headerNames.data(), fnPtr, block.get());
 
 	if (Unlikely(err != CL_SUCCESS)) {
+		// The callback is not called, and the block goes here.
 		mStream.write<ErrorPacket>(err);
 	} else {
+		// Owned by the callback from now on.
+		block.release();
 		mStream.write<SuccessPacket>({});
 	}
 }
@@ -309,14 +357,24 @@ void ServerInstance::createKernel()
 {
 	KernelName name = mStream.read<KernelName>();
 
-	cl_program program = getObj<cl_program>(name.mID);
+	cl_program program = getObj<cl_program>(name.mProgramID);
 	cl_int err = CL_SUCCESS;
-	cl_kernel kernel = clCreateKernel(program, name.mString.c_str(), &err);
+	cl_kernel kernel = clCreateKernel(program, name.mName.c_str(), &err);
 	if (Unlikely(err != CL_SUCCESS)) {
 		mStream.write<ErrorPacket>(err);
-	} else {
-		mStream.write<IDPacket>(getIDFor(kernel));
+		return;
+	}
+
+	// The kernel is bound to the client's ID; reply with its description only.
+	KernelDescription description;
+	err = DescribeKernel(kernel, description);
+	if (Unlikely(err != CL_SUCCESS)) {
+		clReleaseKernel(kernel);
+		mStream.write<ErrorPacket>(err);
+		return;
 	}
+	bindID(name.mKernelID, kernel);
+	mStream.write(description);
 }
 
 void ServerInstance::createKernels()
@@ -347,12 +405,28 @@ void ServerInstance::createKernels()
 	}
 	assert(kernelCount <= packet.mKernelCount);
 
+	// Each ID is followed by the description of that kernel.
+	std::vector<KernelDescription> descriptions(kernelCount);
+	for (cl_uint i = 0; i < kernelCount; ++i) {
+		err = DescribeKernel(kernels[i], descriptions[i]);
+		if (Unlikely(err != CL_SUCCESS)) {
+			for (cl_uint k = 0; k < kernelCount; ++k) {
+				clReleaseKernel(kernels[k]);
+			}
+			mStream.write<ErrorPacket>(err);
+			return;
+		}
+	}
+
 	IDListPacket reply;
 	reply.mIDs.resize(kernelCount);
 	for (cl_uint i = 0; i < kernelCount; ++i) {
 		reply.mIDs[i] = getIDFor(kernels[i]);
 	}
 	mStream.write(reply);
+	for (const KernelDescription& description : descriptions) {
+		mStream.write(description);
+	}
 }
 
 void ServerInstance::cloneKernel()
@@ -378,47 +452,51 @@ void ServerInstance::setKernelArg()
 	cl_uint argIndex = arg.mArgIndex;
 	cl_kernel kernel = getObj<cl_kernel>(arg.mKernelID);
 
-	// Try to figure out the type of the kernel argument.
-	cl_kernel_arg_address_qualifier AS;
-	std::size_t retSize = 0;
-	cl_int err = clGetKernelArgInfo(kernel, argIndex, CL_KERNEL_ARG_ADDRESS_QUALIFIER, sizeof(AS), &AS, &retSize);
-	if (Unlikely(err != CL_SUCCESS)) {
-		// Probably the index is out of range.
-		mStream.write<ErrorPacket>(err);
-		return;
-	}
-
-	// Depending on the address space, ask the client to either send an ID (if this is a buffer or image)
-	// or send the payload of the underlying data (might be a constant or size of local memory).
-	if (AS == CL_KERNEL_ARG_ADDRESS_GLOBAL || AS == CL_KERNEL_ARG_ADDRESS_CONSTANT) {
-		// Ask for an ID.
-		mStream.write<SimplePacket<PacketType::Payload, char>>('I');
-		mStream.flush();
+	// The client classified the argument from the signature sent at creation,
+	// and follows up with the matching value packet.
+	cl_int err = CL_SUCCESS;
+	if (arg.mKind == KernelArgKind::MemObject) {
 		const IDType argID = mStream.read<IDPacket>();
 		cl_mem memObj = getObj<cl_mem>(argID);
-		// Retry the set kernel arg command.
 		err = clSetKernelArg(kernel, argIndex, sizeof(cl_mem), &memObj);
-	} else if (AS == CL_KERNEL_ARG_ADDRESS_LOCAL) {
-		// Ask for a size for the local memory buffer.
-		mStream.write<SimplePacket<PacketType::Payload, char>>('S');
-		mStream.flush();
+	} else if (arg.mKind == KernelArgKind::LocalSize) {
 		uint32_t size = mStream.read<SimplePacket<PacketType::Payload, uint32_t>>();
 		err = clSetKernelArg(kernel, argIndex, size, nullptr);
 	} else {
-		// Ask for a payload.
-		mStream.write<SimplePacket<PacketType::Payload, char>>('P');
-		mStream.flush();
 		Payload<> payload = mStream.read<Payload<>>();
-		// Retry the set kernel arg command.
 		err = clSetKernelArg(kernel, argIndex, payload.mData.size(), payload.mData.data());
 	}
 
+	// The client does not wait on arguments.
 	if (Unlikely(err != CL_SUCCESS)) {
-		// Probably the index is out of range.
-		mStream.write<ErrorPacket>(err);
-	} else {
-		mStream.write<SuccessPacket>({});
+		deferError(err);
+	}
+}
+
+cl_int ServerInstance::applyKernelArgs(IDType kernelID, const std::vector<KernelArgValue>& args)
+{
+	if (args.empty()) return CL_SUCCESS;
+	cl_kernel kernel = getObj<cl_kernel>(kernelID);
+
+	for (const KernelArgValue& arg : args) {
+		cl_int err;
+		if (arg.mKind == KernelArgKind::MemObject) {
+			IDType argID;
+			if (Unlikely(arg.mData.size() != sizeof(argID))) return CL_INVALID_ARG_SIZE;
+			std::memcpy(&argID, arg.mData.data(), sizeof(argID));
+			cl_mem memObj = getObj<cl_mem>(argID);
+			err = clSetKernelArg(kernel, arg.mIndex, sizeof(cl_mem), &memObj);
+		} else if (arg.mKind == KernelArgKind::LocalSize) {
+			uint32_t size;
+			if (Unlikely(arg.mData.size() != sizeof(size))) return CL_INVALID_ARG_SIZE;
+			std::memcpy(&size, arg.mData.data(), sizeof(size));
+			err = clSetKernelArg(kernel, arg.mIndex, size, nullptr);
+		} else {
+			err = clSetKernelArg(kernel, arg.mIndex, arg.mData.size(), arg.mData.data());
+		}
+		if (Unlikely(err != CL_SUCCESS)) return err;
 	}
+	return CL_SUCCESS;
 }
 
 void ServerInstance::getKernelInfo()
@@ -541,7 +619,7 @@ void ServerInstance::getKernelWGInfo()
 			translated[0] = sizes[0];
 			translated[1] = sizes[1];
 			translated[2] = sizes[2];
-			mStream.write(PayloadPtr<uint8_t>(translated, 3));
+			mStream.write(PayloadPtr<uint8_t>(translated, sizeof(translated)));
 			break;
 		}
 
@@ -149,7 +149,7 @@ void ServerInstance::finishQueue()
 	cl_int err = clFinish(queue);
 	if (Unlikely(err != CL_SUCCESS)) {
 		mStream.write<ErrorPacket>(err);
-	} else {
+	} else if (!reportDeferredError()) {
 		mStream.write<SuccessPacket>({});
 	}
 }
@@ -15,6 +15,8 @@
 
 #include "instance.h"
 
+#include <cassert>
+
 #include "CL/cl.h"
 
 #include "hints.h"
@@ -24,151 +26,69 @@
 using namespace RemoteCL;
 using namespace RemoteCL::Server;
 
-
-void ServerInstance::handleRelease()
+cl_int ServerInstance::changeRefCount(char objTy, IDType id, bool retain)
 {
-	Release packet = mStream.read<Release>();
-	switch (packet.mObjTy) {
+	switch (objTy) {
 		case 'D':
 		{
-			cl_uint err = clReleaseDevice(getObj<cl_device_id>(packet.mID));
-			if (Unlikely(err != CL_SUCCESS)) {
-				mStream.write<ErrorPacket>(err);
-				return;
-			}
-			break;
+			cl_device_id device = getObj<cl_device_id>(id);
+			return retain ? clRetainDevice(device) : clReleaseDevice(device);
 		}
 		case 'C':
 		{
-			cl_uint err = clReleaseContext(getObj<cl_context>(packet.mID));
-			if (Unlikely(err != CL_SUCCESS)) {
-				mStream.write<ErrorPacket>(err);
-				return;
-			}
-			break;
+			cl_context context = getObj<cl_context>(id);
+			return retain ? clRetainContext(context) : clReleaseContext(context);
 		}
 		case 'Q':
 		{
-			cl_uint err = clReleaseCommandQueue(getObj<cl_command_queue>(packet.mID));
-			if (Unlikely(err != CL_SUCCESS)) {
-				mStream.write<ErrorPacket>(err);
-				return;
-			}
-			break;
+			cl_command_queue queue = getObj<cl_command_queue>(id);
+			return retain ? clRetainCommandQueue(queue) : clReleaseCommandQueue(queue);
 		}
 		case 'P':
 		{
-			cl_uint err = clReleaseProgram(getObj<cl_program>(packet.mID));
-			if (Unlikely(err != CL_SUCCESS)) {
-				mStream.write<ErrorPacket>(err);
-				return;
-			}
-			break;
+			cl_program program = getObj<cl_program>(id);
+			return retain ? clRetainProgram(program) : clReleaseProgram(program);
 		}
 		case 'K':
 		{
-			cl_uint err = clReleaseKernel(getObj<cl_kernel>(packet.mID));
-			if (Unlikely(err != CL_SUCCESS)) {
-				mStream.write<ErrorPacket>(ErrorPacket (err));
-				return;
-			}
-			break;
+			cl_kernel kernel = getObj<cl_kernel>(id);
+			return retain ? clRetainKernel(kernel) : clReleaseKernel(kernel);
 		}
 		case 'M':
 		{
-			cl_uint err = clReleaseMemObject(getObj<cl_mem>(packet.mID));
-			if (Unlikely(err != CL_SUCCESS)) {
-				mStream.write<ErrorPacket>(ErrorPacket (err));
-				return;
-			}
-			break;
+			cl_mem memory = getObj<cl_mem>(id);
+			return retain ? clRetainMemObject(memory) : clReleaseMemObject(memory);
 		}
 		case 'E':
 		{
-			cl_uint err = clReleaseEvent(getObj<cl_event>(packet.mID));
-			if (Unlikely(err != CL_SUCCESS)) {
-				mStream.write<ErrorPacket>(ErrorPacket (err));
-				return;
-			}
-			break;
+			cl_event event = getObj<cl_event>(id);
+			return retain ? clRetainEvent(event) : clReleaseEvent(event);
 		}
 		default:
 			assert(false && "invalid object type");
+			return CL_INVALID_VALUE;
 	}
-
-	mStream.write<SuccessPacket>({});
 }
 
-void ServerInstance::handleRetain()
+void ServerInstance::handleRefCounts()
 {
-	Retain packet = mStream.read<Retain>();
-	switch (packet.mObjTy) {
-		case 'D':
-		{
-			cl_uint err = clRetainDevice(getObj<cl_device_id>(packet.mID));
-			if (Unlikely(err != CL_SUCCESS)) {
-				mStream.write<ErrorPacket>(err);
-				return;
-			}
-			break;
+	RefCountBatch batch = mStream.read<RefCountBatch>();
+	for (const RefCountChange& change : batch.mChanges) {
+		cl_int err = CL_SUCCESS;
+		for (int32_t i = change.mDelta; i > 0 && err == CL_SUCCESS; --i) {
+			err = changeRefCount(change.mObjTy, change.mID, true);
 		}
-		case 'C':
-		{
-			cl_uint err = clRetainContext(getObj<cl_context>(packet.mID));
-			if (Unlikely(err != CL_SUCCESS)) {
-				mStream.write<ErrorPacket>(ErrorPacket (err));
-				return;
-			}
-			break;
-		}
-		case 'Q':
-		{
-			cl_uint err = clRetainCommandQueue(getObj<cl_command_queue>(packet.mID));
-			if (Unlikely(err != CL_SUCCESS)) {
-				mStream.write<ErrorPacket>(err);
-				return;
-			}
-			break;
-		}
-		case 'P':
-		{
-			cl_uint err = clRetainProgram(getObj<cl_program>(packet.mID));
-			if (Unlikely(err != CL_SUCCESS)) {
-				mStream.write<ErrorPacket>(err);
-				return;
-			}
-			break;
+		for (int32_t i = change.mDelta; i < 0 && err == CL_SUCCESS; ++i) {
+			err = changeRefCount(change.mObjTy, change.mID, false);
 		}
-		case 'K':
-		{
-			cl_uint err = clRetainKernel(getObj<cl_kernel>(packet.mID));
-			if (Unlikely(err != CL_SUCCESS)) {
-				mStream.write<ErrorPacket>(err);
-				return;
-			}
-			break;
-		}
-		case 'M':
-		{
-			cl_uint err = clRetainMemObject(getObj<cl_mem>(packet.mID));
-			if (Unlikely(err != CL_SUCCESS)) {
-				mStream.write<ErrorPacket>(ErrorPacket (err));
-				return;
-			}
-			break;
-		}
-		case 'E':
-		{
-			cl_uint err = clRetainEvent(getObj<cl_event>(packet.mID));
-			if (Unlikely(err != CL_SUCCESS)) {
-				mStream.write<ErrorPacket>(ErrorPacket (err));
-				return;
-			}
-			break;
+		if (Unlikely(err != CL_SUCCESS)) deferError(err);
+
+		// The client no longer refers to the object. It may outlive its ID if the
+		// runtime still holds it, in which case it gets a new ID if reported again.
+		if (change.mDrop) {
+			// The staging blocks of a context would keep it alive until the session ends.
+			if (change.mObjTy == 'C') mState->mStaging.dropContext(getObj<cl_context>(change.mID));
+			dropID(change.mID);
 		}
-		default:
-			assert(false && "invalid object type");
 	}
-
-	mStream.write<SuccessPacket>({});
 }
@@ -0,0 +1,202 @@
+// This file is part of RemoteCL.
+
+// RemoteCL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// RemoteCL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public License
+// along with RemoteCL.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "sessions.h"
+
+#include <cerrno>
+#include <iostream>
+#include <memory>
+#include <system_error>
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+using namespace RemoteCL;
+using namespace RemoteCL::Server;
+
+struct SessionLoop::Session
+{
+	Session(Socket socket, const ServerConfig& config) :
+		mHandle(socket.handle()), mInstance(std::move(socket), config) {}
+
+	/// The socket of the session, owned by mInstance.
+	const Socket::SocketTy mHandle;
+	ServerInstance mInstance;
+};
+
+SessionLoop::SessionLoop(const ServerConfig& config, unsigned workers) : mConfig(config)
+{
+	mPoll = epoll_create1(EPOLL_CLOEXEC);
+	if (mPoll < 0) throw std::system_error(errno, std::generic_category());
+	try {
+		for (unsigned i = 0; i < workers; ++i) {
+			mWorkers.emplace_back(&SessionLoop::workerMain, this);
+		}
+	} catch (...) {
+		// Stop the workers started so far.
+		stop();
+		throw;
+	}
+}
+
+SessionLoop::~SessionLoop()
+{
+	stop();
+}
+
+void SessionLoop::stop() noexcept
+{
+	{
+		std::unique_lock<std::mutex> lock(mReadyMutex);
+		mStopping = true;
+	}
+	mReadyCondition.notify_all();
+	for (std::thread& worker : mWorkers) {
+		worker.join();
+	}
+	mWorkers.clear();
+	if (mPoll >= 0) ::close(mPoll);
+	mPoll = -1;
+}
+
+void SessionLoop::watch(Session* session, bool first)
+{
+	// One-shot, so that a session is only ever served by one worker at a time.
+	epoll_event event = {};
+	event.events = EPOLLIN | EPOLLONESHOT;
+	event.data.ptr = session;
+	if (epoll_ctl(mPoll, first ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, session->mHandle, &event) != 0) {
+		throw Socket::Error();
+	}
+}
+
+void SessionLoop::run(Socket& server)
+{
+	// The listening socket is told apart from the sessions by its null pointer.
+	epoll_event listen = {};
+	listen.events = EPOLLIN;
+	listen.data.ptr = nullptr;
+	if (epoll_ctl(mPoll, EPOLL_CTL_ADD, server.handle(), &listen) != 0) {
+		throw Socket::Error();
+	}
+
+	epoll_event events[64];
+	while (true) {
+		const int count = epoll_wait(mPoll, events, 64, -1);
+		if (count < 0) {
+			if (errno == EINTR) continue;
+			throw Socket::Error();
+		}
+
+		for (int i = 0; i < count; ++i) {
+			Session* session = static_cast<Session*>(events[i].data.ptr);
+			if (session != nullptr) {
+				bool ready = true;
+				try {
+					// A worker would wait on the rest of a batch which has only partly arrived.
+					ready = session->mInstance.receive();
+					if (!ready) watch(session, false);
+				} catch (const Socket::Error&) {
+					// The worker finds out, and ends the session.
+					ready = true;
+				}
+				if (ready) {
+					{
+						std::unique_lock<std::mutex> lock(mReadyMutex);
+						mReady.push_back(session);
+					}
+					mReadyCondition.notify_one();
+				}
+				continue;
+			}
+
+			try {
+				Socket client = server.accept();
+				std::clog << "Incoming connection from " << client.getPeerName().data << '\n';
+				// The instance greets the client, which a worker does, off this loop.
+				{
+					std::unique_lock<std::mutex> lock(mReadyMutex);
+					mIncoming.push_back(std::move(client));
+				}
+				mReadyCondition.notify_one();
+			} catch (const std::system_error& e) {
+				std::clog << "System error while accepting a client: " << e.what() << std::endl;
+			} catch (const Socket::Error&) {
+				std::clog << "Incoming connection lost\n";
+			}
+		}
+	}
+}
+
+void SessionLoop::start(Socket client) noexcept
+{
+	std::unique_ptr<Session> session;
+	try {
+		// The instance greets the client straight away.
+		session.reset(new Session(std::move(client), mConfig));
+		watch(session.get(), true);
+		session.release();
+	} catch (const std::system_error& e) {
+		std::clog << "System error while starting client handler: " << e.what() << std::endl;
+	} catch (const Socket::Error&) {
+		std::clog << "Incoming connection lost\n";
+	} catch (const std::exception& e) {
+		std::clog << "Session error: " << e.what() << '\n';
+	}
+}
+
+void SessionLoop::workerMain() noexcept
+{
+	while (true) {
+		Session* session = nullptr;
+		std::unique_ptr<Socket> client;
+		{
+			std::unique_lock<std::mutex> lock(mReadyMutex);
+			mReadyCondition.wait(lock, [this]{ return mStopping || !mReady.empty() || !mIncoming.empty(); });
+			if (mStopping) return;
+			if (!mIncoming.empty()) {
+				client.reset(new Socket(std::move(mIncoming.front())));
+				mIncoming.pop_front();
+			} else {
+				session = mReady.front();
+				mReady.pop_front();
+			}
+		}
+
+		if (client) {
+			start(std::move(*client));
+			continue;
+		}
+
+		bool open = false;
+		try {
+			open = session->mInstance.serve();
+			if (open) watch(session, false);
+		} catch (const Socket::Error&) {
+			open = false;
+		} catch (const std::exception& e) {
+			std::clog << "Session error: " << e.what() << '\n';
+			open = false;
+		} catch (...) {
+			std::clog << "Session error\n";
+			open = false;
+		}
+		if (!open) {
+			// Closing the socket also removes it from the epoll set.
+			delete session;
+			std::clog << "Session ended.\n";
+		}
+	}
+}
@@ -0,0 +1,79 @@
+// This file is part of RemoteCL.
+
+// RemoteCL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// RemoteCL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public License
+// along with RemoteCL.  If not, see <https://www.gnu.org/licenses/>.
+
+#if !defined(REMOTECL_SERVER_SESSIONS_H)
+#define REMOTECL_SERVER_SESSIONS_H
+/// @file sessions.h
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "instance.h"
+#include "socket.h"
+
+namespace RemoteCL
+{
+namespace Server
+{
+/// Serves many connections from a single process.
+/// An epoll loop waits on the listening socket and every session. A session which has received
+/// a whole batch of packets is handed to one of a pool of worker threads, which handles those
+/// packets, including any blocking OpenCL calls, and hands the session back to the loop. The
+/// workers also start the sessions of the connections the loop accepts.
+class SessionLoop
+{
+public:
+	/// Starts this many worker threads.
+	SessionLoop(const ServerConfig& config, unsigned workers);
+	SessionLoop(const SessionLoop&) = delete;
+	SessionLoop& operator=(const SessionLoop&) = delete;
+	~SessionLoop();
+
+	/// Accepts and serves connections on this listening socket.
+	/// @throws Socket::Error if waiting on the sockets fails.
+	void run(Socket& server);
+
+private:
+	struct Session;
+
+	/// Waits for sessions with incoming packets, and serves them.
+	void workerMain() noexcept;
+	/// Greets a new client, and watches its session.
+	void start(Socket client) noexcept;
+	/// Stops and joins the workers.
+	void stop() noexcept;
+	/// Waits for the next incoming packet of this session.
+	void watch(Session* session, bool first);
+
+	const ServerConfig mConfig;
+	/// The epoll instance.
+	int mPoll = -1;
+	std::vector<std::thread> mWorkers;
+
+	/// Sessions with incoming packets, waiting on a worker.
+	std::deque<Session*> mReady;
+	/// Accepted connections, waiting on a worker to start their session.
+	std::deque<Socket> mIncoming;
+	std::mutex mReadyMutex;
+	std::condition_variable mReadyCondition;
+	bool mStopping = false;
+};
+}
+}
+
+#endif
@@ -0,0 +1,194 @@
+// This file is part of RemoteCL.
+
+// RemoteCL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// RemoteCL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public License
+// along with RemoteCL.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "staging.h"
+
+#include "hints.h"
+
+using namespace RemoteCL;
+using namespace RemoteCL::Server;
+
+namespace
+{
+void CL_CALLBACK WriteCompleteCallback(cl_event event, cl_int, void* data)
+{
+	delete[] static_cast<uint8_t*>(data);
+	// Drop the reference taken for this callback.
+	clReleaseEvent(event);
+}
+}
+
+StagingPool::Lease& StagingPool::Lease::operator=(Lease&& other) noexcept
+{
+	if (this != &other) {
+		reset();
+		mPool = other.mPool;
+		mIndex = other.mIndex;
+		mPtr = other.mPtr;
+		other.mPool = nullptr;
+	}
+	return *this;
+}
+
+void StagingPool::Lease::reset() noexcept
+{
+	if (mPool) mPool->release(mIndex);
+	mPool = nullptr;
+	mPtr = nullptr;
+}
+
+StagingPool::~StagingPool()
+{
+	for (Block& block : mBlocks) {
+		if (block.mBuffer) destroy(block);
+	}
+}
+
+StagingPool::Lease StagingPool::acquire(cl_command_queue queue, std::size_t size)
+{
+	if (size < MinSize) return Lease();
+	cl_context context;
+	cl_int err = clGetCommandQueueInfo(queue, CL_QUEUE_CONTEXT, sizeof(context), &context, nullptr);
+	if (Unlikely(err != CL_SUCCESS)) return Lease();
+
+	std::unique_lock<std::mutex> lock(mMutex);
+	// The smallest idle block of the context which is large enough.
+	std::size_t best = mBlocks.size();
+	for (std::size_t i = 0; i < mBlocks.size(); ++i) {
+		const Block& block = mBlocks[i];
+		if (!block.mBuffer || block.mInUse || block.mDropped || block.mContext != context ||
+		    block.mSize < size) continue;
+		if (best == mBlocks.size() || block.mSize < mBlocks[best].mSize) best = i;
+	}
+	if (best != mBlocks.size()) {
+		Block& block = mBlocks[best];
+		block.mInUse = true;
+		mIdleSize -= block.mSize;
+		return Lease(this, best, block.mPtr);
+	}
+
+	// Mapping waits on the queue; the other channels may use the pool meanwhile.
+	lock.unlock();
+	Block block;
+	// Round up, so that transfers of about the same size share blocks.
+	if (!allocate(queue, context, (size + MinSize - 1) / MinSize * MinSize, block)) return Lease();
+	block.mInUse = true;
+	lock.lock();
+	std::size_t index = 0;
+	while (index < mBlocks.size() && mBlocks[index].mBuffer) ++index;
+	if (index == mBlocks.size()) mBlocks.emplace_back();
+	mBlocks[index] = block;
+	return Lease(this, index, block.mPtr);
+}
+
+bool StagingPool::allocate(cl_command_queue queue, cl_context context, std::size_t size, Block& block)
+{
+	cl_command_queue own = ownQueue(queue, context);
+	if (Unlikely(own == nullptr)) return false;
+	cl_int err = CL_SUCCESS;
+	cl_mem buffer = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, size, nullptr, &err);
+	if (Unlikely(err != CL_SUCCESS)) {
+		clReleaseCommandQueue(own);
+		return false;
+	}
+	void* ptr = clEnqueueMapBuffer(own, buffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, size,
+	                               0, nullptr, nullptr, &err);
+	if (Unlikely(err != CL_SUCCESS)) {
+		clReleaseMemObject(buffer);
+		clReleaseCommandQueue(own);
+		return false;
+	}
+	block.mContext = context;
+	block.mQueue = own;
+	block.mBuffer = buffer;
+	block.mPtr = ptr;
+	block.mSize = size;
+	return true;
+}
+
+cl_command_queue StagingPool::ownQueue(cl_command_queue queue, cl_context context)
+{
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		for (const Block& block : mBlocks) {
+			if (block.mBuffer && !block.mDropped && block.mContext == context) {
+				clRetainCommandQueue(block.mQueue);
+				return block.mQueue;
+			}
+		}
+	}
+	cl_device_id device;
+	cl_int err = clGetCommandQueueInfo(queue, CL_QUEUE_DEVICE, sizeof(device), &device, nullptr);
+	if (Unlikely(err != CL_SUCCESS)) return nullptr;
+	cl_command_queue own = clCreateCommandQueue(context, device, 0, &err);
+	return err == CL_SUCCESS ? own : nullptr;
+}
+
+void StagingPool::dropContext(cl_context context)
+{
+	std::vector<Block> freed;
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		for (Block& block : mBlocks) {
+			if (!block.mBuffer || block.mContext != context) continue;
+			if (block.mInUse) {
+				block.mDropped = true;
+				continue;
+			}
+			mIdleSize -= block.mSize;
+			freed.push_back(block);
+			block = Block();
+		}
+	}
+	for (Block& block : freed) {
+		destroy(block);
+	}
+}
+
+void StagingPool::destroy(Block& block) noexcept
+{
+	clEnqueueUnmapMemObject(block.mQueue, block.mBuffer, block.mPtr, 0, nullptr, nullptr);
+	clReleaseMemObject(block.mBuffer);
+	clReleaseCommandQueue(block.mQueue);
+	block = Block();
+}
+
+void StagingPool::release(std::size_t index) noexcept
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	Block& block = mBlocks[index];
+	block.mInUse = false;
+	if (!block.mDropped && mIdleSize + block.mSize <= MaxIdleSize) {
+		mIdleSize += block.mSize;
+		return;
+	}
+	// Keeping it would hold on to too much memory.
+	Block freed = block;
+	block = Block();
+	lock.unlock();
+	destroy(freed);
+}
+
+void Server::KeepUntilComplete(cl_event event, std::unique_ptr<uint8_t[]> data)
+{
+	clRetainEvent(event);
+	if (Likely(clSetEventCallback(event, CL_COMPLETE, WriteCompleteCallback, data.get()) == CL_SUCCESS)) {
+		data.release();
+		return;
+	}
+	// Without the callback, the data goes once the write is done.
+	clWaitForEvents(1, &event);
+	WriteCompleteCallback(event, CL_COMPLETE, data.release());
+}
@@ -0,0 +1,126 @@
+// This file is part of RemoteCL.
+
+// RemoteCL is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// RemoteCL is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+
+// You should have received a copy of the GNU Lesser General Public License
+// along with RemoteCL.  If not, see <https://www.gnu.org/licenses/>.
+
+#if !defined(REMOTECL_SERVER_STAGING_H)
+#define REMOTECL_SERVER_STAGING_H
+/// @file staging.h
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "CL/cl.h"
+
+namespace RemoteCL
+{
+namespace Server
+{
+/// Host memory allocated by the OpenCL implementation (CL_MEM_ALLOC_HOST_PTR) and mapped
+/// once, through which buffer transfers are staged. The implementation can DMA to and from
+/// it directly, and the socket sends and receives the data in place.
+/// Blocks belong to the context they were allocated for, and are reused by its transfers
+/// until the client releases the context.
+/// They are mapped through a queue of the pool's own, so that they do not keep the queues
+/// of the client alive.
+class StagingPool
+{
+public:
+	/// Transfers smaller than this are staged in ordinary memory.
+	static constexpr std::size_t MinSize = 64 << 10;
+	/// Idle blocks are freed past this many bytes.
+	static constexpr std::size_t MaxIdleSize = 64 << 20;
+
+	/// A staging block in use, handed back to the pool when destroyed.
+	class Lease
+	{
+	public:
+		Lease() noexcept = default;
+		Lease(Lease&& other) noexcept : mPool(other.mPool), mIndex(other.mIndex), mPtr(other.mPtr)
+		{
+			other.mPool = nullptr;
+		}
+		Lease& operator=(Lease&& other) noexcept;
+		Lease(const Lease&) = delete;
+		Lease& operator=(const Lease&) = delete;
+		~Lease() { reset(); }
+
+		/// The staging memory, or nullptr if none could be had.
+		void* data() const noexcept { return mPtr; }
+		/// Hands the block back to the pool.
+		void reset() noexcept;
+
+	private:
+		friend class StagingPool;
+		Lease(StagingPool* pool, std::size_t index, void* ptr) noexcept : mPool(pool), mIndex(index), mPtr(ptr) {}
+
+		StagingPool* mPool = nullptr;
+		std::size_t mIndex = 0;
+		void* mPtr = nullptr;
+	};
+
+	StagingPool() = default;
+	StagingPool(const StagingPool&) = delete;
+	StagingPool& operator=(const StagingPool&) = delete;
+	/// Unmaps and frees every block. None may be in use any more.
+	~StagingPool();
+
+	/// Takes a block of at least this size, for a transfer through this queue.
+	/// @returns an empty lease if the transfer is too small to be worth staging, or if no
+	/// block can be allocated; the caller then stages it in memory of its own.
+	Lease acquire(cl_command_queue queue, std::size_t size);
+	/// Frees the blocks of a context the client no longer refers to, which keep it alive.
+	/// Those in use are freed once handed back.
+	void dropContext(cl_context context);
+
+private:
+	struct Block
+	{
+		cl_context mContext = nullptr;
+		/// The pool's queue for the context, shared by its blocks, to unmap the buffer with
+		/// once the block is freed.
+		cl_command_queue mQueue = nullptr;
+		cl_mem mBuffer = nullptr;
+		void* mPtr = nullptr;
+		std::size_t mSize = 0;
+		bool mInUse = false;
+		/// Free the block once handed back, rather than keep it for reuse.
+		bool mDropped = false;
+	};
+
+	/// Maps a new block for the context of this queue, or returns false.
+	bool allocate(cl_command_queue queue, cl_context context, std::size_t size, Block& block);
+	/// Takes a reference to the pool's queue for this context, creating it on the device
+	/// of this queue if no block of the context has one. Returns nullptr on failure.
+	cl_command_queue ownQueue(cl_command_queue queue, cl_context context);
+	/// Unmaps and releases the OpenCL objects of this block.
+	static void destroy(Block& block) noexcept;
+	void release(std::size_t index) noexcept;
+
+	/// Free entries are left empty (mBuffer is nullptr) for reuse, so that leases keep their index.
+	std::vector<Block> mBlocks;
+	/// Total size of the blocks which are not in use.
+	std::size_t mIdleSize = 0;
+	std::mutex mMutex;
+};
+
+/// Keeps the source data of a non-blocking write until the device is done with it, and frees
+/// it from the callback of the write's event. The caller keeps its own reference to the event.
+void KeepUntilComplete(cl_event event, std::unique_ptr<uint8_t[]> data);
+}
+}
+
+#endif